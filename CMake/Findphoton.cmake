@@ -1,6 +1,9 @@
 include(FetchContent)
 set(FETCHCONTENT_QUIET false)
 set(PHOTON_ENABLE_EXTFS ON)
+if(ENABLE_IOURING)
+  set(PHOTON_ENABLE_URING ON)
+endif()
 
 if(NOT ORIGIN_EXT2FS)
   set(PHOTON_ENABLE_RESIZE ON)
@@ -17,6 +17,8 @@
 #include <photon/net/http/server.h>
 #include <photon/net/socket.h>
 #include <photon/net/http/url.h>
+#include <cstdlib>
+#include <cstring>
 #include <map>
 #include <string>
 #include <string_view>
@@ -127,15 +129,122 @@ EXIT:
     }
 };
 
+// Manage the file cache pool, format:
+//   /cache?action=stat[&path=${path}]
+//   /cache?action=evict&path=${path} or /cache?action=evict[&size=${bytes}]
+//   /cache?action=quota&path=${path}&size=${bytes}, size 0 removes the quota
+//   /cache?action=rename&path=${path}&to=${path}
+// path is a blob name in the pool, e.g. sha256:xxx, or a dir of blobs.
+class CacheHandler : public ApiHandler {
+public:
+    CacheHandler(ImageService *imgservice) : ApiHandler(imgservice) {}
+
+    int handle_request(photon::net::http::Request& req,
+                       photon::net::http::Response& resp,
+                       std::string_view) override {
+        auto target = req.target();
+        std::string_view query("");
+        auto pos = target.find('?');
+        if (pos != std::string_view::npos) {
+            query = target.substr(pos + 1);
+        }
+        LOG_INFO("Cache query: `", query);
+        params.clear();
+        parse_params(query);
+        auto action = params["action"];
+        auto path = pool_path(params["path"]);
+        auto size_str = params["size"];
+        uint64_t size = size_str.empty() ? 0 : strtoull(size_str.c_str(), nullptr, 10);
+
+        int code = 200, err = 0;
+        std::string msg;
+        auto pool = imgservice->global_fs.cache_pool;
+        if (pool == nullptr) {
+            code = 404;
+            msg = std::string(R"delimiter({
+        "success": false,
+        "message": "File or ocf cache is not enabled"
+})delimiter");
+        } else if (action == "stat") {
+            FileSystem::CacheStat stat;
+            if (pool->stat(&stat, path) < 0) {
+                err = errno;
+                code = err == ENOENT ? 404 : 500;
+            } else {
+                msg = "{\n        \"success\": true,\n" +
+                      field("total_bytes", (uint64_t)stat.total_size * stat.refill_unit) +
+                      field("used_bytes", (uint64_t)stat.used_size * stat.refill_unit) +
+                      field("evict_global_bytes", stat.evict_global) +
+                      field("evict_user_bytes", stat.evict_user) +
+                      field("evict_quota_bytes", stat.evict_other, true) + "}";
+            }
+        } else if (action == "evict") {
+            int ret = params["path"].empty() ? pool->evict((size_t)size) : pool->evict(path);
+            if (ret < 0) {
+                err = errno;
+                code = err == ENOENT ? 404 : err == EBUSY ? 409 : 500;
+            }
+        } else if (action == "quota" && !params["path"].empty()) {
+            if (pool->set_quota(path, size) < 0) {
+                err = errno;
+                code = 400;
+            }
+        } else if (action == "rename" && !params["path"].empty() && !params["to"].empty()) {
+            if (pool->rename(path, pool_path(params["to"])) < 0) {
+                err = errno;
+                code = err == ENOENT ? 404 : (err == EEXIST || err == EBUSY) ? 409 : 500;
+            }
+        } else {
+            code = 400;
+            msg = std::string(R"delimiter({
+        "success": false,
+        "message": "Unknown action or missing params in cache request"
+})delimiter");
+        }
+        if (msg.empty()) {
+            msg = code == 200 ? std::string(R"delimiter({
+        "success": true,
+        "message": "Done"
+})delimiter") : "{\n        \"success\": false,\n        \"message\": \"" +
+                    std::string(strerror(err)) + "\"\n}";
+        }
+
+        resp.set_result(code);
+        resp.headers.content_length(msg.size());
+        resp.keep_alive(true);
+        auto ret_w = resp.write((void*)msg.c_str(), msg.size());
+        if (ret_w != (ssize_t)msg.size()) {
+            LOG_ERRNO_RETURN(0, -1, "send body failed, target: `, `", req.target(), VALUE(ret_w));
+        }
+        return 0;
+    }
+
+    // names in the pool begin with '/'
+    static std::string pool_path(const std::string &path) {
+        if (path.empty() || path[0] == '/') {
+            return path;
+        }
+        return "/" + path;
+    }
+
+    static std::string field(const char *name, uint64_t value, bool last = false) {
+        return std::string("        \"") + name + "\": " + std::to_string(value) +
+               (last ? "\n" : ",\n");
+    }
+};
+
 struct ApiServer {
     photon::net::ISocketServer* tcpserver = nullptr;
     photon::net::http::HTTPServer* httpserver = nullptr;
     ApiHandler* handler = nullptr;
+    CacheHandler* cache_handler = nullptr;
 
-    ApiServer(ImageService *imgservice) : handler(new ApiHandler(imgservice)) {}
+    ApiServer(ImageService *imgservice)
+        : handler(new ApiHandler(imgservice)), cache_handler(new CacheHandler(imgservice)) {}
 
     ~ApiServer() {
         delete handler;
+        delete cache_handler;
         if(tcpserver) {
             safe_delete(tcpserver);
         }
@@ -159,9 +268,10 @@ struct ApiServer {
             LOG_ERRNO_RETURN(0, -1, "Failed to listen api server port `", url.port());
         httpserver = photon::net::http::new_http_server();
         httpserver->add_handler(handler, false, "/snapshot");
+        httpserver->add_handler(cache_handler, false, "/cache");
         tcpserver->set_handler(httpserver->get_connection_handler());
         tcpserver->start_loop();
-        LOG_DEBUG("Api server listening on `:`, path: `", host, url.port(), "/snapshot");
+        LOG_DEBUG("Api server listening on `:`, path: `, `", host, url.port(), "/snapshot", "/cache");
         return 0;
     }
 };
@@ -15,23 +15,31 @@
 */
 #include "bk_download.h"
 #include <errno.h>
+#include <algorithm>
+#include <cstring>
 #include <list>
+#include <memory>
 #include <set>
 #include <string>
 #include <thread>
+#include <vector>
 #include <sys/file.h>
 #include <photon/common/alog.h>
 #include <photon/common/alog-stdstring.h>
 #include <photon/common/alog-audit.h>
+#include <photon/common/io-alloc.h>
+#include <photon/fs/forwardfs.h>
 #include <photon/fs/localfs.h>
 #include <photon/fs/throttled-file.h>
 #include <photon/thread/thread.h>
+#include <photon/thread/thread11.h>
 #include <openssl/sha.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include "switch_file.h"
 #include "image_file.h"
 #include "tools/sha256file.h"
+#include "overlaybd/cache/cache.h"
 
 using namespace photon::fs;
 
@@ -55,10 +63,283 @@ bool check_downloaded(const std::string &dir) {
 
 static std::set<std::string> lock_files;
 
+class ForegroundFile : public ForwardFile_Ownership {
+public:
+    ForegroundFile(IFile *file, DownloadScheduler *scheduler)
+        : ForwardFile_Ownership(file, true), m_scheduler(scheduler) {
+    }
+    ssize_t pread(void *buf, size_t count, off_t offset) override {
+        auto start = photon::now;
+        return report(start, m_file->pread(buf, count, offset));
+    }
+    ssize_t preadv(const struct iovec *iov, int iovcnt, off_t offset) override {
+        auto start = photon::now;
+        return report(start, m_file->preadv(iov, iovcnt, offset));
+    }
+    ssize_t preadv2(const struct iovec *iov, int iovcnt, off_t offset, int flags) override {
+        auto start = photon::now;
+        return report(start, m_file->preadv2(iov, iovcnt, offset, flags));
+    }
+
+private:
+    DownloadScheduler *m_scheduler;
+
+    // of the bytes read, a failed read counts as a small one
+    ssize_t report(uint64_t start, ssize_t ret) {
+        m_scheduler->report_foreground(photon::now - start, ret > 0 ? ret : 0);
+        return ret;
+    }
+};
+
+class ForegroundFS : public ForwardFS_Ownership {
+public:
+    ForegroundFS(IFileSystem *fs, DownloadScheduler *scheduler)
+        : ForwardFS_Ownership(fs, false), m_scheduler(scheduler) {
+    }
+    IFile *open(const char *fn, int flags) override {
+        auto file = m_fs->open(fn, flags);
+        return file ? new ForegroundFile(file, m_scheduler) : nullptr;
+    }
+    IFile *open(const char *fn, int flags, mode_t mode) override {
+        auto file = m_fs->open(fn, flags, mode);
+        return file ? new ForegroundFile(file, m_scheduler) : nullptr;
+    }
+
+private:
+    DownloadScheduler *m_scheduler;
+};
+
+DownloadScheduler::~DownloadScheduler() {
+    delete m_fg_fs;
+}
+
+IFileSystem *DownloadScheduler::foreground_fs(IFileSystem *src) {
+    delete m_fg_fs;
+    m_fg_fs = new ForegroundFS(src, this);
+    return m_fg_fs;
+}
+
+bool DownloadScheduler::acquire(const std::atomic<uint64_t> *last_read, const int &running) {
+    auto leave = [&]() {
+        auto it = std::find(m_waiting.begin(), m_waiting.end(), last_read);
+        if (it != m_waiting.end()) {
+            m_waiting.erase(it);
+        }
+    };
+    photon::scoped_lock lock(m_lock);
+    m_waiting.push_back(last_read);
+    while (true) {
+        if (m_max_downloads == 0 || m_downloading < m_max_downloads) {
+            // the first of the most recently read ones
+            auto first = std::max_element(
+                m_waiting.begin(), m_waiting.end(),
+                [](const std::atomic<uint64_t> *a, const std::atomic<uint64_t> *b) {
+                    return (a ? a->load(std::memory_order_relaxed) : 0) <
+                           (b ? b->load(std::memory_order_relaxed) : 0);
+                });
+            if (*first == last_read) {
+                m_waiting.erase(first);
+                m_downloading++;
+                return true;
+            }
+        }
+        if (running != 1) {
+            leave();
+            // the slot may be for another one waiting
+            m_released.notify_all();
+            return false;
+        }
+        // woken up by a release, or to check `running` again
+        m_released.wait(lock, 1000 * 1000);
+    }
+}
+
+void DownloadScheduler::release() {
+    photon::scoped_lock lock(m_lock);
+    m_downloading--;
+    m_released.notify_all();
+}
+
+void DownloadScheduler::throttle(size_t bytes) {
+    if (m_max_rate == 0) {
+        return;
+    }
+    uint64_t wait = 0;
+    {
+        photon::scoped_lock lock(m_lock);
+        adjust_backoff();
+        auto rate = m_max_rate >> m_backoff_shift;
+        // bandwidth is reserved in turn, each waits for those reserved before it
+        auto start = std::max(m_next_free, photon::now);
+        m_next_free = start + bytes * 1000000UL / rate;
+        wait = start - photon::now;
+    }
+    if (wait > 0) {
+        photon::thread_usleep(wait);
+    }
+}
+
+void DownloadScheduler::report_foreground(uint64_t latency_us, size_t bytes) {
+    if (m_backoff_latency == 0) {
+        return;
+    }
+    if (bytes > LATENCY_UNIT) {
+        latency_us = latency_us * LATENCY_UNIT / bytes;
+    }
+    photon::scoped_lock lock(m_lock);
+    if (photon::now - m_fg_reported > 1000000UL) {
+        m_fg_latency = latency_us;
+    } else {
+        m_fg_latency = (m_fg_latency * 7 + latency_us) / 8;
+    }
+    m_fg_reported = photon::now;
+}
+
+void DownloadScheduler::adjust_backoff() {
+    if (m_backoff_latency == 0 || photon::now - m_backoff_adjusted < 1000000UL) {
+        return;
+    }
+    m_backoff_adjusted = photon::now;
+    // no foreground reads in the last second counts as not congested
+    bool congested =
+        photon::now - m_fg_reported <= 1000000UL && m_fg_latency > m_backoff_latency;
+    if (congested && m_backoff_shift < MAX_BACKOFF_SHIFT) {
+        m_backoff_shift++;
+        LOG_INFO("foreground registry latency ` us, download budget down to ` MB/s",
+                 m_fg_latency, (m_max_rate >> m_backoff_shift) / 1024 / 1024);
+    } else if (!congested && m_backoff_shift > 0) {
+        m_backoff_shift--;
+        LOG_INFO("download budget back to ` MB/s", (m_max_rate >> m_backoff_shift) / 1024 / 1024);
+    }
+}
+
+// One bit for each block of the downloaded file, set after the block is written. It's
+// persisted after the downloaded file is synced, so a bit set on disk always means the
+// block is there. The bitmap is loaded only if it's of the same file size and block size.
+class DownloadBitmap {
+public:
+    DownloadBitmap(size_t file_size, uint32_t block_size)
+        : m_nbits((file_size + block_size - 1) / block_size),
+          m_header{BITMAP_MAGIC, file_size, block_size, 0}, m_bits((m_nbits + 7) / 8, 0) {
+    }
+    ~DownloadBitmap() {
+        delete m_file;
+    }
+
+    int open(const std::string &path, bool reset) {
+        m_file = open_localfile_adaptor(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (m_file == nullptr) {
+            LOG_ERRNO_RETURN(0, -1, "failed to open bitmap file `", path);
+        }
+        Header header{};
+        if (reset || m_file->pread(&header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            memcmp(&header, &m_header, sizeof(header)) != 0 ||
+            m_file->pread(m_bits.data(), m_bits.size(), sizeof(header)) !=
+                (ssize_t)m_bits.size()) {
+            std::fill(m_bits.begin(), m_bits.end(), 0);
+            if (m_file->ftruncate(0) != 0 ||
+                m_file->pwrite(&m_header, sizeof(m_header), 0) != (ssize_t)sizeof(m_header)) {
+                LOG_ERRNO_RETURN(0, -1, "failed to init bitmap file `", path);
+            }
+        }
+        return 0;
+    }
+
+    size_t size() const {
+        return m_nbits;
+    }
+    bool test(size_t i) const {
+        return m_bits[i / 8] & (1 << (i % 8));
+    }
+    void set(size_t i) {
+        m_bits[i / 8] |= (1 << (i % 8));
+        m_dirty++;
+    }
+    size_t count() const {
+        size_t n = 0;
+        for (size_t i = 0; i < m_nbits; i++) {
+            n += test(i);
+        }
+        return n;
+    }
+    size_t dirty() const {
+        return m_dirty;
+    }
+
+    // sync `data` and persist the bits set so far
+    int persist(IFile *data) {
+        photon::scoped_lock lock(m_persist_lock);
+        if (m_dirty == 0) {
+            return 0;
+        }
+        // bits set during the sync are not covered by it
+        auto bits = m_bits;
+        m_dirty = 0;
+        if (data->fdatasync() != 0) {
+            LOG_ERRNO_RETURN(0, -1, "failed to sync downloaded file");
+        }
+        if (m_file->pwrite(bits.data(), bits.size(), sizeof(Header)) != (ssize_t)bits.size()) {
+            LOG_ERRNO_RETURN(0, -1, "failed to write bitmap file");
+        }
+        return 0;
+    }
+
+private:
+    static const uint64_t BITMAP_MAGIC = 0x50414d5449424c44; // "DLBITMAP"
+    struct Header {
+        uint64_t magic;
+        uint64_t file_size;
+        uint32_t block_size;
+        uint32_t reserved;
+    };
+
+    size_t m_nbits;
+    Header m_header;
+    std::vector<uint8_t> m_bits;
+    size_t m_dirty = 0;
+    IFile *m_file = nullptr;
+    photon::mutex m_persist_lock;
+};
+
+struct BkDownload::DownloadTask {
+    IFile *src;
+    IFile *dst;
+    DownloadBitmap *bitmap;
+    SHA256Stream *sha;
+    std::vector<std::pair<size_t, bool>> order; // of blocks, see download_order()
+    size_t next = 0; // the next in `order` to take, connections run on the same vcpu
+    size_t hashed = 0; // blocks hashed, in order
+    bool hashing = false; // a block is being read back to hash
+    photon::semaphore written{0}; // signaled when a block is set in the bitmap
+    bool hash_failed = false;
+    bool failed = false;
+    bool done = false; // the connections are all done
+};
+
+// persist the bitmap after the number of blocks downloaded
+static const size_t BITMAP_PERSIST_BLOCKS = 64;
+// blocks downloaded out of order are read back to be hashed at most at the rate while
+// downloading, not to slow down writes of the connections
+static const uint64_t HASH_READBACK_MB_PS = 100;
+// hot ranges mapped to the layer file in the blob, which is behind at most 3 tar headers
+static const size_t TAR_HEADERS_SIZE = 3 * 512;
+
 void BkDownload::switch_to_local_file() {
     std::string path = dir + "/" + COMMIT_FILE_NAME;
     ((ISwitchFile *)sw_file)->set_switch_file(path.c_str());
     LOG_DEBUG("set switch done. (localpath: `)", path);
+    // the blob is kept in the registry cache no more, once it's no longer read from there
+    set_cache_file(nullptr);
+    if (cache_pool && sw_file->release_source(running) == 0) {
+        if (cache_pool->evict_file(url) == 0) {
+            LOG_INFO("evicted ` from registry cache", url);
+        } else if (errno == EBUSY) {
+            LOG_INFO("` is still read from registry cache, e.g. by another image, not evicted",
+                     url);
+        } else {
+            LOG_WARN("failed to evict ` from registry cache, left to be recycled", url);
+        }
+    }
 }
 
 bool BkDownload::download_done() {
@@ -73,16 +354,18 @@ bool BkDownload::download_done() {
     old_name = dir + "/" + DOWNLOAD_TMP_NAME;
     new_name = dir + "/" + COMMIT_FILE_NAME;
 
-    // verify sha256
-    photon::semaphore done;
-    std::string shares;
-    std::thread sha256_thread([&]() {
-        shares = sha256sum(old_name.c_str());
-        done.signal(1);
-    });
-    sha256_thread.detach();
-    // wait verify finish
-    done.wait(1);
+    // verify sha256, read the file again if it's not hashed while downloading
+    std::string shares = checksum;
+    if (shares.empty()) {
+        photon::semaphore done;
+        std::thread sha256_thread([&]() {
+            shares = sha256sum(old_name.c_str());
+            done.signal(1);
+        });
+        sha256_thread.detach();
+        // wait verify finish
+        done.wait(1);
+    }
 
     if (shares != digest) {
         LOG_ERROR("verify checksum ` failed (expect: `, got: `)", old_name, digest, shares);
@@ -94,6 +377,7 @@ bool BkDownload::download_done() {
     if (ret != 0) {
         LOG_ERRNO_RETURN(0, false, "rename(`,`) failed", old_name, new_name);
     }
+    lfs->unlink((dir + "/" + DOWNLOAD_BITMAP_NAME).c_str());
     LOG_INFO("download verify done. rename(`,`) success", old_name, new_name);
     return true;
 }
@@ -142,34 +426,196 @@ bool BkDownload::download_blob() {
             delete src;
     });
 
-    auto dst = open_localfile_adaptor(dl_file_path.c_str(), O_RDWR | O_CREAT, 0644);
+    auto dst = open_localfile_adaptor(dl_file_path.c_str(), O_RDWR | O_CREAT, 0644, io_engine);
     if (dst == nullptr) {
         LOG_ERRNO_RETURN(0, false, "failed to open dst file `", dl_file_path.c_str());
     }
     DEFER(delete dst;);
     dst->ftruncate(file_size);
 
-    size_t bs = block_size;
-    off_t offset = 0;
+    DownloadBitmap bitmap(file_size, block_size);
+    if (bitmap.open(dir + "/" + DOWNLOAD_BITMAP_NAME, force_download) != 0) {
+        LOG_ERROR_RETURN(0, false, "failed to open download bitmap in `", dir);
+    }
+
+    LOG_INFO("download blob start. (`), connections: `, downloaded blocks: `/`", url,
+             connections, bitmap.count(), bitmap.size());
+    checksum.clear();
+    std::unique_ptr<SHA256Stream> sha(new_sha256_stream());
+    DownloadTask task{src, dst, &bitmap, sha.get(), download_order(bitmap.size())};
+    auto hasher = photon::thread_enable_join(
+        photon::thread_create11(&BkDownload::hash_downloaded, this, &task));
+    std::vector<photon::join_handle *> join_hdls;
+    for (uint32_t i = 0; i < connections; i++) {
+        auto th = photon::thread_create11(&BkDownload::download_blocks, this, &task);
+        join_hdls.push_back(photon::thread_enable_join(th));
+    }
+    for (auto jh : join_hdls) {
+        photon::thread_join(jh);
+    }
+    task.done = true;
+    task.written.signal(1);
+    photon::thread_join(hasher);
+    if (bitmap.persist(dst) != 0) {
+        LOG_WARN("failed to persist download bitmap in `", dir);
+    }
+    if (task.failed) {
+        return false;
+    }
+    if (!task.hash_failed && task.hashed == bitmap.size()) {
+        checksum = sha->sha256_checksum();
+    }
+    LOG_INFO("download blob done. (`)", dl_file_path);
+    return true;
+}
+
+std::vector<std::pair<size_t, bool>> BkDownload::download_order(size_t nblocks) {
+    std::vector<std::pair<size_t, bool>> order;
+    order.reserve(nblocks * (cache_file ? 2 : 1));
+    if (cache_file) {
+        for (size_t i = 0; i < nblocks; i++) {
+            order.emplace_back(i, true);
+        }
+    }
+    std::vector<bool> queued(nblocks, false);
+    size_t nhot = 0;
+    // trace ranges are of the layer, i.e. uncompressed if it's a zfile
+    auto ranges = hot_ranges;
+    if (!ranges.empty() && sw_file->map_source_ranges(ranges) != 0) {
+        LOG_WARN("failed to map hot ranges of ` to the blob, ignore them", url);
+        ranges.clear();
+    }
+    for (auto &r : ranges) {
+        if (r.first < 0 || r.second == 0 || (size_t)r.first >= file_size) {
+            continue;
+        }
+        size_t begin = r.first / block_size;
+        size_t end = std::min((r.first + r.second + TAR_HEADERS_SIZE - 1) / block_size + 1,
+                              nblocks);
+        for (size_t i = begin; i < end; i++) {
+            if (!queued[i]) {
+                queued[i] = true;
+                order.emplace_back(i, false);
+                nhot++;
+            }
+        }
+    }
+    for (size_t i = 0; i < nblocks; i++) {
+        if (!queued[i]) {
+            order.emplace_back(i, false);
+        }
+    }
+    LOG_INFO("download order of `: cached blocks first: `, hot blocks: `", url,
+             cache_file != nullptr, nhot);
+    return order;
+}
+
+void BkDownload::hash_block(DownloadTask *task, size_t i, void *buf, size_t count) {
+    if (task->hash_failed || task->hashing || i != task->hashed) {
+        return;
+    }
+    if (task->sha->update(buf, count) != 0) {
+        task->hash_failed = true;
+        return;
+    }
+    task->hashed++;
+}
+
+void BkDownload::hash_downloaded(DownloadTask *task) {
+    void *buff = alloc_block_buf();
+    if (buff == nullptr) {
+        task->hash_failed = true;
+        LOG_ERRNO_RETURN(0, , "failed to allocate buffer to hash downloaded blocks");
+    }
+    DEFER(free_block_buf(buff));
+    ThrottleLimits limits;
+    limits.R.throughput = HASH_READBACK_MB_PS * 1024UL * 1024;
+    limits.R.block_size = 1024UL * 1024;
+    limits.time_window = 1UL;
+    std::unique_ptr<IFile> throttled(new_throttled_file(task->dst, limits));
+
+    auto nblocks = task->bitmap->size();
+    while (!task->hash_failed && !task->failed && task->hashed < nblocks) {
+        if (!task->bitmap->test(task->hashed)) {
+            if (task->done) {
+                break;
+            }
+            task->written.wait(1);
+            continue;
+        }
+        // it's either downloaded by an earlier run, or out of order by the connections
+        off_t offset = task->hashed * block_size;
+        size_t n = std::min((size_t)block_size, file_size - offset);
+        auto file = task->done ? task->dst : throttled.get();
+        task->hashing = true;
+        auto rlen = file->pread(buff, n, offset);
+        task->hashing = false;
+        if (rlen != (ssize_t)n) {
+            task->hash_failed = true;
+            LOG_ERRNO_RETURN(0, , "failed to read back downloaded block at ", VALUE(offset));
+        }
+        if (task->sha->update(buff, n) != 0) {
+            task->hash_failed = true;
+            return;
+        }
+        task->hashed++;
+    }
+}
+
+void *BkDownload::alloc_block_buf() {
     void *buff = nullptr;
+    if (io_alloc) {
+        buff = io_alloc->alloc(block_size);
+    } else {
+        ::posix_memalign(&buff, ALIGNMENT, block_size);
+    }
+    return buff;
+}
+
+void BkDownload::free_block_buf(void *buf) {
+    if (io_alloc) {
+        io_alloc->dealloc(buf);
+    } else {
+        free(buf);
+    }
+}
+
+void BkDownload::download_blocks(DownloadTask *task) {
+    size_t bs = block_size;
     // buffer allocate, with 4K alignment
-    ::posix_memalign(&buff, ALIGNMENT, bs);
-    if (buff == nullptr)
-        LOG_ERRNO_RETURN(0, false, "failed to allocate buffer with ", VALUE(bs));
-    DEFER(free(buff));
+    void *buff = alloc_block_buf();
+    if (buff == nullptr) {
+        task->failed = true;
+        LOG_ERRNO_RETURN(0, , "failed to allocate buffer with ", VALUE(bs));
+    }
+    DEFER(free_block_buf(buff));
 
-    LOG_INFO("download blob start. (`)", url);
-    while (offset < (ssize_t)file_size) {
+    auto src = task->src;
+    auto dst = task->dst;
+    while (!task->failed) {
         if (running != 1) {
-            LOG_INFO("image file exit when background downloading");
-            return false;
+            if (!task->failed) {
+                LOG_INFO("image file exit when background downloading");
+            }
+            task->failed = true;
+            return;
         }
-        if (!force_download) {
-            // check aleady downloaded.
+        if (task->next >= task->order.size()) {
+            return;
+        }
+        size_t i = task->order[task->next].first;
+        bool cache_only = task->order[task->next].second;
+        task->next++;
+        if (task->bitmap->test(i)) {
+            continue;
+        }
+        off_t offset = i * bs;
+        if (!force_download && !cache_only) {
+            // check aleady downloaded, e.g. by download cache
             auto hole_pos = dst->lseek(offset, SEEK_HOLE);
             if (hole_pos >= offset + (ssize_t)bs) {
-                // alread downloaded
-                offset += bs;
+                task->bitmap->set(i);
+                task->written.signal(1);
                 continue;
             }
         }
@@ -178,13 +624,27 @@ bool BkDownload::download_blob() {
         auto count = bs;
         if (offset + count > file_size)
             count = file_size - offset;
-    again_read:
-        if (!(retry--))
-            LOG_ERROR_RETURN(EIO, false, "failed to read at ", VALUE(offset), VALUE(count));
         ssize_t rlen;
+        if (cache_only) {
+            // a miss fails without refilling, and it's left to be fetched from the source
+            struct iovec iov { buff, count };
+            rlen = cache_file->preadv2(&iov, 1, offset, RW_V2_CACHE_ONLY | RW_V2_LOW_PRIORITY);
+            if (rlen != (ssize_t)count) {
+                continue;
+            }
+            goto again_write;
+        }
+    again_read:
+        if (!(retry--)) {
+            task->failed = true;
+            LOG_ERROR_RETURN(EIO, , "failed to read at ", VALUE(offset), VALUE(count));
+        }
+        if (scheduler) {
+            scheduler->throttle(count);
+        }
         {
             SCOPE_AUDIT("bk_download", AU_FILEOP(url, offset, rlen));
-            rlen = src->pread(buff, bs, offset);
+            rlen = src->pread(buff, count, offset);
         }
         if (rlen < 0) {
             LOG_WARN("failed to read at ", VALUE(offset), VALUE(count), VALUE(errno), " retry...");
@@ -192,21 +652,27 @@ bool BkDownload::download_blob() {
         }
         retry = 2;
     again_write:
-        if (!(retry--))
-            LOG_ERROR_RETURN(EIO, false, "failed to write at ", VALUE(offset), VALUE(count));
+        if (!(retry--)) {
+            task->failed = true;
+            LOG_ERROR_RETURN(EIO, , "failed to write at ", VALUE(offset), VALUE(count));
+        }
         auto wlen = dst->pwrite(buff, count, offset);
         // but once write lenth larger than read length treats as OK
         if (wlen < rlen) {
             LOG_WARN("failed to write at ", VALUE(offset), VALUE(count), VALUE(errno), " retry...");
             goto again_write;
         }
-        offset += count;
+        task->bitmap->set(i);
+        hash_block(task, i, buff, count);
+        task->written.signal(1);
+        if (task->bitmap->dirty() >= BITMAP_PERSIST_BLOCKS && task->bitmap->persist(dst) != 0) {
+            LOG_WARN("failed to persist download bitmap in `", dir);
+        }
     }
-    LOG_INFO("download blob done. (`)", dl_file_path);
-    return true;
 }
 
-void bk_download_proc(std::list<BKDL::BkDownload *> &dl_list, uint64_t delay_sec, int &running) {
+void bk_download_proc(std::list<BKDL::BkDownload *> &dl_list, uint64_t delay_sec, int &running,
+                      DownloadScheduler *scheduler, const std::atomic<uint64_t> *last_read) {
     LOG_INFO("BACKGROUND DOWNLOAD THREAD STARTED.");
     uint64_t time_st = photon::now;
     while (photon::now - time_st < delay_sec * 1000000) {
@@ -232,7 +698,16 @@ void bk_download_proc(std::list<BKDL::BkDownload *> &dl_list, uint64_t delay_sec
             continue;
         }
 
+        if (scheduler && !scheduler->acquire(last_read, running)) {
+            dl_item->unlock_file();
+            dl_list.push_back(dl_item);
+            LOG_WARN("image exited, background download exit...");
+            break;
+        }
         bool succ = dl_item->download();
+        if (scheduler) {
+            scheduler->release();
+        }
         dl_item->unlock_file();
 
         if (running != 1) {
@@ -14,20 +14,83 @@
    limitations under the License.
 */
 #pragma once
+#include <atomic>
 #include <list>
 #include <string>
+#include <utility>
+#include <vector>
 #include <cstdint>
 #include <photon/fs/filesystem.h>
+#include <photon/thread/thread.h>
 
 class ImageFile;
 class ISwitchFile;
+struct IOAlloc;
+namespace FileSystem {
+class ICachePool;
+}
 
 namespace BKDL {
 
 static std::string DOWNLOAD_TMP_NAME = ".download";
+// blocks of DOWNLOAD_TMP_NAME downloaded, for resuming an interrupted download
+static std::string DOWNLOAD_BITMAP_NAME = ".download.bitmap";
 
 bool check_downloaded(const std::string &dir);
 
+// Background downloads of all the images on the node share a DownloadScheduler, so that
+// together they stay within a bandwidth budget of `max_MBps` and at most `max_downloads`
+// blobs are downloaded at the same time (0 for no limit). When a download slot is free, it
+// goes to the waiting image read most recently. The bandwidth budget is halved, down to
+// 1/16, for every second the latency of foreground reads from the registry, i.e. refills
+// of the cache, per MB read, is above `backoff_latency_ms`, and doubled back for every
+// second it's not (0 for no backoff).
+class DownloadScheduler {
+public:
+    DownloadScheduler(uint32_t max_MBps, uint32_t max_downloads, uint32_t backoff_latency_ms)
+        : m_max_rate(max_MBps * 1024UL * 1024), m_max_downloads(max_downloads),
+          m_backoff_latency(backoff_latency_ms * 1000UL) {
+    }
+    ~DownloadScheduler();
+
+    // wait for a download slot, `last_read` is the time the image was read last, returns
+    // false if `running` is turned off meanwhile
+    bool acquire(const std::atomic<uint64_t> *last_read, const int &running);
+    void release();
+
+    // wait until `bytes` more can be downloaded within the bandwidth budget
+    void throttle(size_t bytes);
+
+    // report the latency of a foreground read of `bytes` from the registry, reads larger
+    // than 1MB count as the time of 1MB of them
+    void report_foreground(uint64_t latency_us, size_t bytes);
+
+    // reads of files opened from the returned fs are reported as foreground ones, it's
+    // owned by the scheduler and doesn't own `src`
+    photon::fs::IFileSystem *foreground_fs(photon::fs::IFileSystem *src);
+
+private:
+    static const uint32_t MAX_BACKOFF_SHIFT = 4;
+    static const size_t LATENCY_UNIT = 1024UL * 1024;
+
+    // called with m_lock held
+    void adjust_backoff();
+
+    uint64_t m_max_rate; // bytes per second
+    uint32_t m_max_downloads;
+    uint64_t m_backoff_latency; // us
+    photon::mutex m_lock;
+    photon::condition_variable m_released;
+    uint32_t m_downloading = 0;
+    std::vector<const std::atomic<uint64_t> *> m_waiting;
+    uint64_t m_next_free = 0;      // the time the budget is free again
+    uint64_t m_fg_latency = 0;     // moving average
+    uint64_t m_fg_reported = 0;    // the time of the last report
+    uint64_t m_backoff_adjusted = 0;
+    uint32_t m_backoff_shift = 0;  // the budget is m_max_rate >> m_backoff_shift
+    photon::fs::IFileSystem *m_fg_fs = nullptr;
+};
+
 class BkDownload {
 public:
     std::string dir;
@@ -41,31 +104,83 @@ public:
     ~BkDownload() {
         unlock_file();
         delete src_file;
+        delete cache_file;
     }
     BkDownload(ISwitchFile *sw_file, photon::fs::IFile *src_file, size_t file_size,
                const std::string &dir, const std::string &digest, const std::string &url,
-               int &running, int32_t limit_MB_ps, int32_t try_cnt, uint32_t bs)
+               int &running, int32_t limit_MB_ps, int32_t try_cnt, uint32_t bs,
+               int io_engine = 0, uint32_t connections = 1)
         : dir(dir), try_cnt(try_cnt), sw_file(sw_file), src_file(src_file),
           file_size(file_size), digest(digest), url(url), running(running),
-          limit_MB_ps(limit_MB_ps), block_size(bs) {
+          limit_MB_ps(limit_MB_ps), block_size(bs), io_engine(io_engine),
+          connections(connections > 0 ? connections : 1) {
     }
 
-private:
+    // Blocks are downloaded in the order of: those in the registry cache, copied from
+    // `cache_file` without going to the source, those covering `hot_ranges` {offset,
+    // count} of the blob, e.g. from the prefetch trace, and then the rest.
+    // `cache_file` is owned by BkDownload, and must support RW_V2_CACHE_ONLY.
+    void set_cache_file(photon::fs::IFile *file) {
+        delete cache_file;
+        cache_file = file;
+    }
+    void set_hot_ranges(std::vector<std::pair<off_t, size_t>> ranges) {
+        hot_ranges = std::move(ranges);
+    }
+    // the blob is evicted from `pool` once switched to the downloaded file, not owned
+    void set_cache_pool(FileSystem::ICachePool *pool) {
+        cache_pool = pool;
+    }
+    // reads from the source are throttled by `s`, not owned
+    void set_scheduler(DownloadScheduler *s) {
+        scheduler = s;
+    }
+    // block buffers are taken from `alloc` if set, not owned
+    void set_io_alloc(IOAlloc *alloc) {
+        io_alloc = alloc;
+    }
+
+protected:
+    struct DownloadTask;
+
     void switch_to_local_file();
     bool download_blob();
+    // download blocks taken from the task one by one, as a connection to the source
+    void download_blocks(DownloadTask *task);
+    // blocks to download in order, with whether to take it from the cache only
+    std::vector<std::pair<size_t, bool>> download_order(size_t nblocks);
+    // hash block `i` just written from `buf`, if it's the next one in order to hash
+    void hash_block(DownloadTask *task, size_t i, void *buf, size_t count);
+    // hash downloaded blocks in order, as a coroutine along with the connections, those not
+    // hashed by hash_block() are read back from the downloaded file
+    void hash_downloaded(DownloadTask *task);
     bool download_done();
+    // a 4K aligned buffer of a block
+    void *alloc_block_buf();
+    void free_block_buf(void *buf);
 
     ISwitchFile *sw_file = nullptr;
     photon::fs::IFile *src_file = nullptr;
+    photon::fs::IFile *cache_file = nullptr;
+    FileSystem::ICachePool *cache_pool = nullptr;
+    std::vector<std::pair<off_t, size_t>> hot_ranges;
+    DownloadScheduler *scheduler = nullptr;
+    IOAlloc *io_alloc = nullptr;
     size_t file_size;
     std::string digest;
     std::string url;
     int &running;
     int32_t limit_MB_ps;
     uint32_t block_size;
+    int io_engine; // of the downloaded file
+    uint32_t connections;
     bool force_download = false;
+    // of the blob hashed while downloading, empty if it has to be computed from the file
+    std::string checksum;
 };
 
-void bk_download_proc(std::list<BKDL::BkDownload *> &, uint64_t, int &);
+void bk_download_proc(std::list<BKDL::BkDownload *> &, uint64_t, int &,
+                      DownloadScheduler *scheduler = nullptr,
+                      const std::atomic<uint64_t> *last_read = nullptr);
 
 } // namespace BKDL
\ No newline at end of file
@@ -53,6 +53,11 @@ struct DownloadConfig : public ConfigUtils::Config {
     APPCFG_PARA(maxMBps, int, 100);
     APPCFG_PARA(tryCnt, int, 5);
     APPCFG_PARA(blockSize, uint32_t, 262144);
+    APPCFG_PARA(connections, uint32_t, 4);
+    // node-wide, taken from the global config only, 0 to disable
+    APPCFG_PARA(nodeMaxMBps, uint32_t, 0);
+    APPCFG_PARA(nodeMaxDownloads, uint32_t, 0);
+    APPCFG_PARA(backoffLatencyMs, uint32_t, 0);
 };
 
 struct ImageConfig : public ConfigUtils::Config {
@@ -81,6 +86,7 @@ struct GzipCacheConfig : public ConfigUtils::Config {
     APPCFG_PARA(cacheDir, std::string, "/opt/overlaybd/gzip_cache");
     APPCFG_PARA(cacheSizeGB, uint32_t, 4);
     APPCFG_PARA(refillSize, uint32_t, 1024 * 1024);
+    APPCFG_PARA(spanCacheMB, uint32_t, 0);
 };
 
 struct ExporterConfig : public ConfigUtils::Config {
@@ -110,6 +116,12 @@ struct CacheConfig : public ConfigUtils::Config {
     APPCFG_PARA(cacheSizeGB, uint32_t, 4);
     APPCFG_PARA(refillSize, uint32_t, 262144);
     APPCFG_PARA(blockSize, uint32_t, 65536);
+    APPCFG_PARA(memCacheSizeMB, uint32_t, 0);
+    APPCFG_PARA(memCachePromoteHits, uint32_t, 2);
+    APPCFG_PARA(policy, std::string, "lru");
+    APPCFG_PARA(refillMinSize, uint32_t, 0);
+    APPCFG_PARA(refillMaxSize, uint32_t, 0);
+    APPCFG_PARA(ocfIoQueues, uint32_t, 0);
 };
 
 struct LogConfig : public ConfigUtils::Config {
@@ -148,6 +160,7 @@ struct GlobalConfig : public ConfigUtils::Config {
     APPCFG_PARA(credentialConfig, CredentialConfig)
     APPCFG_PARA(registryCacheSizeGB, uint32_t, 4);
     APPCFG_PARA(ioEngine, uint32_t, 0);
+    APPCFG_PARA(ioBufferPoolMB, uint32_t, 0);
     APPCFG_PARA(cacheType, std::string, "file");
     APPCFG_PARA(logLevel, uint32_t, 1);
     APPCFG_PARA(logPath, std::string, "/var/log/overlaybd.log");
@@ -18,6 +18,7 @@
 
 #include <unistd.h>
 
+#include <photon/common/callback.h>
 #include <photon/common/conststr.h>
 #include <photon/common/estring.h>
 #include <photon/common/metric-meter/metrics.h>
@@ -53,6 +54,8 @@ struct ExposeRender : public photon::net::http::HTTPHandler {
     EXPOSE_PHOTON_METRICLIST(cache, Metric::ValueCounter);
 
     std::string node_name;
+    // to refresh the gauges that are sampled rather than counted
+    Delegate<void> before_render;
 
     template <typename... Args>
     ExposeRender(Args&&... args) {
@@ -66,6 +69,7 @@ struct ExposeRender : public photon::net::http::HTTPHandler {
     }
 
     std::string render() {
+        before_render();
         EXPOSE_TEMPLATE(alive, OverlayBD_Alive : gauge{node});
         EXPOSE_TEMPLATE(throughput, OverlayBD_Read_Throughtput
                         : gauge{node, type, mode} #Bytes / sec);
@@ -73,6 +77,7 @@ struct ExposeRender : public photon::net::http::HTTPHandler {
         EXPOSE_TEMPLATE(latency, OverlayBD_MaxLatency
                         : gauge{node, type, mode} #us);
         EXPOSE_TEMPLATE(count, OverlayBD_Count : gauge{node, type} #Bytes);
+        EXPOSE_TEMPLATE(cache, OverlayBD_Cache : gauge{node, type});
         std::string ret(alive.help_str());
         ret.append("\n")
             .append(alive.type_str())
@@ -83,6 +88,7 @@ struct ExposeRender : public photon::net::http::HTTPHandler {
         LOOP_APPEND_METRIC(ret, qps);
         LOOP_APPEND_METRIC(ret, latency);
         LOOP_APPEND_METRIC(ret, count);
+        LOOP_APPEND_METRIC(ret, cache);
         return ret;
     }
 
@@ -23,12 +23,21 @@
 #include <photon/thread/timer.h>
 
 #include "config.h"
+#include "overlaybd/cache/pool_store.h"
+#include "overlaybd/cache/memory_cache/tiered_pool.h"
 #include "exporter_handler.h"
 #include "metrics_fs.h"
 
 class OverlayBDMetric {
 public:
     MetricMeta pread, download;
+    // refills of the registry cache, sizes in bytes
+    Metric::ValueCounter refill_count, refill_bytes, refill_max_size;
+    // reads served by each tier of the registry cache if it has a memory tier, hit ratios
+    // in percent of all reads
+    Metric::ValueCounter mem_tier_hits, lower_tier_hits, tier_misses, mem_tier_promotions,
+        mem_tier_used, mem_tier_hit_ratio, lower_tier_hit_ratio;
+    FileSystem::ICachePool *cache_pool = nullptr;
 
     ExposeMetrics::ExposeRender exporter;
 
@@ -41,6 +50,43 @@ public:
         exporter.add_latency("download", download.latency);
         exporter.add_qps("download", download.qps);
         exporter.add_count("download", download.total);
+        exporter.add_cache("refill_count", refill_count);
+        exporter.add_cache("refill_bytes", refill_bytes);
+        exporter.add_cache("refill_max_size", refill_max_size);
+        exporter.add_cache("mem_tier_hits", mem_tier_hits);
+        exporter.add_cache("lower_tier_hits", lower_tier_hits);
+        exporter.add_cache("tier_misses", tier_misses);
+        exporter.add_cache("mem_tier_promotions", mem_tier_promotions);
+        exporter.add_cache("mem_tier_used", mem_tier_used);
+        exporter.add_cache("mem_tier_hit_ratio", mem_tier_hit_ratio);
+        exporter.add_cache("lower_tier_hit_ratio", lower_tier_hit_ratio);
+        exporter.before_render = {this, &OverlayBDMetric::update_cache};
+    }
+
+    void update_cache() {
+        if (cache_pool == nullptr)
+            return;
+        FileSystem::ICachePool::RefillStat stat;
+        cache_pool->get_refill_stat(&stat);
+        refill_count.set(stat.refills);
+        refill_bytes.set(stat.bytes);
+        refill_max_size.set(stat.max_size);
+
+        auto tiered = dynamic_cast<Cache::TieredCachePool *>(cache_pool);
+        if (tiered == nullptr)
+            return;
+        Cache::TierStat tier;
+        tiered->get_tier_stat(&tier);
+        mem_tier_hits.set(tier.mem_hits);
+        lower_tier_hits.set(tier.lower_hits);
+        tier_misses.set(tier.misses);
+        mem_tier_promotions.set(tier.promotions);
+        mem_tier_used.set(tier.mem_used);
+        auto reads = tier.mem_hits + tier.lower_hits + tier.misses;
+        if (reads > 0) {
+            mem_tier_hit_ratio.set(tier.mem_hits * 100 / reads);
+            lower_tier_hit_ratio.set(tier.lower_hits * 100 / reads);
+        }
     }
 };
 
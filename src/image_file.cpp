@@ -51,7 +51,7 @@ IFile *ImageFile::__open_ro_file(const std::string &path) {
 
     LOG_INFO("open ro file: `", path);
     int ioengine = image_service.global_conf.ioEngine();
-    if (ioengine > 2) {
+    if (ioengine > ioengine_iouring) {
         LOG_WARN("invalid ioengine: `, set to psync", ioengine);
         ioengine = 0;
     }
@@ -198,9 +198,26 @@ IFile *ImageFile::__open_ro_remote(const std::string &dir, const std::string &di
         if (srcfile == nullptr) {
             LOG_WARN("failed to open source file, ignore download");
         } else {
+            // writes are unaligned, so only io_uring is taken from ioEngine besides psync
+            int io_engine = image_service.global_conf.ioEngine() == ioengine_iouring
+                                ? ioengine_iouring
+                                : ioengine_psync;
             BKDL::BkDownload *obj = new BKDL::BkDownload(
                 switch_file, srcfile, size, dir, digest, url, m_status, conf.download().maxMBps(),
-                conf.download().tryCnt(), conf.download().blockSize());
+                conf.download().tryCnt(), conf.download().blockSize(), io_engine,
+                conf.download().connections());
+            obj->set_scheduler(image_service.download_scheduler);
+            obj->set_cache_pool(image_service.global_fs.cache_pool);
+            obj->set_io_alloc(image_service.global_fs.io_buffer_pool);
+            if (image_service.global_fs.cache_only_fs) {
+                obj->set_cache_file(
+                    image_service.global_fs.cache_only_fs->open(url.c_str(), O_RDONLY));
+            }
+            if (m_prefetcher) {
+                std::vector<std::pair<off_t, size_t>> ranges;
+                m_prefetcher->get_trace_ranges(layer_index, ranges);
+                obj->set_hot_ranges(std::move(ranges));
+            }
             LOG_DEBUG("add to download list for `", dir);
             dl_list.push_back(obj);
         }
@@ -218,10 +235,12 @@ void ImageFile::start_bk_dl_thread() {
     uint64_t extra_range = conf.download().delayExtra();
     extra_range = (extra_range <= 0) ? 30 : extra_range;
     uint64_t delay_sec = (rand() % extra_range) + conf.download().delay();
-    LOG_INFO("background download is enabled, delay `, maxMBps `, tryCnt `, blockSize `", delay_sec,
-             conf.download().maxMBps(), conf.download().tryCnt(), conf.download().blockSize());
+    LOG_INFO("background download is enabled, delay `, maxMBps `, tryCnt `, blockSize `, connections `",
+             delay_sec, conf.download().maxMBps(), conf.download().tryCnt(),
+             conf.download().blockSize(), conf.download().connections());
     dl_thread_jh = photon::thread_enable_join(
-        photon::thread_create11(&BKDL::bk_download_proc, dl_list, delay_sec, m_status));
+        photon::thread_create11(&BKDL::bk_download_proc, dl_list, delay_sec, m_status,
+                                image_service.download_scheduler, &m_last_read));
 }
 
 struct ParallelOpenTask {
@@ -311,7 +330,8 @@ int ImageFile::open_lower_layer(IFile *&file, ImageConfigNS::LayerConfig &layer,
             set_failed("failed to open gzip index " + layer.gzipIndex());
             LOG_ERRNO_RETURN(0, -1, "open(`) failed", layer.gzipIndex());
         }
-        target_file = new_gzfile(target_file, gz_index, true);
+        target_file = new_gzfile(target_file, gz_index, true,
+                                 image_service.global_fs.gz_span_cache);
         if (image_service.global_conf.gzipCacheConfig().enable() && layer.targetDigest() != "") {
             target_file = image_service.global_fs.gzcache_fs->open_cached_gzip_file(
                 target_file, layer.targetDigest().c_str());
@@ -412,7 +432,8 @@ LSMT::IFileRW *ImageFile::open_upper(ImageConfigNS::UpperConfig &upper) {
                 LOG_ERROR("open(`,flags), `:`", upper.gzipIndex(), errno, strerror(errno));
                 goto ERROR_EXIT;
             }
-            target_file = new_gzfile(target_file, gzip_index);
+            target_file = new_gzfile(target_file, gzip_index, false,
+                                     image_service.global_fs.gz_span_cache);
         }
         ret = LSMT::open_warpfile_rw(idx_file, data_file, target_file, true);
         if (!ret) {
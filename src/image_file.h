@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <atomic>
 #include <list>
 #include <map>
 #include <string>
@@ -91,6 +92,7 @@ public:
     }
 
     ssize_t preadv(const struct iovec *iov, int iovcnt, off_t offset) override {
+        m_last_read.store(photon::now, std::memory_order_relaxed);
         return m_file->preadv(iov, iovcnt, offset);
     }
 
@@ -133,6 +135,8 @@ private:
     const std::string config_path;
     std::list<BKDL::BkDownload *> dl_list;
     photon::join_handle *dl_thread_jh = nullptr;
+    // for the download scheduler to prioritize recently read images
+    std::atomic<uint64_t> m_last_read{0};
     ImageService &image_service;
     photon::fs::IFile *m_lower_file = nullptr;
     photon::fs::IFile *m_upper_file = nullptr;
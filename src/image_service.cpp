@@ -25,6 +25,7 @@
 #include <photon/net/curl.h>
 #include <photon/net/http/url.h>
 #include <photon/net/socket.h>
+#include <photon/photon.h>
 #include <photon/thread/thread.h>
 #include "overlaybd/cache/cache.h"
 #include "overlaybd/registryfs/registryfs.h"
@@ -252,7 +253,7 @@ int ImageService::read_global_config_and_set() {
         LOG_ERROR_RETURN(0, -1, "error parse global config json: `", m_config_path);
     }
     uint32_t ioengine = global_conf.ioEngine();
-    if (ioengine > 2) {
+    if (ioengine > ioengine_iouring) {
         LOG_ERROR_RETURN(0, -1, "unknown io_engine: `", ioengine);
     }
 
@@ -455,22 +456,69 @@ int ImageService::init() {
             global_fs.srcfs = global_fs.underlay_registryfs;
         }
 
-        if (global_conf.enableThread() == true && cache_type == "file") {
-            LOG_ERROR_RETURN(0, -1, "multi-thread has not been valid for file cache");
+        auto dl_conf = global_conf.download();
+        auto fg_srcfs = global_fs.srcfs;
+        if (dl_conf.nodeMaxMBps() || dl_conf.nodeMaxDownloads() || dl_conf.backoffLatencyMs()) {
+            download_scheduler = new BKDL::DownloadScheduler(
+                dl_conf.nodeMaxMBps(), dl_conf.nodeMaxDownloads(), dl_conf.backoffLatencyMs());
+            LOG_INFO("download scheduler: nodeMaxMBps `, nodeMaxDownloads `, backoffLatencyMs `",
+                     dl_conf.nodeMaxMBps(), dl_conf.nodeMaxDownloads(),
+                     dl_conf.backoffLatencyMs());
+            // refills of caches are the foreground reads background downloads back off from
+            if (dl_conf.backoffLatencyMs() && dl_conf.nodeMaxMBps()) {
+                fg_srcfs = download_scheduler->foreground_fs(global_fs.srcfs);
+            }
         }
 
-        global_fs.io_alloc = new IOAlloc;
+        if (global_conf.ioBufferPoolMB() > 0) {
+            global_fs.io_buffer_pool =
+                FileSystem::new_pooled_io_alloc((size_t)global_conf.ioBufferPoolMB() << 20);
+            if (global_fs.io_buffer_pool == nullptr) {
+                LOG_WARN("failed to create io buffer pool, use default allocator");
+            }
+        }
+        if (global_fs.io_buffer_pool) {
+            global_fs.io_alloc = global_fs.io_buffer_pool;
+            ZFile::zfile_set_io_alloc(global_fs.io_alloc);
+        } else {
+            global_fs.io_alloc = new IOAlloc;
+        }
+        // cache media is accessed with unaligned buffered I/O, so only io_uring is taken
+        // from ioEngine besides psync
+        int media_engine = global_conf.ioEngine() == ioengine_iouring ? ioengine_iouring
+                                                                      : ioengine_psync;
 
         if (cache_type == "file") {
-            auto registry_cache_fs = new_localfs_adaptor(cache_dir.c_str());
+            auto registry_cache_fs = new_localfs_adaptor(cache_dir.c_str(), media_engine);
             if (registry_cache_fs == nullptr) {
                 delete global_fs.srcfs;
                 LOG_ERROR_RETURN(0, -1, "new_localfs_adaptor for ` failed", cache_dir.c_str());
             }
+            int policy = POLICY_LRU;
+            if (global_conf.cacheConfig().policy() == "2q") {
+                policy = POLICY_2Q;
+            } else if (global_conf.cacheConfig().policy() != "lru") {
+                LOG_WARN("unknown cache policy `, use lru", global_conf.cacheConfig().policy());
+            }
             // file cache will delete its src_fs automatically when destructed
-            global_fs.cached_fs = FileSystem::new_full_file_cached_fs(
-                global_fs.srcfs, registry_cache_fs, refill_size, cache_size_GB, 10000000,
-                (uint64_t)1048576 * 1024, global_fs.io_alloc, 0, {nullptr, &cache_fn_trans_sha256});
+            auto cached_fs = FileSystem::new_full_file_cached_fs(
+                fg_srcfs, registry_cache_fs, refill_size, cache_size_GB, 10000000,
+                (uint64_t)1048576 * 1024, global_fs.io_alloc, 0, {nullptr, &cache_fn_trans_sha256},
+                (uint64_t)global_conf.cacheConfig().memCacheSizeMB() * 1024 * 1024, policy,
+                global_conf.cacheConfig().memCachePromoteHits());
+            if (cached_fs) {
+                auto pool = cached_fs->get_pool();
+                if (pool->set_refill_bounds(global_conf.cacheConfig().refillMinSize(),
+                                            global_conf.cacheConfig().refillMaxSize()) != 0) {
+                    LOG_WARN("adaptive refill size disabled");
+                }
+                if (metrics) {
+                    metrics->cache_pool = pool;
+                }
+                global_fs.cache_pool = pool;
+            }
+            global_fs.cached_fs = cached_fs;
+            global_fs.cache_only_fs = cached_fs;
 
         } else if (cache_type == "ocf") {
             auto namespace_dir = std::string(cache_dir + "/namespace");
@@ -489,19 +537,25 @@ int ImageService::init() {
             if (::access(media_file_path.c_str(), F_OK) != 0) {
                 reload_media = false;
                 media_file = open_localfile_adaptor(media_file_path.c_str(), O_RDWR | O_CREAT, 0644,
-                                                                ioengine_psync);
+                                                                media_engine);
                 media_file->fallocate(0, 0, cache_size_GB * 1024UL * 1024 * 1024);
             } else {
                 reload_media = true;
                 media_file = open_localfile_adaptor(media_file_path.c_str(), O_RDWR, 0644,
-                                                                ioengine_psync);
+                                                                media_engine);
             }
             global_fs.media_file = media_file;
 
-            global_fs.cached_fs = FileSystem::new_ocf_cached_fs(global_fs.srcfs, namespace_fs, block_size, refill_size,
-                                                                media_file, reload_media, global_fs.io_alloc);
+            auto cached_fs = FileSystem::new_ocf_cached_fs(fg_srcfs, namespace_fs, block_size, refill_size,
+                                                           media_file, reload_media, global_fs.io_alloc,
+                                                           media_engine,
+                                                           global_conf.cacheConfig().ocfIoQueues());
+            if (cached_fs) {
+                global_fs.cache_pool = cached_fs->get_pool();
+            }
+            global_fs.cached_fs = cached_fs;
         } else if (cache_type == "download") {
-            global_fs.cached_fs = FileSystem::new_download_cached_fs(global_fs.srcfs, 4096, refill_size, global_fs.io_alloc);
+            global_fs.cached_fs = FileSystem::new_download_cached_fs(fg_srcfs, 4096, refill_size, global_fs.io_alloc);
         } else {
             LOG_ERROR_RETURN(0, -1, "cache type invalid");
         }
@@ -531,6 +585,11 @@ int ImageService::init() {
                 gzip_cache_fs, refill_size, cache_size_GB,
                 10000000, (uint64_t)1048576 * 4096, global_fs.io_alloc);
         }
+        if (global_conf.gzipCacheConfig().spanCacheMB() > 0) {
+            LOG_INFO("use gzip span cache of ` MB", global_conf.gzipCacheConfig().spanCacheMB());
+            global_fs.gz_span_cache =
+                new_gz_span_cache((size_t)global_conf.gzipCacheConfig().spanCacheMB() << 20);
+        }
     }
     if (global_conf.serviceConfig().enable()) {
         // auto sock_path = global_conf.serviceConfig().domainSocket();
@@ -631,16 +690,43 @@ ImageService::ImageService(const char *config_path) {
 ImageService::~ImageService() {
     delete global_fs.media_file;
     delete global_fs.namespace_fs;
+    if (metrics) {
+        metrics->cache_pool = nullptr;
+    }
+    global_fs.cache_pool = nullptr;
+    global_fs.cache_only_fs = nullptr;
     delete global_fs.cached_fs;
     delete global_fs.gzcache_fs;
+    delete global_fs.gz_span_cache;
+    delete download_scheduler;
     delete global_fs.srcfs;
-    delete global_fs.io_alloc;
+    if (global_fs.io_buffer_pool) {
+        ZFile::zfile_set_io_alloc(nullptr);
+        delete global_fs.io_buffer_pool;
+    } else {
+        delete global_fs.io_alloc;
+    }
     delete exporter;
     stop_api_server(api_server);
 
     LOG_INFO("image service is fully stopped");
 }
 
+uint64_t event_engine_for(uint32_t io_engine, uint64_t default_engine) {
+    if (io_engine != ioengine_iouring) {
+        return default_engine;
+    }
+    return (default_engine & ~photon::INIT_EVENT_EPOLL) | photon::INIT_EVENT_IOURING;
+}
+
+uint32_t read_io_engine(const char *config_path) {
+    ImageConfigNS::GlobalConfig conf;
+    if (!conf.ParseJSON(config_path ? config_path : DEFAULT_CONFIG_PATH)) {
+        return ioengine_psync;
+    }
+    return conf.ioEngine();
+}
+
 ImageService *create_image_service(const char *config_path) {
     ImageService *ret = new ImageService(config_path);
     if (ret->init() < 0) {
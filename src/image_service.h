@@ -20,6 +20,8 @@
 #include "config.h"
 #include "exporter_server.h"
 #include "overlaybd/cache/gzip_cache/cached_fs.h"
+#include "overlaybd/cache/pooled_alloc.h"
+#include "overlaybd/gzindex/gzfile.h"
 #include <photon/fs/filesystem.h>
 #include <photon/common/io-alloc.h>
 #include <unordered_map>
@@ -33,11 +35,20 @@ struct GlobalFs {
     IFileSystem *srcfs = nullptr;
     IFileSystem *cached_fs = nullptr;
     Cache::GzipCachedFs *gzcache_fs = nullptr;
+    // inflated spans of gzip layers in memory
+    GzSpanCache *gz_span_cache = nullptr;
+
+    // file or ocf cache, managed through api server
+    FileSystem::ICachePool *cache_pool = nullptr;
+    // file cache only, for background download to copy the cached ranges of blobs
+    IFileSystem *cache_only_fs = nullptr;
 
     // ocf cache only
     IFile *media_file = nullptr;
     IFileSystem *namespace_fs = nullptr;
     IOAlloc *io_alloc = nullptr;
+    // io_alloc if buffers are pooled
+    FileSystem::PooledIOAlloc *io_buffer_pool = nullptr;
 };
 
 struct ImageAuthResponse : public ConfigUtils::Config {
@@ -50,6 +61,9 @@ struct ImageAuthResponse : public ConfigUtils::Config {
 
 struct ImageFile;
 struct ApiServer;
+namespace BKDL {
+class DownloadScheduler;
+}
 
 class ImageService {
 public:
@@ -69,6 +83,8 @@ public:
     std::unique_ptr<OverlayBDMetric> metrics;
     ExporterServer *exporter = nullptr;
     ApiServer *api_server = nullptr;
+    // shared by background downloads of all the images
+    BKDL::DownloadScheduler *download_scheduler = nullptr;
 
 private:
     int read_global_config_and_set();
@@ -80,6 +96,11 @@ private:
 
 ImageService *create_image_service(const char *config_path = nullptr);
 
+// Local files opened with io_uring are served by the event engine of the vcpu doing the I/O,
+// so vcpus doing file I/O run io_uring instead of epoll when it's configured.
+uint64_t event_engine_for(uint32_t io_engine, uint64_t default_engine);
+uint32_t read_io_engine(const char *config_path = nullptr);
+
 int load_cred_from_file(const std::string path, const std::string &remote_path,
                         std::string &username, std::string &password);
 
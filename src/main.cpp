@@ -375,7 +375,9 @@ static int dev_open(struct tcmu_device *dev) {
 
     if (imgservice->global_conf.enableThread()) {
         auto obd_th = [](obd_dev *odev, struct tcmu_device *dev) {
-            photon::init(photon::INIT_EVENT_EPOLL, photon::INIT_IO_LIBCURL);
+            photon::init(event_engine_for(imgservice->global_conf.ioEngine(),
+                                          photon::INIT_EVENT_EPOLL),
+                         photon::INIT_IO_LIBCURL);
             DEFER(photon::fini());
 
             odev->loop = new TCMUDevLoop(dev);
@@ -438,7 +440,12 @@ int main(int argc, char **argv) {
     mallopt(M_TRIM_THRESHOLD, 128 * 1024);
     prctl(PR_SET_THP_DISABLE, 1);
 
-    photon::init(photon::INIT_EVENT_DEFAULT, photon::INIT_IO_DEFAULT);
+    auto io_engine = read_io_engine(argc > 1 ? argv[1] : nullptr);
+    if (photon::init(event_engine_for(io_engine, photon::INIT_EVENT_DEFAULT),
+                     photon::INIT_IO_DEFAULT) != 0) {
+        LOG_ERROR("failed to init photon, io engine: `", io_engine);
+        return -1;
+    }
     photon::block_all_signal();
     photon::sync_signal(SIGTERM, &sigint_handler);
     photon::sync_signal(SIGINT, &sigint_handler);
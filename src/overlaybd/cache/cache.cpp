@@ -22,6 +22,7 @@
 #include <photon/thread/thread-pool.h>
 
 #include "full_file_cache/cache_pool.h"
+#include "refill_scheduler.h"
 
 namespace FileSystem {
 using namespace photon::fs;
@@ -29,7 +30,9 @@ ICachedFileSystem *new_full_file_cached_fs(IFileSystem *srcFs, IFileSystem *medi
                                            uint64_t refillUnit, uint64_t capacityInGB,
                                            uint64_t periodInUs, uint64_t diskAvailInBytes,
                                            IOAlloc *allocator, int quotaDirLevel,
-                                           CacheFnTransFunc fn_trans_func) {
+                                           CacheFnTransFunc fn_trans_func,
+                                           uint64_t memCacheBytes, int policy,
+                                           uint32_t memPromoteHits) {
     if (refillUnit % 4096 != 0 || !is_power_of_2(refillUnit)) {
         LOG_ERROR_RETURN(EINVAL, nullptr, "refill Unit need to be aligned to 4KB and power of 2")
     }
@@ -37,15 +40,27 @@ ICachedFileSystem *new_full_file_cached_fs(IFileSystem *srcFs, IFileSystem *medi
         allocator = new IOAlloc;
     }
     Cache::FileCachePool *pool = nullptr;
-    pool =
-        new ::Cache::FileCachePool(mediaFs, capacityInGB, periodInUs, diskAvailInBytes, refillUnit);
+    pool = new ::Cache::FileCachePool(mediaFs, capacityInGB, periodInUs, diskAvailInBytes,
+                                      refillUnit, policy);
     pool->Init();
+    if (memCacheBytes > 0) {
+        auto tiered = new_tiered_cache_pool(pool, memCacheBytes, refillUnit, memPromoteHits);
+        if (tiered == nullptr) {
+            delete pool;
+            return nullptr;
+        }
+        return new_cached_fs(srcFs, tiered, 4096, allocator, fn_trans_func);
+    }
     return new_cached_fs(srcFs, pool, 4096, allocator, fn_trans_func);
 }
 
 using OC = ObjectCache<std::string, ICacheStore *>;
+static const size_t kMaxRefillRequestSize = 4UL * 1024 * 1024;
+static const uint32_t kMaxRefillInflight = 32; // per store
 ICachePool::ICachePool(uint32_t pool_size, uint32_t max_refilling, uint32_t refilling_threshold)
-    : m_stores(new OC(10UL * 1000 * 1000)), m_max_refilling(max_refilling),
+    : m_stores(new OC(10UL * 1000 * 1000)),
+      m_refill_scheduler(new RefillScheduler(kMaxRefillRequestSize, kMaxRefillInflight)),
+      m_max_refilling(max_refilling),
       m_refilling_threshold(refilling_threshold) {
     if (pool_size != 0) {
         m_thread_pool = photon::new_thread_pool(pool_size, 128 * 1024UL);
@@ -57,6 +72,7 @@ ICachePool::ICachePool(uint32_t pool_size, uint32_t max_refilling, uint32_t refi
 ICachePool::~ICachePool() {
     stores_clear();
     delete cast(m_stores);
+    delete m_refill_scheduler;
 }
 
 void ICachePool::stores_clear() {
@@ -103,6 +119,44 @@ ICacheStore *ICachePool::open(std::string_view filename, int flags, mode_t mode)
     return store;
 }
 
+int ICachePool::evict_file(std::string_view filename) {
+    char store_name[4096];
+    auto len = this->fn_trans_func(filename, store_name, sizeof(store_name));
+    std::string_view store_sv = len ? std::string_view(store_name, len) : filename;
+    // the store is kept by the pool for a while after closed, only if it's still opened,
+    // e.g. by another image of the blob, it's not evicted
+    auto store = cast(m_stores)->acquire(store_sv, []() -> ICacheStore * { return nullptr; });
+    if (store) {
+        auto opened = store->ref_.load(std::memory_order_relaxed);
+        cast(m_stores)->release(store_sv);
+        if (opened > 0) {
+            LOG_ERROR_RETURN(EBUSY, -1, "file is opened, name : `", filename);
+        }
+    }
+    return evict(store_sv);
+}
+
+int ICachePool::set_refill_bounds(size_t min, size_t max) {
+    if (max == 0) {
+        m_min_refill = m_max_refill = 0;
+        return 0;
+    }
+    if (min < 4096 || min > max || !is_power_of_2(min) || !is_power_of_2(max)) {
+        LOG_ERROR_RETURN(EINVAL, -1,
+                         "refill bounds need to be power of 2 and no less than 4KB, min : `, max : `",
+                         min, max);
+    }
+    m_min_refill = min;
+    m_max_refill = max;
+    return 0;
+}
+
+void ICachePool::get_refill_stat(RefillStat *stat) {
+    stat->refills = m_refills.load(std::memory_order_relaxed);
+    stat->bytes = m_refill_bytes.load(std::memory_order_relaxed);
+    stat->max_size = m_refill_max.exchange(0, std::memory_order_relaxed);
+}
+
 void ICachePool::set_trans_func(CacheFnTransFunc fn_trans_func) {
     this->fn_trans_func = fn_trans_func;
 }
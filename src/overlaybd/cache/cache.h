@@ -34,6 +34,7 @@
 #define RW_V2_TO_BUFFER_WITHOUT_SYNC                                                               \
     0x00000010                       // pwritev2 to buffered accessor file's buffer without sync
 #define RW_V2_MEMORY_ONLY 0x00000020 // pwritev2 memory cache only
+#define RW_V2_LOW_PRIORITY 0x00000040 // preadv2/pwritev2 bulk data, not to displace hot data
 
 #define IS_STRUCT_STAT_SETTED(x) ((*(uint64_t *)x) == 0xF19A336DB7CA28E7ull)
 #define SET_STRUCT_STAT(x) ((*(uint64_t *)x) = 0xF19A336DB7CA28E7ull)
@@ -114,18 +115,30 @@ ICachedFileSystem *new_full_file_cached_fs(photon::fs::IFileSystem *srcFs,
                                            uint64_t capacityInGB, uint64_t periodInUs,
                                            uint64_t diskAvailInBytes, IOAlloc *allocator,
                                            int quotaDirLevel,
-                                           CacheFnTransFunc fn_trans_func = nullptr);
+                                           CacheFnTransFunc fn_trans_func = nullptr,
+                                           uint64_t memCacheBytes = 0, int policy = POLICY_LRU,
+                                           uint32_t memPromoteHits = 2);
+
+// Layer a memory cache of hot units over `lower`, which is owned by the returned pool.
+// A unit is promoted after it is read `promoteHits` times from `lower`.
+ICachePool *new_tiered_cache_pool(ICachePool *lower, uint64_t memCapacity, size_t memUnit,
+                                  uint32_t promoteHits);
 
 /**
  * @param blk_size The proper size for cache metadata and IO efficiency. Large writes to cache media
  *                 will be split into blk_size. Reads and small writes are not affected.
  * @param prefetch_unit Controls the expand prefetch size from src file. 0 means to disable this
  * feature.
+ * @param io_queues The number of OCF I/O queues, reads are submitted to them round robin. 0 means
+ * the default, 4.
+ * get_pool() of the returned fs evicts blobs from cache and reuses their space, by
+ * evict(filename) only.
  */
-photon::fs::IFileSystem *new_ocf_cached_fs(photon::fs::IFileSystem *src_fs,
-                                           photon::fs::IFileSystem *namespace_fs, size_t blk_size,
-                                           size_t prefetch_unit, photon::fs::IFile *media_file,
-                                           bool reload_media, IOAlloc *io_alloc);
+ICachedFileSystem *new_ocf_cached_fs(photon::fs::IFileSystem *src_fs,
+                                     photon::fs::IFileSystem *namespace_fs, size_t blk_size,
+                                     size_t prefetch_unit, photon::fs::IFile *media_file,
+                                     bool reload_media, IOAlloc *io_alloc, int media_io_engine = 0,
+                                     uint32_t io_queues = 0);
 
 photon::fs::IFileSystem *new_download_cached_fs(photon::fs::IFileSystem *src_fs, size_t blk_size,
                                                 size_t refill_size, IOAlloc *io_alloc);
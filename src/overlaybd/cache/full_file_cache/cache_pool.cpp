@@ -19,8 +19,10 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <algorithm>
+#include <cstring>
 #include <sys/statvfs.h>
 #include "cache_store.h"
+#include "../../zfile/crc32/crc32c.h"
 #include <photon/common/alog.h>
 #include <photon/common/alog-stdstring.h>
 #include <photon/common/enumerable.h>
@@ -33,14 +35,53 @@ using namespace FileSystem;
 using namespace photon::fs;
 
 const uint64_t kGB = 1024 * 1024 * 1024;
+const uint32_t kPoolIndexMagic = 0x58444950; // "PIDX"
+
+// pool index: header, then records of files from cold to hot
+struct PoolIndexHeader {
+    uint32_t magic;
+    uint32_t checksum; // crc32c of all records
+    uint64_t count;
+    uint64_t length; // in bytes, of all records
+};
+
+struct PoolIndexRecord {
+    uint64_t size;
+    uint32_t nameLength; // followed by the name
+    uint32_t reserved;
+};
+
+static bool isPoolIndex(std::string_view file) {
+    std::string_view index(FileCachePool::kPoolIndexFile);
+    while (!file.empty() && file.front() == '/') {
+        file.remove_prefix(1);
+    }
+    index.remove_prefix(1);
+    return file.substr(0, index.size()) == index;
+}
+
+// a path without trailing '/', "/" becomes empty, as the parent of all
+static std::string_view trimPath(std::string_view path) {
+    while (!path.empty() && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+    return path;
+}
+
+static bool underPath(std::string_view name, std::string_view path) {
+    return name.size() >= path.size() && name.substr(0, path.size()) == path &&
+           (name.size() == path.size() || name[path.size()] == '/');
+}
+
 const uint64_t kMaxFreeSpace = 50 * kGB;
 const int64_t kEvictionMark = 5ll * kGB;
 
 FileCachePool::FileCachePool(IFileSystem *mediaFs, uint64_t capacityInGB, uint64_t periodInUs,
-                             uint64_t diskAvailInBytes, uint64_t refillUnit)
+                             uint64_t diskAvailInBytes, uint64_t refillUnit, int policy)
     : ICachePool(0), mediaFs_(mediaFs), capacityInGB_(capacityInGB), periodInUs_(periodInUs),
       diskAvailInBytes_(diskAvailInBytes), refillUnit_(refillUnit), totalUsed_(0), timer_(nullptr),
-      running_(false), exit_(false), isFull_(false) {
+      running_(false), exit_(false), isFull_(false),
+      lru_(policy == POLICY_2Q ? kProtectedPercent : 0) {
     int64_t capacityInBytes = capacityInGB_ * kGB;
     waterMark_ = calcWaterMark(capacityInBytes, kMaxFreeSpace);
     // keep this relation : waterMark < riskMark < capacity
@@ -57,35 +98,91 @@ FileCachePool::~FileCachePool() {
         delete timer_;
     }
     this->stores_clear();
+    if (timer_) {
+        saveIndex();
+    }
     delete mediaFs_;
 }
 
 void FileCachePool::Init() {
-    traverseDir("/");
+    if (loadIndex() != 0) {
+        traverseDir("/");
+    }
     timer_ = new photon::Timer(periodInUs_, {this, FileCachePool::timerHandler}, true,
                                8UL * 1024 * 1024);
 }
 
 ICacheStore *FileCachePool::do_open(std::string_view pathname, int flags, mode_t mode) {
+    // hold the shard while opening, so that eviction won't unlink the file in between
+    auto shard = indexShard(pathname);
+    photon::scoped_lock lock(indexLock_[shard]);
     auto localFile = openMedia(pathname, flags, mode);
     if (!localFile) {
         return nullptr;
     }
 
-    auto find = fileIndex_.find(pathname);
-    if (find == fileIndex_.end()) {
-        auto lruIter = lru_.push_front(fileIndex_.end());
-        std::unique_ptr<LruEntry> entry(new LruEntry{lruIter, 1, 0});
-        find = fileIndex_.emplace(pathname, std::move(entry)).first;
-        lru_.front() = find;
+    auto &index = fileIndex_[shard];
+    auto find = index.find(pathname);
+    if (find == index.end()) {
+        std::unique_ptr<LruEntry> entry(new LruEntry{0, 1, 0});
+        find = index.emplace(pathname, std::move(entry)).first;
+        photon::scoped_lock l(lruLock_);
+        find->second->lruIter = lru_.push_front({find, kNoUnit});
     } else {
-        lru_.access(find->second->lruIter);
+        {
+            photon::scoped_lock l(lruLock_);
+            accessLru(find->second->lruIter);
+        }
         find->second->openCount++;
+        if (find->second->sizeUnchecked) {
+            // validate lazily what was loaded from pool index
+            struct stat st = {};
+            if (localFile->fstat(&st) == 0) {
+                uint64_t size = st.st_blocks * kDiskBlockSize;
+                auto old = find->second->size.exchange(size);
+                totalUsed_ += static_cast<int64_t>(size) - static_cast<int64_t>(old);
+                find->second->sizeUnchecked = false;
+            }
+        }
     }
 
     return new FileCacheStore(this, localFile, refillUnit_, find);
 }
 
+size_t FileCachePool::indexShard(std::string_view name) {
+    return std::hash<std::string_view>()(name) % kIndexShards;
+}
+
+std::vector<FileCachePool::FileNameMap::iterator> FileCachePool::findFiles(std::string_view path) {
+    std::vector<FileNameMap::iterator> files;
+    {
+        auto shard = indexShard(path);
+        photon::scoped_lock lock(indexLock_[shard]);
+        auto find = fileIndex_[shard].find(path);
+        if (find != fileIndex_[shard].end()) {
+            files.push_back(find);
+            return files;
+        }
+    }
+    for (size_t i = 0; i < kIndexShards; i++) {
+        photon::scoped_lock lock(indexLock_[i]);
+        for (auto it = fileIndex_[i].begin(); it != fileIndex_[i].end(); ++it) {
+            if (underPath(it->first, path)) {
+                files.push_back(it);
+            }
+        }
+    }
+    return files;
+}
+
+uint64_t FileCachePool::usage(std::string_view path) {
+    uint64_t used = 0;
+    for (auto iter : findFiles(path)) {
+        used += iter->second->size;
+    }
+    return used;
+}
+
 IFile *FileCachePool::openMedia(std::string_view name, int flags, int mode) {
     if (name.empty() || name[0] != '/') {
         LOG_ERROR_RETURN(EINVAL, nullptr, "pathname is invalid, path : `", name);
@@ -106,28 +203,165 @@ IFile *FileCachePool::openMedia(std::string_view name, int flags, int mode) {
 }
 
 int FileCachePool::set_quota(std::string_view pathname, size_t quota) {
-    errno = ENOSYS;
-    return -1;
+    if (pathname.empty() || pathname[0] != '/') {
+        LOG_ERROR_RETURN(EINVAL, -1, "pathname is invalid, path : `", pathname);
+    }
+    auto path = trimPath(pathname);
+    photon::scoped_lock lock(quotaLock_);
+    if (quota == 0) {
+        auto it = quotas_.find(path);
+        if (it != quotas_.end()) {
+            quotas_.erase(it);
+        }
+        return 0;
+    }
+    auto it = quotas_.find(path);
+    if (it == quotas_.end()) {
+        quotas_.emplace(path, quota);
+    } else {
+        it->second = quota;
+    }
+    return 0;
 }
 
 int FileCachePool::stat(CacheStat *stat, std::string_view pathname) {
-    errno = ENOSYS;
-    return -1;
+    auto path = trimPath(pathname);
+    auto units = [&](uint64_t bytes) {
+        return static_cast<uint32_t>((bytes + refillUnit_ - 1) / refillUnit_);
+    };
+    stat->refill_unit = refillUnit_;
+    if (path.empty()) {
+        stat->total_size = units(capacityInGB_ * kGB);
+        stat->used_size = units(std::max(totalUsed_.load(), static_cast<int64_t>(0)));
+        stat->evict_global = evictGlobal_.load();
+        stat->evict_user = evictUser_.load();
+        stat->evict_other = evictOther_.load();
+        return 0;
+    }
+    stat->evict_global = stat->evict_user = stat->evict_other = 0;
+
+    uint64_t quota = 0;
+    {
+        photon::scoped_lock lock(quotaLock_);
+        auto it = quotas_.find(path);
+        if (it != quotas_.end()) {
+            quota = it->second;
+        }
+    }
+    lockEviction();
+    DEFER(running_ = false);
+    auto files = findFiles(path);
+    if (files.empty() && quota == 0) {
+        LOG_ERROR_RETURN(ENOENT, -1, "no cached file under `", pathname);
+    }
+    if (files.size() == 1 && files[0]->first == path) {
+        struct stat st = {};
+        if (mediaFs_->stat(files[0]->first.data(), &st) != 0) {
+            LOG_ERRNO_RETURN(0, -1, "stat failed, name : `", files[0]->first);
+        }
+        stat->total_size = units(quota ? quota : st.st_size);
+        stat->used_size = units(files[0]->second->size);
+        return 0;
+    }
+    uint64_t used = 0;
+    for (auto iter : files) {
+        used += iter->second->size;
+    }
+    // a dir without quota is limited by the pool only
+    stat->total_size = units(quota ? quota : capacityInGB_ * kGB);
+    stat->used_size = units(used);
+    return 0;
 }
 
 int FileCachePool::evict(std::string_view filename) {
-    errno = ENOSYS;
-    return -1;
+    auto path = trimPath(filename);
+    lockEviction();
+    DEFER(running_ = false);
+    auto files = findFiles(path);
+    if (files.empty()) {
+        LOG_ERROR_RETURN(ENOENT, -1, "no cached file under `", filename);
+    }
+    uint64_t freed = 0;
+    for (auto iter : files) {
+        // files not opened are unlinked, opened ones are truncated to 0 and kept
+        freed += evictVictim({iter, kNoUnit}, false);
+        photon::thread_yield();
+    }
+    evictUser_ += freed;
+    LOG_INFO("evicted ` files under `, freed : `", files.size(), filename, freed);
+    return 0;
 }
 
 int FileCachePool::evict(size_t size) {
-    errno = ENOSYS;
-    return -1;
+    lockEviction();
+    DEFER(running_ = false);
+    auto totalUsed = static_cast<uint64_t>(std::max(totalUsed_.load(), static_cast<int64_t>(0)));
+    auto actualEvict = std::max(calcEviction(),
+                                static_cast<int64_t>(std::min<uint64_t>(size, totalUsed)));
+    if (actualEvict > 0) {
+        evictUser_ += evictLru(actualEvict);
+    }
+    evictOther_ += evictQuotas();
+    return 0;
+}
+
+int FileCachePool::reset(int flags) {
+    if (flags != RST_STAT) {
+        LOG_ERROR_RETURN(ENOSYS, -1, "only RST_STAT is supported by reset");
+    }
+    evictGlobal_ = 0;
+    evictUser_ = 0;
+    evictOther_ = 0;
+    return 0;
 }
 
 int FileCachePool::rename(std::string_view oldname, std::string_view newname) {
-    errno = ENOSYS;
-    return -1;
+    if (newname.empty() || newname[0] != '/') {
+        LOG_ERROR_RETURN(EINVAL, -1, "pathname is invalid, path : `", newname);
+    }
+    lockEviction();
+    DEFER(running_ = false);
+    auto oldShard = indexShard(oldname), newShard = indexShard(newname);
+    auto first = std::min(oldShard, newShard), second = std::max(oldShard, newShard);
+    indexLock_[first].lock();
+    DEFER(indexLock_[first].unlock());
+    if (second != first) {
+        indexLock_[second].lock();
+    }
+    DEFER(if (second != first) indexLock_[second].unlock());
+
+    auto &oldIndex = fileIndex_[oldShard];
+    auto &newIndex = fileIndex_[newShard];
+    auto find = oldIndex.find(oldname);
+    if (find == oldIndex.end()) {
+        LOG_ERROR_RETURN(ENOENT, -1, "file not cached, name : `", oldname);
+    }
+    if (newIndex.find(newname) != newIndex.end()) {
+        LOG_ERROR_RETURN(EEXIST, -1, "file already cached, name : `", newname);
+    }
+    // the store keeps its iterator, so opened files can't be renamed
+    if (find->second->openCount > 0) {
+        LOG_ERROR_RETURN(EBUSY, -1, "file is opened, name : `", oldname);
+    }
+    std::string target(newname);
+    if (mkdir_recursive(Path(target.c_str()).dirname(), mediaFs_) != 0) {
+        LOG_ERRNO_RETURN(0, -1, "mkdir failed, path : `", newname);
+    }
+    if (mediaFs_->rename(find->first.data(), target.c_str()) != 0) {
+        LOG_ERRNO_RETURN(0, -1, "rename failed, ` -> `", oldname, newname);
+    }
+    auto entry = std::move(find->second);
+    oldIndex.erase(find);
+    auto iter = newIndex.emplace(newname, std::move(entry)).first;
+    photon::scoped_lock lock(lruLock_);
+    auto lruEntry = iter->second.get();
+    lru_.get(lruEntry->lruIter).file = iter;
+    for (auto key : lruEntry->units) {
+        if (key != kNoUnit) {
+            lru_.get(key).file = iter;
+        }
+    }
+    return 0;
 }
 
 bool FileCachePool::isFull() {
@@ -135,6 +369,7 @@ bool FileCachePool::isFull() {
 }
 
 void FileCachePool::removeOpenFile(FileNameMap::iterator iter) {
+    photon::scoped_lock lock(indexLock_[indexShard(iter->first)]);
     iter->second->openCount--;
 }
 
@@ -142,22 +377,53 @@ void FileCachePool::forceRecycle() {
     timerHandler(this);
 }
 
-void FileCachePool::updateLru(FileNameMap::iterator iter) {
-    lru_.access(iter->second->lruIter);
+void FileCachePool::updateLru(FileNameMap::iterator iter, off_t offset, size_t count,
+                              bool lowPriority) {
+    if (count == 0) {
+        return;
+    }
+    auto lruEntry = iter->second.get();
+    size_t begin = offset / refillUnit_;
+    size_t end = (offset + count - 1) / refillUnit_ + 1;
+    photon::scoped_lock lock(lruLock_);
+    if (lruEntry->units.size() < end) {
+        lruEntry->units.resize(end, kNoUnit);
+    }
+    for (auto i = begin; i < end; i++) {
+        auto &key = lruEntry->units[i];
+        if (key == kNoUnit) {
+            LruUnit unit{iter, static_cast<uint32_t>(i)};
+            key = lowPriority ? lru_.push_back(unit) : lru_.push_front(unit);
+        } else if (!lowPriority) {
+            accessLru(key);
+        }
+    }
+}
+
+void FileCachePool::accessLru(uint32_t key) {
+    // promotion and demotion between segments change keys
+    lru_.access(key, [](LruUnit &x, uint32_t newKey) {
+        auto lruEntry = x.file->second.get();
+        if (x.unit == kNoUnit) {
+            lruEntry->lruIter = newKey;
+        } else {
+            lruEntry->units[x.unit] = newKey;
+        }
+    });
 }
 
 //  currently, we exist duplicate pwrite
 uint64_t FileCachePool::updateSpace(FileNameMap::iterator iter, uint64_t size) {
     auto lruEntry = iter->second.get();
     uint64_t diff = 0;
-    if (size > lruEntry->size) {
-        diff = size - lruEntry->size;
+    auto old = lruEntry->size.exchange(size);
+    if (size > old) {
+        diff = size - old;
         totalUsed_ += diff;
     }
-    lruEntry->size = size;
     if (totalUsed_ >= riskMark_) {
-        LOG_WARN("pwrite is so heavy, totalUsed:`,riskMark:` || lruEntry->size = `", totalUsed_,
-                 riskMark_, lruEntry->size);
+        LOG_WARN("pwrite is so heavy, totalUsed:`,riskMark:` || lruEntry->size = `",
+                 totalUsed_.load(), riskMark_, lruEntry->size.load());
         isFull_ = true;
         forceRecycle();
         if (lruEntry->size == 0)
@@ -169,96 +435,217 @@ uint64_t FileCachePool::updateSpace(FileNameMap::iterator iter, uint64_t size) {
 
 uint64_t FileCachePool::timerHandler(void *data) {
     auto cur = static_cast<FileCachePool *>(data);
-    if (cur->running_) {
+    // may be forced by writers on other vcpus
+    if (cur->running_.exchange(true)) {
         return 0;
     }
-    cur->running_ = true;
     DEFER(cur->running_ = false;);
     cur->eviction();
     return 0;
 }
 
 void FileCachePool::eviction() {
+    DEFER(isFull_ = false);
+    auto actualEvict = calcEviction();
+    if (actualEvict > 0) {
+        isFull_ = true;
+        evictGlobal_ += evictLru(actualEvict);
+    }
+    evictOther_ += evictQuotas();
+}
+
+int64_t FileCachePool::calcEviction() {
     uint64_t evictByDisk = 0;
     uint64_t evictByCache = 0;
     uint64_t fsCapacity = 0;
 
-    DEFER(isFull_ = false);
     struct statvfs stFs = {};
     auto err = mediaFs_->statvfs("/", &stFs);
     if (err) {
         LOG_ERROR("statvfs failed, ret : `, error code : `", err, ERRNO());
-        return;
+        return 0;
     } else {
         fsCapacity = stFs.f_frsize * stFs.f_blocks;
         uint64_t diskAvailInBytes = stFs.f_bavail * stFs.f_frsize;
         if (diskAvailInBytes < diskAvailInBytes_) {
             evictByDisk = diskAvailInBytes_ - diskAvailInBytes;
         } else if (fsCapacity <= waterMark_) { // we occupy the whole disk
-            return;
+            return 0;
         }
     }
 
-    if (totalUsed_ >= static_cast<int64_t>(waterMark_)) {
-        evictByCache = totalUsed_ - waterMark_;
+    int64_t totalUsed = totalUsed_;
+    if (totalUsed >= static_cast<int64_t>(waterMark_)) {
+        evictByCache = totalUsed - waterMark_;
     }
 
     auto actualEvict = std::min(
         static_cast<int64_t>(std::max(evictByCache, evictByDisk)),
-        totalUsed_
+        totalUsed
     );
 
-    if (actualEvict <= 0) {
-        return;
+    if (actualEvict > 0 && !exit_) {
+        LOG_AUDIT("eviction", VALUE(actualEvict), VALUE(evictByCache), VALUE(evictByDisk), VALUE(totalUsed));
     }
+    return actualEvict;
+}
 
-    isFull_ = true;
+void FileCachePool::lockEviction() {
+    while (running_.exchange(true)) {
+        photon::thread_usleep(1000);
+    }
+}
 
-    if (!lru_.empty() && !exit_) {
-        LOG_AUDIT("eviction", VALUE(actualEvict), VALUE(evictByCache), VALUE(evictByDisk), VALUE(totalUsed_));
+void FileCachePool::detachVictim(const LruUnit &victim, bool &untracked) {
+    auto lruEntry = victim.file->second.get();
+    untracked = false;
+    if (victim.unit != kNoUnit) {
+        lru_.remove(lruEntry->units[victim.unit]);
+        lruEntry->units[victim.unit] = kNoUnit;
+    } else if (!lruEntry->units.empty()) {
+        // keep the tracked units, they have their own place in lru
+        lru_.mark_key_cleared(lruEntry->lruIter);
+        untracked = true;
+    } else if (lruEntry->openCount == 0) {
+        lru_.mark_key_cleared(lruEntry->lruIter);
+    } else {
+        accessLru(lruEntry->lruIter);
     }
+}
 
-    while (actualEvict > 0 && !lru_.empty() && !exit_) {
-        auto fileIter = lru_.back();
-        const auto &fileName = fileIter->first;
-        auto lruEntry = fileIter->second.get();
-        auto fileSize = lruEntry->size;
-        if (lruEntry->openCount == 0) {
-            lru_.mark_key_cleared(fileIter->second->lruIter);
-        } else {
-            lru_.access(fileIter->second->lruIter);
+uint64_t FileCachePool::evictVictim(const LruUnit &victim, bool untracked) {
+    auto fileIter = victim.file;
+    if (victim.unit != kNoUnit) {
+        off_t offset = static_cast<off_t>(victim.unit) * refillUnit_;
+        return punchHoles(fileIter, {{offset, refillUnit_}});
+    }
+    if (untracked) {
+        return evictUntracked(fileIter);
+    }
+    const auto &fileName = fileIter->first;
+    auto lruEntry = fileIter->second.get();
+    uint64_t fileSize = lruEntry->size;
+    // as soon as possible truncate and unlink
+    if (0 == fileSize) {
+        if (0 == fileIter->second->openCount) {
+            afterFtrucate(fileIter);
         }
-        // as soon as possible truncate and unlink
-        if (0 == fileSize) {
-            if (0 == fileIter->second->openCount) {
-                afterFtrucate(fileIter);
-            }
-            photon::thread_yield();
-            continue;
+        return 0;
+    }
+
+    int err;
+    {
+        photon::scoped_rwlock rl(lruEntry->rw_lock_, photon::WLOCK);
+        lruEntry->clearCached(0);
+        err = mediaFs_->truncate(fileName.data(), 0);
+        lruEntry->truncate_done = false;
+    }
+
+    if (err) {
+        ERRNO e;
+        LOG_ERROR("truncate(0) failed, name : `, ret : `, error code : `", fileName, err, e);
+        // truncate to 0 failed means unable to free the file, it should not consider as a part
+        // of cache. Deal as it already release.
+        // The only exception is errno EINTR, means truncate interrupted by signal, should try
+        // again
+        if (e.no == EINTR) {
+            return 0;
         }
+    }
+    afterFtrucate(fileIter);
+    return fileSize;
+}
 
+uint64_t FileCachePool::evictLru(int64_t bytes) {
+    uint64_t freed = 0;
+    while (bytes > 0 && !exit_) {
+        // only pick the victim under lruLock_, the I/O is done without it
+        LruUnit victim;
+        bool untracked = false;
         {
-            photon::scoped_rwlock rl(lruEntry->rw_lock_, photon::WLOCK);
-            err = mediaFs_->truncate(fileName.data(), 0);
-            lruEntry->truncate_done = false;
+            photon::scoped_lock lock(lruLock_);
+            if (lru_.empty()) {
+                break;
+            }
+            victim = lru_.back();
+            detachVictim(victim, untracked);
         }
+        auto n = evictVictim(victim, untracked);
+        bytes -= static_cast<int64_t>(n);
+        freed += n;
+        photon::thread_yield();
+    }
+    return freed;
+}
 
-        if (err) {
-            ERRNO e;
-            LOG_ERROR("truncate(0) failed, name : `, ret : `, error code : `", fileName, err, e);
-            // truncate to 0 failed means unable to free the file, it should not consider as a part
-            // of cache. Deal as it already release.
-            // The only exception is errno EINTR, means truncate interrupted by signal, should try
-            // again
-            if (e.no == EINTR) {
-                photon::thread_yield();
+uint64_t FileCachePool::evictUnder(std::string_view path, int64_t bytes) {
+    // Victims are picked in a batch by one scan of lru, and kept by name, as evicting one
+    // may remove the entry of another.
+    std::vector<std::pair<std::string, uint32_t>> victims;
+    {
+        photon::scoped_lock lock(lruLock_);
+        int64_t picked = 0;
+        lru_.for_each_from_back([&](LruUnit &x) {
+            if (picked >= bytes || !underPath(x.file->first, path)) {
+                return;
+            }
+            victims.emplace_back(x.file->first, x.unit);
+            auto lruEntry = x.file->second.get();
+            if (x.unit != kNoUnit) {
+                picked += refillUnit_;
+            } else if (lruEntry->units.empty()) {
+                picked += lruEntry->size;
+            }
+        });
+    }
+    uint64_t freed = 0;
+    for (auto &x : victims) {
+        if (exit_) {
+            break;
+        }
+        auto shard = indexShard(x.first);
+        FileNameMap::iterator iter;
+        {
+            photon::scoped_lock lock(indexLock_[shard]);
+            iter = fileIndex_[shard].find(x.first);
+            if (iter == fileIndex_[shard].end()) {
+                continue;
+            }
+        }
+        LruUnit victim{iter, x.second};
+        bool untracked = false;
+        {
+            photon::scoped_lock lock(lruLock_);
+            auto &units = iter->second->units;
+            if (x.second != kNoUnit && (x.second >= units.size() || units[x.second] == kNoUnit)) {
                 continue;
             }
+            detachVictim(victim, untracked);
         }
-        afterFtrucate(fileIter);
-        actualEvict -= fileSize;
+        freed += evictVictim(victim, untracked);
         photon::thread_yield();
     }
+    return freed;
+}
+
+uint64_t FileCachePool::evictQuotas() {
+    std::vector<std::pair<std::string, uint64_t>> quotas;
+    {
+        photon::scoped_lock lock(quotaLock_);
+        for (auto &x : quotas_) {
+            quotas.emplace_back(x.first, x.second);
+        }
+    }
+    uint64_t freed = 0;
+    for (auto &x : quotas) {
+        auto used = usage(x.first);
+        if (used <= x.second || exit_) {
+            continue;
+        }
+        LOG_AUDIT("quota eviction", VALUE(x.first), VALUE(x.second), VALUE(used));
+        freed += evictUnder(x.first, used - x.second);
+    }
+    return freed;
 }
 
 uint64_t FileCachePool::calcWaterMark(uint64_t capacity, uint64_t maxFreeSpace) {
@@ -268,8 +655,13 @@ uint64_t FileCachePool::calcWaterMark(uint64_t capacity, uint64_t maxFreeSpace)
 
 bool FileCachePool::afterFtrucate(FileNameMap::iterator iter) {
     auto lruEntry = iter->second.get();
-    totalUsed_ -= static_cast<int64_t>(lruEntry->size);
-    lruEntry->size = 0;
+    auto shard = indexShard(iter->first);
+    photon::scoped_lock lock(indexLock_[shard]);
+    {
+        photon::scoped_lock l(lruLock_);
+        removeUnits(lruEntry);
+    }
+    totalUsed_ -= static_cast<int64_t>(lruEntry->size.exchange(0));
     if (totalUsed_ < 0) {
         totalUsed_ = 0;
     }
@@ -283,14 +675,101 @@ bool FileCachePool::afterFtrucate(FileNameMap::iterator iter) {
         if (err && (e.no == EBUSY)) {
             return false;
         }
-        lru_.remove(iter->second->lruIter);
-        fileIndex_.erase(iter);
+        {
+            photon::scoped_lock l(lruLock_);
+            lru_.remove(iter->second->lruIter);
+        }
+        fileIndex_[shard].erase(iter);
     }
     return true;
 }
 
+uint64_t FileCachePool::evictUntracked(FileNameMap::iterator iter) {
+    std::vector<std::pair<off_t, size_t>> ranges;
+    size_t begin = 0;
+    {
+        photon::scoped_lock lock(lruLock_);
+        auto &units = iter->second->units;
+        for (size_t i = 0; i < units.size(); i++) {
+            if (units[i] == kNoUnit) {
+                continue;
+            }
+            if (i > begin) {
+                ranges.emplace_back(begin * refillUnit_, (i - begin) * refillUnit_);
+            }
+            begin = i + 1;
+        }
+    }
+    ranges.emplace_back(begin * refillUnit_, static_cast<size_t>(-1)); // to the end of file
+    return punchHoles(iter, ranges);
+}
+
+uint64_t FileCachePool::punchHoles(FileNameMap::iterator iter,
+                                   const std::vector<std::pair<off_t, size_t>> &ranges) {
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 0x01 /* default is extend size */
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_PUNCH_HOLE 0x02 /* de-allocates range */
+#endif
+    const auto &fileName = iter->first;
+    auto lruEntry = iter->second.get();
+    auto file = mediaFs_->open(fileName.data(), O_RDWR);
+    if (file == nullptr) {
+        LOG_ERRNO_RETURN(0, 0, "open failed, name : `", fileName);
+    }
+    DEFER(delete file);
+    struct stat st = {};
+    {
+        photon::scoped_rwlock rl(lruEntry->rw_lock_, photon::WLOCK);
+        if (file->fstat(&st) != 0) {
+            LOG_ERRNO_RETURN(0, 0, "fstat failed, name : `", fileName);
+        }
+        for (auto &range : ranges) {
+            if (range.first >= st.st_size) {
+                continue;
+            }
+            auto count = std::min(range.second, static_cast<size_t>(st.st_size - range.first));
+            lruEntry->clearCached(range.first / refillUnit_,
+                                  (range.first + count - 1) / refillUnit_ + 1);
+            auto err = file->fallocate(FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, range.first,
+                                       count);
+            if (err) {
+                LOG_ERROR("punch hole failed, name : `, offset : `, count : `, error code : `",
+                          fileName, range.first, count, ERRNO());
+            }
+        }
+        if (file->fstat(&st) != 0) {
+            LOG_ERRNO_RETURN(0, 0, "fstat failed, name : `", fileName);
+        }
+    }
+    uint64_t size = st.st_blocks * kDiskBlockSize;
+    uint64_t old = lruEntry->size.exchange(size);
+    uint64_t freed = old > size ? old - size : 0;
+    totalUsed_ -= static_cast<int64_t>(freed);
+    if (totalUsed_ < 0) {
+        totalUsed_ = 0;
+    }
+    if (0 == size && 0 == lruEntry->openCount) {
+        afterFtrucate(iter);
+    }
+    return freed;
+}
+
+void FileCachePool::removeUnits(LruEntry *lruEntry) {
+    for (auto key : lruEntry->units) {
+        if (key != kNoUnit) {
+            lru_.remove(key);
+        }
+    }
+    std::vector<uint32_t>().swap(lruEntry->units);
+}
+
 int FileCachePool::traverseDir(const std::string &root) {
     for (auto file : enumerable(Walker(mediaFs_, root))) {
+        if (isPoolIndex(file)) {
+            continue;
+        }
         insertFile(file);
     }
     return 0;
@@ -302,13 +781,141 @@ int FileCachePool::insertFile(std::string_view file) {
     if (ret) {
         LOG_ERRNO_RETURN(0, -1, "stat failed, name : `", file.data());
     }
-    auto fileSize = st.st_blocks * kDiskBlockSize;
+    insertEntry(file, st.st_blocks * kDiskBlockSize, false);
+    return 0;
+}
+
+void FileCachePool::insertEntry(std::string_view file, uint64_t size, bool sizeUnchecked) {
+    auto shard = indexShard(file);
+    photon::scoped_lock lock(indexLock_[shard]);
+    auto entry = std::unique_ptr<LruEntry>(new LruEntry{0, 0, size});
+    entry->sizeUnchecked = sizeUnchecked;
+    auto res = fileIndex_[shard].emplace(file, std::move(entry));
+    if (!res.second) {
+        LOG_WARN("file ` is already in the pool, not inserted again", file);
+        return;
+    }
+    auto iter = res.first;
+    {
+        photon::scoped_lock l(lruLock_);
+        iter->second->lruIter = lru_.push_front({iter, kNoUnit});
+    }
+    totalUsed_ += size;
+}
+
+int FileCachePool::loadIndex() {
+    auto file = mediaFs_->open(kPoolIndexFile, O_RDONLY);
+    if (file == nullptr) {
+        LOG_INFO("pool index ` not loaded, traverse media dir, error code : `", kPoolIndexFile,
+                 ERRNO());
+        return -1;
+    }
+    DEFER(delete file);
+    // the index stays valid only until the pool changes, so it is consumed here,
+    // and a crash before next save falls back to traverseDir
+    DEFER(mediaFs_->unlink(kPoolIndexFile));
+
+    PoolIndexHeader header = {};
+    if (file->pread(&header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        LOG_ERRNO_RETURN(0, -1, "failed to read pool index header");
+    }
+    if (header.magic != kPoolIndexMagic) {
+        LOG_ERROR_RETURN(0, -1, "pool index magic error");
+    }
+    struct stat st = {};
+    if (file->fstat(&st) != 0) {
+        LOG_ERRNO_RETURN(0, -1, "failed to stat pool index");
+    }
+    if (header.length > (uint64_t)st.st_size - sizeof(header)) {
+        LOG_ERROR_RETURN(0, -1, "pool index length error, length : `, file size : `",
+                         header.length, st.st_size);
+    }
+    std::string buf;
+    buf.resize(header.length);
+    if (file->pread(&buf[0], header.length, sizeof(header)) != (ssize_t)header.length) {
+        LOG_ERRNO_RETURN(0, -1, "failed to read pool index, length : `", header.length);
+    }
+    if (header.checksum != crc32::crc32c(buf.data(), buf.size())) {
+        LOG_ERROR_RETURN(0, -1, "pool index checksum error");
+    }
+
+    std::vector<std::pair<std::string_view, uint64_t>> files;
+    size_t pos = 0;
+    while (pos < buf.size()) {
+        PoolIndexRecord record;
+        if (pos + sizeof(record) > buf.size()) {
+            LOG_ERROR_RETURN(0, -1, "pool index record truncated, offset : `", pos);
+        }
+        memcpy(&record, buf.data() + pos, sizeof(record));
+        pos += sizeof(record);
+        if (record.nameLength == 0 || pos + record.nameLength > buf.size()) {
+            LOG_ERROR_RETURN(0, -1, "pool index record truncated, offset : `", pos);
+        }
+        files.emplace_back(std::string_view(buf.data() + pos, record.nameLength), record.size);
+        pos += record.nameLength;
+    }
+    if (files.size() != header.count) {
+        LOG_ERROR_RETURN(0, -1, "pool index count mismatch, expected : `, got : `", header.count,
+                         files.size());
+    }
+    for (auto &x : files) {
+        insertEntry(x.first, x.second, true);
+    }
+    LOG_INFO("pool index loaded, files : `, used : `", files.size(), totalUsed_.load());
+    return 0;
+}
+
+int FileCachePool::saveIndex() {
+    std::string buf;
+    uint64_t count = 0;
+    {
+        // a file is as hot as its hottest unit
+        std::vector<std::pair<FileNameMap::iterator, bool>> files;
+        std::unordered_map<LruEntry *, size_t> position;
+        photon::scoped_lock lock(lruLock_);
+        lru_.for_each_from_back([&](LruUnit &x) {
+            auto it = position.find(x.file->second.get());
+            if (it != position.end()) {
+                files[it->second].second = false;
+            }
+            position[x.file->second.get()] = files.size();
+            files.emplace_back(x.file, true);
+        });
+        for (auto &x : files) {
+            if (!x.second || x.first->second->size == 0) {
+                continue;
+            }
+            const auto &name = x.first->first;
+            PoolIndexRecord record = {x.first->second->size, (uint32_t)name.size(), 0};
+            buf.append((const char *)&record, sizeof(record));
+            buf.append(name.data(), name.size());
+            count++;
+        }
+    }
 
-    auto lruIter = lru_.push_front(fileIndex_.end());
-    auto entry = std::unique_ptr<LruEntry>(new LruEntry{lruIter, 0, fileSize});
-    auto iter = fileIndex_.emplace(file, std::move(entry)).first;
-    lru_.front() = iter;
-    totalUsed_ += fileSize;
+    PoolIndexHeader header = {kPoolIndexMagic, crc32::crc32c(buf.data(), buf.size()), count,
+                              buf.size()};
+    std::string tmpName = std::string(kPoolIndexFile) + ".tmp";
+    {
+        auto file = mediaFs_->open(tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file == nullptr) {
+            LOG_ERRNO_RETURN(0, -1, "failed to create pool index `", tmpName);
+        }
+        DEFER(delete file);
+        if (file->pwrite(&header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            file->pwrite(buf.data(), buf.size(), sizeof(header)) != (ssize_t)buf.size() ||
+            file->fdatasync() != 0) {
+            ERRNO e;
+            mediaFs_->unlink(tmpName.c_str());
+            LOG_ERROR_RETURN(e.no, -1, "failed to write pool index `", tmpName);
+        }
+    }
+    if (mediaFs_->rename(tmpName.c_str(), kPoolIndexFile) != 0) {
+        ERRNO e;
+        mediaFs_->unlink(tmpName.c_str());
+        LOG_ERROR_RETURN(e.no, -1, "failed to rename pool index `", tmpName);
+    }
+    LOG_INFO("pool index saved, files : `", count);
     return 0;
 }
 
@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <memory>
 #include <string>
@@ -24,7 +26,7 @@
 #include <photon/thread/thread.h>
 #include <photon/thread/timer.h>
 #include <photon/common/string-keyed.h>
-#include "../policy/lru.h"
+#include "../policy/slru.h"
 #include "../pool_store.h"
 
 #include <photon/fs/filesystem.h>
@@ -34,12 +36,16 @@ namespace Cache {
 class FileCachePool : public FileSystem::ICachePool {
 public:
     FileCachePool(photon::fs::IFileSystem *mediaFs, uint64_t capacityInGB, uint64_t periodInUs,
-                  uint64_t diskAvailInBytes, uint64_t refillUnit);
+                  uint64_t diskAvailInBytes, uint64_t refillUnit, int policy = POLICY_LRU);
     ~FileCachePool();
 
     static const uint64_t kDiskBlockSize = 512; // stat(2)
     static const uint64_t kDeleteDelayInUs = 1000;
     static const uint32_t kWaterMarkRatio = 90;
+    // share of units, hit more than once, that is protected from scans by POLICY_2Q
+    static const uint32_t kProtectedPercent = 75;
+    // snapshot of fileIndex_ and lru order, saved at exit and consumed at Init
+    static constexpr const char *kPoolIndexFile = "/.pool_index";
 
     void Init();
 
@@ -53,17 +59,57 @@ public:
     int evict(std::string_view filename) override;
     int evict(size_t size = 0) override;
     int rename(std::string_view oldname, std::string_view newname) override;
+    // only RST_STAT is supported
+    int reset(int flags = 0) override;
+
+    static const uint32_t kNoUnit = UINT32_MAX;
 
     struct LruEntry {
         LruEntry(uint32_t lruIt, int openCnt, uint64_t fileSize)
             : lruIter(lruIt), openCount(openCnt), size(fileSize), truncate_done(false) {
         }
         ~LruEntry() = default;
-        uint32_t lruIter;
-        int openCount;
-        uint64_t size;
+        uint32_t lruIter; // for the data of the file not tracked in `units`
+        std::atomic<int> openCount;
+        std::atomic<uint64_t> size;
         photon::rwlock rw_lock_;
         bool truncate_done;
+        // size is loaded from pool index and not checked against the media file yet
+        bool sizeUnchecked = false;
+        // refill unit index -> lru key of the unit, kNoUnit if not tracked,
+        // guarded by FileCachePool::lruLock_
+        std::vector<uint32_t> units;
+        // refill unit index -> whether the whole unit is in the media file,
+        // units not marked are checked by fiemap
+        std::vector<bool> cachedUnits;
+        mutable photon::mutex cachedLock;
+
+        void setCached(size_t begin, size_t end) {
+            photon::scoped_lock lock(cachedLock);
+            if (cachedUnits.size() < end) {
+                cachedUnits.resize(end, false);
+            }
+            std::fill(cachedUnits.begin() + begin, cachedUnits.begin() + end, true);
+        }
+        void clearCached(size_t begin, size_t end = SIZE_MAX) {
+            photon::scoped_lock lock(cachedLock);
+            end = std::min(end, cachedUnits.size());
+            if (begin < end) {
+                std::fill(cachedUnits.begin() + begin, cachedUnits.begin() + end, false);
+            }
+        }
+        bool isCached(size_t begin, size_t end) const {
+            photon::scoped_lock lock(cachedLock);
+            if (end > cachedUnits.size()) {
+                return false;
+            }
+            for (auto i = begin; i < end; i++) {
+                if (!cachedUnits[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
     };
 
     // Normally, fileIndex(std::map) always keep growing, so its iterators always
@@ -72,12 +118,25 @@ public:
     // erased iterator.
     typedef map_string_key<std::unique_ptr<LruEntry>> FileNameMap;
 
+    // Recency is tracked per refill unit that has been written or read since the file was
+    // opened, so that cold units of a hot file can be reclaimed by punching holes. Data of
+    // a file that is not tracked by unit, e.g. found at startup, is represented by the
+    // entry with unit kNoUnit.
+    struct LruUnit {
+        FileNameMap::iterator file;
+        uint32_t unit;
+    };
+
     bool isFull();
     void removeOpenFile(FileNameMap::iterator iter);
     void forceRecycle();
-    void updateLru(FileNameMap::iterator iter);
+    // low priority data is inserted as the coldest, and doesn't get promoted when hit
+    void updateLru(FileNameMap::iterator iter, off_t offset, size_t count,
+                   bool lowPriority = false);
     uint64_t updateSpace(FileNameMap::iterator iter, uint64_t size);
 
+    static const size_t kIndexShards = 32;
+
 protected:
     photon::fs::IFile *openMedia(std::string_view name, int flags, int mode);
 
@@ -90,25 +149,66 @@ protected:
     uint64_t periodInUs_;
     uint64_t diskAvailInBytes_;
     size_t refillUnit_;
-    int64_t totalUsed_;
+    std::atomic<int64_t> totalUsed_;
     int64_t riskMark_;
     uint64_t waterMark_;
 
     photon::Timer *timer_;
-    bool running_;
+    std::atomic<bool> running_;
     bool exit_;
 
-    bool isFull_;
+    std::atomic<bool> isFull_;
 
     virtual bool afterFtrucate(FileNameMap::iterator iter);
 
+    // reclaim the untracked data of a file that has tracked units, or the given ranges,
+    // returns bytes freed
+    uint64_t evictUntracked(FileNameMap::iterator iter);
+    uint64_t punchHoles(FileNameMap::iterator iter,
+                        const std::vector<std::pair<off_t, size_t>> &ranges);
+    void removeUnits(LruEntry *lruEntry);
+    // called with lruLock_ held
+    void accessLru(uint32_t key);
+
     int traverseDir(const std::string &root);
     virtual int insertFile(std::string_view file);
-
-    typedef FileSystem::LRU<FileNameMap::iterator, uint32_t> LRUContainer;
+    void insertEntry(std::string_view file, uint64_t size, bool sizeUnchecked);
+    int loadIndex();
+    int saveIndex();
+
+    size_t indexShard(std::string_view name);
+    // the file itself, or files under the dir `path`
+    std::vector<FileNameMap::iterator> findFiles(std::string_view path);
+    uint64_t usage(std::string_view path);
+
+    // bytes to evict to keep the water marks of cache and disk
+    int64_t calcEviction();
+    // wait for the running eviction, so that entries are removed by the caller only
+    void lockEviction();
+    // called with lruLock_ held, detach the victim from lru_ before evicting it
+    void detachVictim(const LruUnit &victim, bool &untracked);
+    // returns bytes freed
+    uint64_t evictVictim(const LruUnit &victim, bool untracked);
+    uint64_t evictLru(int64_t bytes);
+    uint64_t evictUnder(std::string_view path, int64_t bytes);
+    uint64_t evictQuotas();
+
+    // pathname -> quota in bytes, of a dir or a file
+    map_string_key<uint64_t> quotas_;
+    photon::mutex quotaLock_;
+    // bytes evicted for the water marks, by user requests, and for quotas
+    std::atomic<uint64_t> evictGlobal_{0}, evictUser_{0}, evictOther_{0};
+
+    // Stores may be used from multiple vcpus. An index shard lock guards its map and the
+    // openCount of its entries, lruLock_ guards lru_ and the units of all entries. Lock
+    // order: index shard, lruLock_. Only open, rename and unlink of media files are done
+    // under an index shard lock, no other I/O is done under either of them.
+    typedef FileSystem::SegmentedLRU<LruUnit, uint32_t> LRUContainer;
     LRUContainer lru_;
+    photon::mutex lruLock_;
     // filename -> lruEntry
-    FileNameMap fileIndex_;
+    FileNameMap fileIndex_[kIndexShards];
+    photon::mutex indexLock_[kIndexShards];
 };
 
 } //  namespace Cache
@@ -24,6 +24,7 @@
 #include <photon/fs/filesystem.h>
 #include <photon/common/iovector.h>
 #include "cache_pool.h"
+#include "../cache.h"
 
 using namespace FileSystem;
 using namespace photon::fs;
@@ -38,6 +39,7 @@ FileCacheStore::FileCacheStore(FileSystem::ICachePool *cachePool, IFile *localFi
                                size_t refillUnit, FileIterator iterator)
     : cachePool_(static_cast<FileCachePool *>(cachePool)), localFile_(localFile),
       refillUnit_(refillUnit), iterator_(iterator) {
+    loadCachedUnits();
 }
 
 FileCacheStore::~FileCacheStore() {
@@ -56,7 +58,8 @@ ssize_t FileCacheStore::do_preadv2(const struct iovec *iov, int iovcnt, off_t of
     // TODO(suoshi.yf): maybe a new interface for updating lru is better for avoiding
     // multiple cacheStore preadvs but cacheFile preadv only once
     ssize_t ret;
-    cachePool_->updateLru(iterator_);
+    cachePool_->updateLru(iterator_, offset, iovector_view((iovec *)iov, iovcnt).sum(),
+                          flags & RW_V2_LOW_PRIORITY);
     SCOPE_AUDIT_THRESHOLD(1UL * 1000, "file:read", AU_FILEOP("", offset, ret));
     ret = localFile_->preadv(iov, iovcnt, offset);
     return ret;
@@ -78,9 +81,75 @@ ssize_t FileCacheStore::do_pwritev(const struct iovec *iov, int iovcnt, off_t of
     ScopedRangeLock lock(rangeLock_, offset, view.sum());
     SCOPE_AUDIT_THRESHOLD(10UL * 1000, "file:write", AU_FILEOP("", offset, ret));
     ret = localFile_->pwritev(iov, iovcnt, offset);
+    if (ret > 0) {
+        // mark while holding the lock, so that eviction won't slip in between
+        markCached(offset, ret);
+    }
     return ret;
 }
 
+void FileCacheStore::markCached(off_t offset, size_t count) {
+    auto end = offset + static_cast<off_t>(count);
+    size_t begin = align_up(offset, refillUnit_) / refillUnit_;
+    size_t last = end / refillUnit_;
+    if (actual_size_ > 0 && end >= actual_size_ && end % refillUnit_ != 0 &&
+        static_cast<off_t>(last * refillUnit_) >= offset) {
+        last++; // the tail unit of file
+    }
+    if (begin < last) {
+        iterator_->second->setCached(begin, last);
+    }
+}
+
+int FileCacheStore::loadCachedUnits() {
+    auto lruEntry = iterator_->second.get();
+    lruEntry->clearCached(0);
+    struct stat st = {};
+    if (localFile_->fstat(&st) != 0) {
+        LOG_ERRNO_RETURN(0, -1, "fstat failed");
+    }
+    photon::scoped_rwlock rl(lruEntry->rw_lock_, photon::RLOCK);
+    // mark units covered by continuous extents, fiemap batch by batch
+    uint64_t runStart = 0, runEnd = 0, start = 0;
+    auto markRun = [&]() {
+        if (runStart >= runEnd) {
+            return;
+        }
+        size_t begin = align_up(runStart, refillUnit_) / refillUnit_;
+        size_t last = runEnd >= static_cast<uint64_t>(st.st_size)
+                          ? (st.st_size - 1) / refillUnit_ + 1
+                          : runEnd / refillUnit_;
+        if (begin < last) {
+            lruEntry->setCached(begin, last);
+        }
+    };
+    while (start < static_cast<uint64_t>(st.st_size)) {
+        struct fiemap_t<kFieExtentSize> fie(start, st.st_size - start);
+        fie.fm_mapped_extents = 0;
+        if (localFile_->fiemap(&fie) != 0) {
+            LOG_ERRNO_RETURN(0, -1, "media fiemap failed, offset : `", start);
+        }
+        for (uint32_t i = 0; i < fie.fm_mapped_extents; i++) {
+            auto &extent = fie.fm_extents[i];
+            if ((extent.fe_flags == FIEMAP_EXTENT_UNKNOWN) ||
+                (extent.fe_flags == FIEMAP_EXTENT_UNWRITTEN)) {
+                continue;
+            }
+            if (extent.fe_logical != runEnd) {
+                markRun();
+                runStart = extent.fe_logical;
+            }
+            runEnd = extent.fe_logical_end();
+        }
+        if (fie.fm_mapped_extents < kFieExtentSize) {
+            break;
+        }
+        start = fie.fm_extents[kFieExtentSize - 1].fe_logical_end();
+    }
+    markRun();
+    return 0;
+}
+
 ssize_t FileCacheStore::do_pwritev2(const struct iovec *iov, int iovcnt, off_t offset, int flags) {
     if (cacheIsFull()) {
         errno = ENOSPC;
@@ -98,7 +167,7 @@ ssize_t FileCacheStore::do_pwritev2(const struct iovec *iov, int iovcnt, off_t o
         if (err) {
             LOG_ERRNO_RETURN(0, ret, "fstat failed")
         }
-        cachePool_->updateLru(iterator_);
+        cachePool_->updateLru(iterator_, offset, ret, flags & RW_V2_LOW_PRIORITY);
         cachePool_->updateSpace(iterator_, kDiskBlockSize * st.st_blocks);
     }
     return ret;
@@ -106,6 +175,10 @@ ssize_t FileCacheStore::do_pwritev2(const struct iovec *iov, int iovcnt, off_t o
 
 std::pair<off_t, size_t> FileCacheStore::queryRefillRange(off_t offset, size_t size) {
     ScopedRangeLock lock(rangeLock_, offset, size);
+    if (size > 0 &&
+        iterator_->second->isCached(offset / refillUnit_, (offset + size - 1) / refillUnit_ + 1)) {
+        return std::make_pair(0, 0);
+    }
     off_t alignLeft = align_down(offset, kBlockSize);
     off_t alignRight = align_up(offset + size, kBlockSize);
     ReadRequest request{alignLeft, static_cast<size_t>(alignRight - alignLeft)};
@@ -167,17 +240,16 @@ std::pair<off_t, size_t> FileCacheStore::queryRefillRange(off_t offset, size_t s
 }
 
 int FileCacheStore::set_quota(size_t quota) {
-    errno = ENOSYS;
-    return -1;
+    return cachePool_->set_quota(iterator_->first, quota);
 }
 
 int FileCacheStore::stat(CacheStat *stat) {
-    errno = ENOSYS;
-    return -1;
+    return cachePool_->stat(stat, iterator_->first);
 }
 
 int FileCacheStore::evict(off_t offset, size_t count) {
     if (static_cast<size_t>(-1) == count) {
+        iterator_->second->clearCached(offset / refillUnit_);
         return localFile_->ftruncate(offset);
     } else {
 #ifndef FALLOC_FL_KEEP_SIZE
@@ -187,6 +259,10 @@ int FileCacheStore::evict(off_t offset, size_t count) {
 #define FALLOC_FL_PUNCH_HOLE 0x02 /* de-allocates range */
 #endif
         int mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+        if (count > 0) {
+            iterator_->second->clearCached(offset / refillUnit_,
+                                           (offset + count - 1) / refillUnit_ + 1);
+        }
         return localFile_->fallocate(mode, offset, count);
     }
 }
@@ -69,6 +69,10 @@ protected:
     RangeLock rangeLock_;
 
     ssize_t do_pwritev(const struct iovec *iov, int iovcnt, off_t offset);
+
+    // keep FileCachePool::LruEntry::cachedUnits, so that cache hits need no fiemap
+    void markCached(off_t offset, size_t count);
+    int loadCachedUnits();
 };
 
 } //  namespace Cache
@@ -0,0 +1,450 @@
+/*
+   Copyright The Overlaybd Authors
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "tiered_pool.h"
+#include <sys/mman.h>
+#include <algorithm>
+#include <photon/common/alog.h>
+#include <photon/common/iovector.h>
+#include <photon/common/utility.h>
+#include "../cache.h"
+
+namespace Cache {
+
+using namespace FileSystem;
+
+// forget access counts of units not promoted, beyond this many per store
+const size_t kMaxAccessCount = 4096;
+
+TieredCachePool::TieredCachePool(ICachePool *lower, uint64_t capacity, size_t unit,
+                                 uint32_t promoteHits)
+    : lower_(lower), unit_(unit), promoteHits_(std::max(promoteHits, 1u)) {
+    arenaSize_ = capacity / unit_ * unit_;
+    if (arenaSize_ == 0) {
+        return;
+    }
+    auto p = mmap(nullptr, arenaSize_, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        LOG_ERROR("failed to reserve memory tier, size : `, error code : `", arenaSize_, ERRNO());
+        arenaSize_ = 0;
+        return;
+    }
+    arena_ = static_cast<char *>(p);
+    slotLimit_ = capacity / unit_;
+    for (uint32_t i = slotLimit_; i > 0; i--) {
+        freeSlots_.push_back(i - 1);
+    }
+    slotRefs_.assign(slotLimit_, 0);
+    slotReleased_.assign(slotLimit_, false);
+}
+
+TieredCachePool::~TieredCachePool() {
+    this->stores_clear();
+    if (arena_) {
+        munmap(arena_, arenaSize_);
+    }
+    delete lower_;
+}
+
+ICacheStore *TieredCachePool::do_open(std::string_view pathname, int flags, mode_t mode) {
+    auto lower = lower_->open(pathname, flags, mode);
+    if (lower == nullptr) {
+        LOG_ERRNO_RETURN(0, nullptr, "lower pool open failed, name : `", pathname);
+    }
+    return new TieredCacheStore(this, lower);
+}
+
+int TieredCachePool::set_quota(std::string_view pathname, size_t quota) {
+    return lower_->set_quota(pathname, quota);
+}
+
+int TieredCachePool::stat(CacheStat *stat, std::string_view pathname) {
+    return lower_->stat(stat, pathname);
+}
+
+int TieredCachePool::evict(std::string_view filename) {
+    return lower_->evict(filename);
+}
+
+int TieredCachePool::evict(size_t size) {
+    return lower_->evict(size);
+}
+
+int TieredCachePool::rename(std::string_view oldname, std::string_view newname) {
+    return lower_->rename(oldname, newname);
+}
+
+int TieredCachePool::reset(int flags) {
+    if (flags == RST_ALL || (flags & RST_MEMORY)) {
+        photon::scoped_lock lock(lock_);
+        shrink(0);
+    }
+    if (flags == RST_MEMORY) {
+        return 0;
+    }
+    return lower_->reset(flags & ~RST_MEMORY);
+}
+
+int TieredCachePool::resize(size_t n, int flags) {
+    if (!(flags & RSZ_MEMORY)) {
+        return lower_->resize(n, flags);
+    }
+    if (n > arenaSize_) {
+        LOG_ERROR_RETURN(EINVAL, -1, "memory tier can't grow beyond ` bytes", arenaSize_);
+    }
+    photon::scoped_lock lock(lock_);
+    slotLimit_ = n / unit_;
+    shrink(slotLimit_);
+    return 0;
+}
+
+void TieredCachePool::get_tier_stat(TierStat *stat) {
+    stat->mem_hits = memHits_;
+    stat->lower_hits = lowerHits_;
+    stat->misses = misses_;
+    stat->promotions = promotions_;
+    photon::scoped_lock lock(lock_);
+    stat->mem_used = slotsUsed_ * unit_;
+    stat->mem_capacity = slotLimit_ * unit_;
+}
+
+ssize_t TieredCachePool::readMem(TieredCacheStore *store, const struct iovec *iov, int iovcnt,
+                                 off_t offset) {
+    iovector_view view((iovec *)iov, iovcnt);
+    size_t count = view.sum();
+    if (count == 0 || slotLimit_ == 0) {
+        return -1;
+    }
+    uint64_t begin = offset / unit_, end = (offset + count - 1) / unit_ + 1;
+    // copies, as units may be released or replaced while being read
+    std::vector<Slot> slots;
+    {
+        photon::scoped_lock lock(lock_);
+        for (auto i = begin; i < end; i++) {
+            auto it = store->units_.find(i);
+            if (it == store->units_.end()) {
+                return -1;
+            }
+            slots.push_back(it->second);
+        }
+        if ((end - 1) * unit_ + slots.back().length < offset + count) {
+            return -1; // beyond the tail
+        }
+        for (auto &slot : slots) {
+            slotRefs_[slot.index]++;
+            lru_.access(slot.lruKey);
+        }
+    }
+
+    SmartCloneIOV<32> ciov(iov, iovcnt);
+    iovector_view dest(ciov.iov, iovcnt);
+    for (auto i = begin; i < end; i++) {
+        auto &slot = slots[i - begin];
+        off_t start = std::max(offset, static_cast<off_t>(i * unit_));
+        size_t length = std::min(offset + count, (i + 1) * unit_) - start;
+        dest.memcpy_from(slotBuffer(slot.index) + start - i * unit_, length);
+        dest.extract_front(length);
+    }
+
+    memHits_++;
+    photon::scoped_lock lock(lock_);
+    for (auto &slot : slots) {
+        unref(slot.index);
+    }
+    return count;
+}
+
+bool TieredCachePool::inMem(TieredCacheStore *store, off_t offset, size_t count) {
+    if (count == 0 || slotLimit_ == 0) {
+        return false;
+    }
+    photon::scoped_lock lock(lock_);
+    for (uint64_t i = offset / unit_; i <= (offset + count - 1) / unit_; i++) {
+        auto it = store->units_.find(i);
+        if (it == store->units_.end() || i * unit_ + it->second.length < std::min(
+                                             offset + count, (i + 1) * unit_)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TieredCachePool::touch(TieredCacheStore *store, off_t offset, size_t count) {
+    if (count == 0 || slotLimit_ == 0) {
+        return;
+    }
+    std::vector<uint64_t> hot;
+    {
+        photon::scoped_lock lock(lock_);
+        if (store->accessCount_.size() > kMaxAccessCount) {
+            store->accessCount_.clear();
+        }
+        for (uint64_t i = offset / unit_; i <= (offset + count - 1) / unit_; i++) {
+            if (store->units_.count(i)) {
+                continue;
+            }
+            if (++store->accessCount_[i] >= promoteHits_) {
+                store->accessCount_.erase(i);
+                hot.push_back(i);
+            }
+        }
+    }
+
+    for (auto i : hot) {
+        off_t start = i * unit_;
+        auto actual_size = store->get_actual_size();
+        if (start >= actual_size) {
+            break;
+        }
+        uint32_t length = std::min(static_cast<off_t>(unit_), actual_size - start);
+        uint32_t index;
+        {
+            photon::scoped_lock lock(lock_);
+            if (store->units_.count(i) || allocSlot(&index) == nullptr) {
+                continue;
+            }
+        }
+        struct iovec v {
+            slotBuffer(index), length
+        };
+        auto tr = store->syncLower()->try_preadv2(&v, 1, start, 0);
+        photon::scoped_lock lock(lock_);
+        if (tr.refill_size == 0 && tr.size == (ssize_t)length && !store->units_.count(i)) {
+            install(store, i, index, length);
+            promotions_++;
+        } else {
+            freeSlot(index);
+        }
+    }
+}
+
+ssize_t TieredCachePool::writeMem(TieredCacheStore *store, const struct iovec *iov, int iovcnt,
+                                  off_t offset) {
+    iovector_view view((iovec *)iov, iovcnt);
+    size_t count = view.sum();
+    if (slotLimit_ == 0) {
+        return count;
+    }
+    SmartCloneIOV<32> ciov(iov, iovcnt);
+    iovector_view src(ciov.iov, iovcnt);
+    off_t end = offset + count;
+    auto actual_size = store->get_actual_size();
+    // only whole units, or the tail unit of file, are kept
+    for (uint64_t i = align_up(offset, unit_) / unit_; (off_t)(i * unit_) < end; i++) {
+        off_t start = i * unit_;
+        if (start >= actual_size) {
+            break;
+        }
+        uint32_t length = std::min(static_cast<off_t>(unit_), actual_size - start);
+        if (start + length > end) {
+            break;
+        }
+        src.extract_front(start - (offset + count - src.sum()));
+        uint32_t index;
+        photon::scoped_lock lock(lock_);
+        if (store->units_.count(i)) {
+            release(i, store->units_);
+        }
+        auto buf = allocSlot(&index);
+        if (buf == nullptr) {
+            break;
+        }
+        src.memcpy_to(buf, length);
+        install(store, i, index, length);
+    }
+    return count;
+}
+
+void TieredCachePool::invalidate(TieredCacheStore *store, off_t offset, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    photon::scoped_lock lock(lock_);
+    uint64_t end = count == (size_t)-1 ? UINT64_MAX : (offset + count - 1) / unit_ + 1;
+    for (auto it = store->units_.begin(); it != store->units_.end();) {
+        auto i = (it++)->first;
+        if (i >= offset / unit_ && i < end) {
+            release(i, store->units_);
+        }
+    }
+}
+
+void TieredCachePool::dropStore(TieredCacheStore *store) {
+    photon::scoped_lock lock(lock_);
+    while (!store->units_.empty()) {
+        release(store->units_.begin()->first, store->units_);
+    }
+}
+
+char *TieredCachePool::allocSlot(uint32_t *index) {
+    // evict the coldest units that are not being read
+    size_t tries = lru_.size();
+    while (slotsUsed_ >= slotLimit_ || freeSlots_.empty()) {
+        if (lru_.empty() || tries-- == 0) {
+            return nullptr;
+        }
+        auto victim = lru_.back();
+        auto &units = victim.store->units_;
+        auto &slot = units[victim.unit];
+        if (slotRefs_[slot.index]) {
+            lru_.access(slot.lruKey);
+            continue;
+        }
+        release(victim.unit, units);
+    }
+    *index = freeSlots_.back();
+    freeSlots_.pop_back();
+    slotsUsed_++;
+    return slotBuffer(*index);
+}
+
+void TieredCachePool::install(TieredCacheStore *store, uint64_t unit, uint32_t index,
+                              uint32_t length) {
+    auto key = lru_.push_front({store, unit});
+    store->units_[unit] = Slot{key, index, length};
+}
+
+void TieredCachePool::release(uint64_t unit, std::unordered_map<uint64_t, Slot> &units) {
+    auto it = units.find(unit);
+    auto index = it->second.index;
+    lru_.remove(it->second.lruKey);
+    units.erase(it);
+    if (slotRefs_[index]) {
+        slotReleased_[index] = true;
+    } else {
+        freeSlot(index);
+    }
+}
+
+void TieredCachePool::freeSlot(uint32_t index) {
+    freeSlots_.push_back(index);
+    slotsUsed_--;
+}
+
+void TieredCachePool::unref(uint32_t index) {
+    if (--slotRefs_[index] == 0 && slotReleased_[index]) {
+        slotReleased_[index] = false;
+        freeSlot(index);
+    }
+}
+
+size_t TieredCachePool::shrink(size_t slots) {
+    size_t released = 0;
+    while (slotsUsed_ > slots && !lru_.empty()) {
+        auto victim = lru_.back();
+        auto &units = victim.store->units_;
+        if (slotRefs_[units[victim.unit].index]) {
+            break;
+        }
+        release(victim.unit, units);
+        released++;
+    }
+    if (slotsUsed_ == 0 && arena_) {
+        // give the pages back
+        madvise(arena_, arenaSize_, MADV_DONTNEED);
+    }
+    return released;
+}
+
+TieredCacheStore::TieredCacheStore(TieredCachePool *pool, ICacheStore *lower)
+    : tieredPool_(pool), lower_(lower) {
+}
+
+TieredCacheStore::~TieredCacheStore() {
+    tieredPool_->dropStore(this);
+    lower_->release();
+}
+
+ICacheStore::try_preadv_result TieredCacheStore::try_preadv2(const struct iovec *iov, int iovcnt,
+                                                             off_t offset, int flags) {
+    try_preadv_result rst;
+    auto n = tieredPool_->readMem(this, iov, iovcnt, offset);
+    if (n >= 0) {
+        rst.iov_sum = n;
+        rst.refill_size = 0;
+        rst.size = n;
+        return rst;
+    }
+    rst = syncLower()->try_preadv2(iov, iovcnt, offset, flags);
+    if (rst.refill_size == 0 && rst.size >= 0) {
+        tieredPool_->lowerHits_++;
+        if (!(flags & RW_V2_LOW_PRIORITY)) {
+            tieredPool_->touch(this, offset, rst.iov_sum);
+        }
+    } else {
+        tieredPool_->misses_++;
+    }
+    return rst;
+}
+
+ssize_t TieredCacheStore::do_preadv2(const struct iovec *iov, int iovcnt, off_t offset,
+                                     int flags) {
+    auto n = tieredPool_->readMem(this, iov, iovcnt, offset);
+    if (n >= 0) {
+        return n;
+    }
+    return syncLower()->do_preadv2(iov, iovcnt, offset, flags);
+}
+
+ssize_t TieredCacheStore::do_pwritev2(const struct iovec *iov, int iovcnt, off_t offset,
+                                      int flags) {
+    if (flags & RW_V2_MEMORY_ONLY) {
+        return tieredPool_->writeMem(this, iov, iovcnt, offset);
+    }
+    tieredPool_->invalidate(this, offset, iovector_view((iovec *)iov, iovcnt).sum());
+    return syncLower()->do_pwritev2(iov, iovcnt, offset, flags);
+}
+
+int TieredCacheStore::set_quota(size_t quota) {
+    return lower_->set_quota(quota);
+}
+
+int TieredCacheStore::stat(CacheStat *stat) {
+    return lower_->stat(stat);
+}
+
+int TieredCacheStore::evict(off_t offset, size_t count) {
+    tieredPool_->invalidate(this, offset, count);
+    return syncLower()->evict(offset, count);
+}
+
+std::pair<off_t, size_t> TieredCacheStore::queryRefillRange(off_t offset, size_t size) {
+    if (tieredPool_->inMem(this, offset, size)) {
+        return std::make_pair(0, 0);
+    }
+    return syncLower()->queryRefillRange(offset, size);
+}
+
+int TieredCacheStore::fstat(struct stat *buf) {
+    return lower_->fstat(buf);
+}
+
+uint64_t TieredCacheStore::get_handle() {
+    return lower_->get_handle();
+}
+
+} // namespace Cache
+
+namespace FileSystem {
+ICachePool *new_tiered_cache_pool(ICachePool *lower, uint64_t memCapacity, size_t memUnit,
+                                  uint32_t promoteHits) {
+    if (memUnit % 4096 != 0 || !is_power_of_2(memUnit)) {
+        LOG_ERROR_RETURN(EINVAL, nullptr, "memory unit need to be aligned to 4KB and power of 2");
+    }
+    return new ::Cache::TieredCachePool(lower, memCapacity, memUnit, promoteHits);
+}
+} // namespace FileSystem
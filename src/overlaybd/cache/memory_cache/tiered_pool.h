@@ -0,0 +1,147 @@
+/*
+   Copyright The Overlaybd Authors
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+#include <photon/thread/thread.h>
+#include "../policy/lru.h"
+#include "../pool_store.h"
+
+namespace Cache {
+
+struct TierStat {
+    uint64_t mem_hits;     // reads served by the memory tier
+    uint64_t lower_hits;   // reads served by the lower pool
+    uint64_t misses;       // reads that had to refill from source
+    uint64_t promotions;   // units copied from the lower pool into memory
+    uint64_t mem_used;     // in bytes
+    uint64_t mem_capacity; // in bytes
+};
+
+class TieredCacheStore;
+
+// A memory tier of hot units over any ICachePool. A unit is promoted into memory after
+// it has been read from the lower pool `promoteHits` times, and the least recently used
+// units are dropped when memory is full. Memory is reserved up front, so it never grows
+// beyond `capacity`.
+class TieredCachePool : public FileSystem::ICachePool {
+public:
+    TieredCachePool(ICachePool *lower, uint64_t capacity, size_t unit, uint32_t promoteHits);
+    ~TieredCachePool();
+
+    FileSystem::ICacheStore *do_open(std::string_view pathname, int flags, mode_t mode) override;
+
+    int set_quota(std::string_view pathname, size_t quota) override;
+    int stat(FileSystem::CacheStat *stat,
+             std::string_view pathname = std::string_view(nullptr, 0)) override;
+    int evict(std::string_view filename) override;
+    int evict(size_t size = 0) override;
+    int rename(std::string_view oldname, std::string_view newname) override;
+    int reset(int flags = 0) override;
+    int resize(size_t n, int flags = 0) override;
+
+    void get_tier_stat(TierStat *stat);
+
+protected:
+    struct Slot {
+        uint32_t lruKey;
+        uint32_t index; // in arena
+        uint32_t length;
+    };
+    struct MemUnit {
+        TieredCacheStore *store;
+        uint64_t unit;
+    };
+
+    // copy [offset, offset + sum) out of memory, only if all of it is there
+    ssize_t readMem(TieredCacheStore *store, const struct iovec *iov, int iovcnt, off_t offset);
+    bool inMem(TieredCacheStore *store, off_t offset, size_t count);
+    // count a read served by the lower pool, and promote the units that become hot
+    void touch(TieredCacheStore *store, off_t offset, size_t count);
+    ssize_t writeMem(TieredCacheStore *store, const struct iovec *iov, int iovcnt, off_t offset);
+    void invalidate(TieredCacheStore *store, off_t offset, size_t count);
+    void dropStore(TieredCacheStore *store);
+
+    // both are called with lock_ held
+    char *allocSlot(uint32_t *index);
+    void install(TieredCacheStore *store, uint64_t unit, uint32_t index, uint32_t length);
+    // a slot being read is only freed by the last unref()
+    void release(uint64_t unit, std::unordered_map<uint64_t, Slot> &units);
+    void freeSlot(uint32_t index);
+    void unref(uint32_t index);
+    size_t shrink(size_t slots);
+
+    char *slotBuffer(uint32_t index) {
+        return arena_ + static_cast<uint64_t>(index) * unit_;
+    }
+
+    ICachePool *lower_; // owned by current class
+    size_t unit_;
+    uint32_t promoteHits_;
+    char *arena_ = nullptr;
+    size_t arenaSize_ = 0;
+    size_t slotLimit_ = 0;
+    size_t slotsUsed_ = 0;
+    std::vector<uint32_t> freeSlots_;
+    // of each slot in arena, reads copying out of it, and whether it's released meanwhile
+    std::vector<uint32_t> slotRefs_;
+    std::vector<bool> slotReleased_;
+    FileSystem::LRU<MemUnit, uint32_t> lru_;
+    photon::mutex lock_;
+
+    std::atomic<uint64_t> memHits_{0};
+    std::atomic<uint64_t> lowerHits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> promotions_{0};
+
+    friend class TieredCacheStore;
+};
+
+class TieredCacheStore : public FileSystem::ICacheStore {
+public:
+    TieredCacheStore(TieredCachePool *pool, ICacheStore *lower);
+    ~TieredCacheStore();
+
+    try_preadv_result try_preadv2(const struct iovec *iov, int iovcnt, off_t offset,
+                                  int flags) override;
+    ssize_t do_preadv2(const struct iovec *iov, int iovcnt, off_t offset, int flags) override;
+    ssize_t do_pwritev2(const struct iovec *iov, int iovcnt, off_t offset, int flags) override;
+
+    int set_quota(size_t quota) override;
+    int stat(FileSystem::CacheStat *stat) override;
+    int evict(off_t offset, size_t count = -1) override;
+    std::pair<off_t, size_t> queryRefillRange(off_t offset, size_t size) override;
+    int fstat(struct stat *buf) override;
+    uint64_t get_handle() override;
+
+protected:
+    ICacheStore *syncLower() {
+        lower_->set_actual_size(actual_size_);
+        return lower_;
+    }
+
+    TieredCachePool *tieredPool_; // owned by extern class
+    ICacheStore *lower_;          // released by current class
+    // guarded by the pool's lock_
+    std::unordered_map<uint64_t, TieredCachePool::Slot> units_;
+    std::unordered_map<uint64_t, uint32_t> accessCount_;
+
+    friend class TieredCachePool;
+};
+
+} // namespace Cache
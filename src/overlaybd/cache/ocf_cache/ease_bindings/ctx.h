@@ -1,7 +1,9 @@
 #pragma once
 
 #include <sys/uio.h>
+#include <atomic>
 #include <string>
+#include <vector>
 
 #include <photon/thread/thread.h>
 #include <photon/fs/filesystem.h>
@@ -11,6 +13,10 @@ extern "C" {
 #include <ocf/ocf.h>
 }
 
+namespace photon {
+class WorkPool;
+}
+
 #define ROUND_UP(N, S) ((((N) + (S)-1) / (S)) * (S))
 #define ROUND_DOWN(N, S) ((N) & ~((S)-1))
 
@@ -70,7 +76,11 @@ struct ease_ocf_config {
 
 struct ease_ocf_queue {
     ocf_queue_t mngt_queue;
-    ocf_queue_t io_queue;
+    // I/O queues, I/Os are submitted to them round robin
+    std::vector<ocf_queue_t> io_queues;
+    std::atomic<uint32_t> next_io_queue{0};
+    // run the I/O queues, owned
+    std::vector<photon::WorkPool *> io_pools;
 };
 
 /* Context config */
@@ -10,7 +10,10 @@
 
 #include "provider.h"
 
+#include <algorithm>
+
 #include <photon/common/alog.h>
+#include <photon/fs/localfs.h>
 
 
 extern IOAlloc *g_io_alloc;
@@ -109,15 +112,15 @@ int ease_ocf_provider::start(bool reload_media) {
     }
     ocf_mngt_cache_set_mngt_queue(m_cache, m_queue->mngt_queue);
 
-    /* Create IO submission queue */
-    ret = ocf_queue_create(m_cache, &m_queue->io_queue, get_queue_ops());
+    init_mngt_queue(m_queue->mngt_queue, m_volume_params->media_io_engine);
+
+    /* Create IO submission queues */
+    ret = create_io_queues();
     if (ret != 0) {
-        LOG_ERROR("OCF: failed to create io queue");
+        LOG_ERROR("OCF: failed to create io queues");
         return ret;
     }
 
-    init_queues(m_queue->mngt_queue, m_queue->io_queue);
-
     if (reload_media) {
         /* Reload cache instance */
         ocf_mngt_cache_load(m_cache, &m_cfg.device, simple_complete, &simple_ctx);
@@ -177,6 +180,10 @@ int ease_ocf_provider::stop() {
     if (m_queue != nullptr) {
         ocf_queue_put(m_queue->mngt_queue);
         LOG_DEBUG("OCF: done put management queue");
+        // I/O queues are put by stopping the cache
+        for (auto pool : m_queue->io_pools) {
+            delete pool;
+        }
     }
 
     delete m_queue;
@@ -296,8 +303,10 @@ ssize_t ease_ocf_provider::ocf_pread(void *buf, size_t count, off_t offset, size
     /* Create data */
     ease_ocf_io_data data(iov.iovec(), iov.iovcnt(), iov.sum(), blk_addr, ctx, prefetch);
 
+    auto queue = get_io_queue();
+
     /* Create io */
-    ocf_io *io = ocf_core_new_io(m_core, m_queue->io_queue, data.blk_addr + align.lower_bound,
+    ocf_io *io = ocf_core_new_io(m_core, queue, data.blk_addr + align.lower_bound,
                                  (uint32_t)iov.sum(), OCF_READ, 0, 0);
     if (io == nullptr) {
         LOG_ERRNO_RETURN(ENOMEM, -1, "OCF: failed to create new IO, count `, offset `, blk_addr `",
@@ -325,3 +334,55 @@ ssize_t ease_ocf_provider::ocf_pread(void *buf, size_t count, off_t offset, size
     LOG_DEBUG("Finish IO: pread buf `, count `, offset `", buf, count, offset);
     return count;
 }
+
+int ease_ocf_provider::ocf_discard(size_t blk_addr, size_t count) {
+    LOG_DEBUG("New IO: discard blk_addr `, count `", blk_addr, count);
+    auto queue = get_io_queue();
+
+    // size of an OCF io is 32-bit
+    const size_t max_discard = 1UL << 30;
+    for (size_t done = 0; done < count;) {
+        size_t n = std::min(count - done, max_discard);
+        int error = 0;
+        ease_ocf_io_data data(nullptr, 0, 0, blk_addr, nullptr, false);
+        ocf_io *io = ocf_core_new_io(m_core, queue, blk_addr + done, (uint32_t)n, OCF_WRITE, 0, 0);
+        if (io == nullptr) {
+            LOG_ERRNO_RETURN(ENOMEM, -1, "OCF: failed to create new discard IO, blk_addr `",
+                             blk_addr + done);
+        }
+        ocf_io_set_data(io, &data, 0);
+        ocf_io_set_cmpl(io, nullptr, &error, read_complete);
+        ocf_core_submit_discard(io);
+
+        data.sem.wait(1);
+        if (error != 0) {
+            LOG_ERROR_RETURN(EIO, -1, "OCF: discard error `, blk_addr `", error, blk_addr + done);
+        }
+        done += n;
+    }
+    return 0;
+}
+
+int ease_ocf_provider::create_io_queues() {
+    // A fixed set of queues rather than one per vcpu of the callers: reads come from photon
+    // threads of arbitrary vcpus, whose count the cache doesn't know, so they are spread over the
+    // queues round robin. Each queue runs on a pool of its own, queues don't contend for vcpus.
+    for (uint32_t i = 0; i < m_io_queues; i++) {
+        ocf_queue_t queue;
+        int ret = ocf_queue_create(m_cache, &queue, get_queue_ops());
+        if (ret != 0) {
+            LOG_ERROR_RETURN(0, ret, "OCF: failed to create io queue `", i);
+        }
+        auto pool = new_io_queue_pool(m_volume_params->media_io_engine);
+        m_queue->io_pools.push_back(pool);
+        init_io_queue(queue, pool);
+        m_queue->io_queues.push_back(queue);
+    }
+    LOG_INFO("OCF: ` io queues created", m_io_queues);
+    return 0;
+}
+
+ocf_queue_t ease_ocf_provider::get_io_queue() {
+    auto n = m_queue->next_io_queue.fetch_add(1, std::memory_order_relaxed);
+    return m_queue->io_queues[n % m_queue->io_queues.size()];
+}
@@ -9,8 +9,11 @@
 
 class ease_ocf_provider {
 public:
-    ease_ocf_provider(ease_ocf_volume_params *params, size_t prefetch_unit)
-        : m_volume_params(params), m_prefetch_unit(prefetch_unit) {
+    // io_queues == 0 means DEFAULT_IO_QUEUES
+    ease_ocf_provider(ease_ocf_volume_params *params, size_t prefetch_unit,
+                      uint32_t io_queues = 0)
+        : m_volume_params(params), m_prefetch_unit(prefetch_unit),
+          m_io_queues(io_queues ? io_queues : DEFAULT_IO_QUEUES) {
     }
 
     int start(bool reload_media);
@@ -24,12 +27,21 @@ public:
     ssize_t ocf_pread(void *buf, size_t count, off_t offset, size_t blk_addr, OcfSrcFileCtx *ctx,
                       bool prefetch = false);
 
+    /**
+     * @brief Invalidate the cached data of [blk_addr, blk_addr + count) in core address space,
+     * so that the range can be reused by another src file.
+     * @return 0 for success
+     */
+    int ocf_discard(size_t blk_addr, size_t count);
+
     size_t prefetch_unit() const {
         return m_prefetch_unit;
     }
 
     static const size_t SectorSize;
 
+    static const uint32_t DEFAULT_IO_QUEUES = 4;
+
 private:
     static constexpr const char *CACHE_NAME = "Ease Cache";
     static constexpr const char *CORE_NAME = "Ease Core";
@@ -54,6 +66,13 @@ private:
 
     size_t m_prefetch_unit;
 
+    uint32_t m_io_queues;
+
+    int create_io_queues();
+
+    // the I/O queue to submit the next I/O to
+    ocf_queue_t get_io_queue();
+
     /*
      *       |                       |                       |                       |
      *       |                       |                       |                       |
@@ -1,5 +1,6 @@
 #include "queue.h"
 
+#include <photon/fs/localfs.h>
 #include <photon/thread/thread-pool.h>
 #include <photon/thread/workerpool.h>
 #include <photon/photon.h>
@@ -13,13 +14,18 @@ static void *run(void *args) {
 /* Pooled queue kicker */
 class QueueKicker {
 public:
-    explicit QueueKicker(ocf_queue_t queue) : m_queue(queue) {
-    }
-    QueueKicker(ocf_queue_t queue, size_t vcpu_num, int ev_engine, int io_engine, int mode) : m_queue(queue) {
+    // run the queue in a work pool of its own
+    QueueKicker(ocf_queue_t queue, size_t vcpu_num, int ev_engine, int io_engine, int mode)
+        : m_queue(queue), m_own_pool(true) {
         work_pool = new photon::WorkPool(vcpu_num, ev_engine, io_engine, mode);
     }
+    // run the queue in a work pool owned by the caller
+    QueueKicker(ocf_queue_t queue, photon::WorkPool *pool) : m_queue(queue), work_pool(pool) {
+    }
     ~QueueKicker() {
-        delete work_pool;
+        if (m_own_pool) {
+            delete work_pool;
+        }
     }
 
     inline void kick() {
@@ -33,19 +39,33 @@ public:
 private:
     /* associated OCF queue */
     ocf_queue_t m_queue;
+    bool m_own_pool = false;
     /* thread pool */
     photon::WorkPool* work_pool = nullptr;
 };
 
-int init_queues(ocf_queue_t mngt_queue, ocf_queue_t io_queue) {
-    auto mngt_queue_kicker = new QueueKicker(mngt_queue, 2, 0, 0, 64);
-    auto io_queue_kicker = new QueueKicker(io_queue, 4, photon::INIT_EVENT_EPOLL, photon::INIT_IO_LIBCURL, 64);
-
+int init_mngt_queue(ocf_queue_t mngt_queue, int media_io_engine) {
+    bool iouring = media_io_engine == photon::fs::ioengine_iouring;
+    auto mngt_queue_kicker =
+        new QueueKicker(mngt_queue, 2, iouring ? photon::INIT_EVENT_IOURING : 0, 0, 64);
     ocf_queue_set_priv(mngt_queue, mngt_queue_kicker);
+    return 0;
+}
+
+int init_io_queue(ocf_queue_t io_queue, photon::WorkPool *pool) {
+    auto io_queue_kicker = new QueueKicker(io_queue, pool);
     ocf_queue_set_priv(io_queue, io_queue_kicker);
     return 0;
 }
 
+photon::WorkPool *new_io_queue_pool(int media_io_engine) {
+    if (media_io_engine == photon::fs::ioengine_iouring) {
+        return new photon::WorkPool(1, photon::INIT_EVENT_IOURING, photon::INIT_IO_LIBCURL, 64);
+    }
+    // psync media I/O blocks a vcpu, a second one keeps the queue running meanwhile
+    return new photon::WorkPool(2, photon::INIT_EVENT_EPOLL, photon::INIT_IO_LIBCURL, 64);
+}
+
 /* Callback for OCF to kick the queue thread */
 static void queue_thread_kick(ocf_queue_t q) {
     auto qk = (QueueKicker *)ocf_queue_get_priv(q);
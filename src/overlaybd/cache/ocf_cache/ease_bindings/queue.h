@@ -4,6 +4,19 @@ extern "C" {
 #include <ocf/ocf.h>
 }
 
-int init_queues(ocf_queue_t mngt_queue, ocf_queue_t io_queue);
+namespace photon {
+class WorkPool;
+}
+
+// media I/O is submitted from the vcpus of queues, so they run io_uring for a media file
+// opened with it
+int init_mngt_queue(ocf_queue_t mngt_queue, int media_io_engine = 0);
+
+// An I/O queue is run in `pool`, which must outlive the queue.
+int init_io_queue(ocf_queue_t io_queue, photon::WorkPool *pool);
+
+// The pool of an I/O queue, one io_uring vcpu if media I/O is io_uring, otherwise two vcpus, as
+// psync media I/O blocks them.
+photon::WorkPool *new_io_queue_pool(int media_io_engine);
 
 const ocf_queue_ops *get_queue_ops();
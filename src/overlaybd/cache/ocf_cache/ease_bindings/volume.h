@@ -13,6 +13,7 @@ struct ease_ocf_volume_params {
     size_t media_size;
     photon::fs::IFile *media_file;
     bool enable_logging;
+    int media_io_engine; // of media_file
 };
 
 int volume_init(ocf_ctx_t ocf_ctx);
@@ -1,4 +1,6 @@
 #include <sys/stat.h>
+#include <atomic>
+#include <vector>
 
 #include <photon/common/estring.h>
 #include <photon/common/io-alloc.h>
@@ -68,6 +70,47 @@ private:
 
 class OcfCachedFs;
 
+// Manages the space of OcfCachedFs: a blob evicted by `evict(filename)` has its cached data
+// invalidated, and its range of core address space reused by blobs opened later. OCF itself
+// replaces data when cache media is full, so there is no quota or space based eviction.
+class OcfCachePool : public FileSystem::ICachePool {
+public:
+    explicit OcfCachePool(OcfCachedFs *fs) : ICachePool(0), m_fs(fs) {
+    }
+
+    FileSystem::ICacheStore *do_open(std::string_view filename, int flags, mode_t mode) override {
+        LOG_ERROR_RETURN(ENOSYS, nullptr, "OCF: stores are not supported");
+    }
+
+    int set_quota(std::string_view pathname, size_t quota) override {
+        LOG_ERROR_RETURN(ENOSYS, -1, "OCF: quota is not supported");
+    }
+
+    int stat(FileSystem::CacheStat *stat, std::string_view pathname) override;
+
+    int evict(std::string_view filename) override;
+
+    int evict(size_t size) override {
+        LOG_ERROR_RETURN(ENOSYS, -1, "OCF: space is reclaimed by OCF itself");
+    }
+
+    int rename(std::string_view oldname, std::string_view newname) override {
+        LOG_ERROR_RETURN(ENOSYS, -1, "OCF: rename is not supported");
+    }
+
+    int reset(int flags) override {
+        if (flags != FileSystem::RST_STAT) {
+            LOG_ERROR_RETURN(ENOSYS, -1, "OCF: only RST_STAT is supported by reset");
+        }
+        m_evict_user = 0;
+        return 0;
+    }
+
+private:
+    OcfCachedFs *m_fs; // owned by external class
+    std::atomic<uint64_t> m_evict_user{0};
+};
+
 class OcfCachedFile : public VirtualFile {
 public:
     OcfCachedFile(OcfCachedFs *fs, OcfSrcFileCtx *ctx);
@@ -109,10 +152,11 @@ private:
     estring m_path_name;
 };
 
-class OcfCachedFs : public IFileSystem {
+class OcfCachedFs : public FileSystem::ICachedFileSystem {
 public:
     OcfCachedFs(IFileSystem *src_fs, size_t prefetch_unit, OcfNamespace *ocf_ns,
-                IFile *media_file, bool reload_media, IOAlloc *io_alloc);
+                IFile *media_file, bool reload_media, IOAlloc *io_alloc, int media_io_engine,
+                uint32_t io_queues);
 
     ~OcfCachedFs();
 
@@ -121,9 +165,43 @@ public:
     ssize_t ocf_pread(void *buf, size_t count, off_t offset, OcfSrcFileCtx *ctx);
 
     inline void pooled_release(OcfCachedFile *file) {
+        {
+            photon::scoped_lock lock(m_open_lock);
+            auto it = m_open_files.find(file->get_pathname());
+            if (it != m_open_files.end() && --it->second == 0) {
+                m_open_files.erase(it);
+            }
+        }
         m_src_file_pool.release(file->get_pathname());
     }
 
+    /**
+     * @brief Evict the file, or the files under the dir `path`, from cache and namespace.
+     * Files being opened are skipped, it fails with EBUSY if any.
+     * @param[out] evicted bytes of the evicted files' ranges
+     */
+    int evict(const estring &path, uint64_t &evicted);
+
+    void get_ns_stat(OcfNamespace::NsStat &stat) {
+        m_ocf_ns->get_stat(stat);
+    }
+
+    int find_files(const estring &path, std::vector<OcfNamespace::NsFile> &files) {
+        return m_ocf_ns->find_files(path, files);
+    }
+
+    size_t media_size() const {
+        return m_volume_params->media_size;
+    }
+
+    size_t block_size() const {
+        return m_ocf_ns->block_size();
+    }
+
+    FileSystem::ICachePool *get_pool() override {
+        return &m_pool;
+    }
+
     inline IOAlloc *get_io_alloc() const {
         return m_io_alloc;
     }
@@ -150,7 +228,10 @@ public:
     UNIMPLEMENTED(int access(const char *pathname, int mode) override);
     UNIMPLEMENTED(int truncate(const char *path, off_t length) override);
     UNIMPLEMENTED(int syncfs() override);
-    UNIMPLEMENTED(int unlink(const char *filename) override);
+    int unlink(const char *filename) override {
+        uint64_t evicted = 0;
+        return evict(filename, evicted);
+    }
     UNIMPLEMENTED(int lchown(const char *pathname, uid_t owner, gid_t group) override);
     UNIMPLEMENTED_POINTER(DIR *opendir(const char *) override);
     UNIMPLEMENTED(int utime(const char *path, const struct utimbuf *file_times) override);
@@ -165,8 +246,16 @@ private:
     IFile *m_media_file; // owned by external class
     bool m_reload_media;
     IOAlloc *m_io_alloc; // owned by external class
+    int m_media_io_engine;
+    uint32_t m_io_queues;
 
     ObjectCache<std::string, OcfSrcFileCtx *> m_src_file_pool;
+    // blocks of a file in namespace are only removed when no one opens it,
+    // eviction takes the write lock, open takes the read lock
+    photon::rwlock m_ns_lock;
+    map_string_key<uint32_t> m_open_files;
+    photon::mutex m_open_lock;
+    OcfCachePool m_pool;
 
     ease_ocf_volume_params *m_volume_params = nullptr; // owned by self
     ease_ocf_provider *m_provider = nullptr;           // owned by self
@@ -202,9 +291,11 @@ int OcfCachedFile::fadvise(off_t offset, off_t len, int advice) {
 
 OcfCachedFs::OcfCachedFs(IFileSystem *src_fs, size_t prefetch_unit,
                          OcfNamespace *ocf_ns, IFile *media_file, bool reload_media,
-                         IOAlloc *io_alloc)
+                         IOAlloc *io_alloc, int media_io_engine, uint32_t io_queues)
     : m_src_fs(src_fs), m_prefetch_unit(prefetch_unit), m_ocf_ns(ocf_ns), m_media_file(media_file),
-      m_reload_media(reload_media), m_io_alloc(io_alloc), m_src_file_pool(1 * 1000 * 1000) {
+      m_reload_media(reload_media), m_io_alloc(io_alloc), m_media_io_engine(media_io_engine),
+      m_io_queues(io_queues),
+      m_src_file_pool(1 * 1000 * 1000), m_pool(this) {
 }
 
 OcfCachedFs::~OcfCachedFs() {
@@ -226,8 +317,9 @@ int OcfCachedFs::init() {
     }
     size_t media_size = buf.st_size;
     m_volume_params =
-        new ease_ocf_volume_params{m_ocf_ns->block_size(), media_size, m_media_file, false};
-    m_provider = new ease_ocf_provider(m_volume_params, m_prefetch_unit);
+        new ease_ocf_volume_params{m_ocf_ns->block_size(), media_size, m_media_file, false,
+                                   m_media_io_engine};
+    m_provider = new ease_ocf_provider(m_volume_params, m_prefetch_unit, m_io_queues);
 
     return m_provider->start(m_reload_media);
 }
@@ -259,10 +351,15 @@ IFile *OcfCachedFs::open(const char *pathname, int flags, mode_t mode) {
         return new OcfSrcFileCtx(src_file, info, m_provider, path_str);
     };
 
+    photon::scoped_rwlock rl(m_ns_lock, photon::RLOCK);
     auto src_file_ctx = m_src_file_pool.acquire(path_str, ctor);
     if (src_file_ctx == nullptr) {
         LOG_ERROR_RETURN(0, nullptr, "OCF: failed to open ` from pool", path_str);
     }
+    {
+        photon::scoped_lock lock(m_open_lock);
+        m_open_files.emplace(path_str, 0).first->second++;
+    }
 
     auto cached_file = new OcfCachedFile(this, src_file_ctx);
     cached_file->set_pathname(path_str);
@@ -270,13 +367,88 @@ IFile *OcfCachedFs::open(const char *pathname, int flags, mode_t mode) {
     return new OcfTruncateFile(cached_file, src_file_ctx->ns_info.file_size);
 }
 
+int OcfCachedFs::evict(const estring &path, uint64_t &evicted) {
+    std::vector<OcfNamespace::NsFile> files;
+    if (m_ocf_ns->find_files(path, files) != 0) {
+        LOG_ERRNO_RETURN(0, -1, "OCF: failed to find ` in namespace", path);
+    }
+
+    photon::scoped_rwlock wl(m_ns_lock, photon::WLOCK);
+    bool busy = false;
+    for (auto &file : files) {
+        {
+            photon::scoped_lock lock(m_open_lock);
+            if (m_open_files.find(file.path) != m_open_files.end()) {
+                busy = true;
+                continue;
+            }
+        }
+        // drop the context kept by pool after the file is closed, it has the location
+        auto ctx = m_src_file_pool.acquire(file.path, [] { return (OcfSrcFileCtx *)nullptr; });
+        if (ctx != nullptr) {
+            m_src_file_pool.release(file.path, true);
+        }
+
+        // invalidate data in cache before the range is reused
+        size_t blk_size = m_volume_params->blk_size;
+        size_t count = ROUND_UP(file.info.file_size, blk_size);
+        if (count > 0 && m_provider->ocf_discard(file.info.blk_idx * blk_size, count) != 0) {
+            LOG_ERRNO_RETURN(0, -1, "OCF: failed to discard `", file.path);
+        }
+        OcfNamespace::NsInfo info;
+        if (m_ocf_ns->remove_file(file.path, info) != 0) {
+            LOG_ERRNO_RETURN(0, -1, "OCF: failed to remove ` from namespace", file.path);
+        }
+        evicted += count;
+    }
+    if (busy) {
+        LOG_ERROR_RETURN(EBUSY, -1, "OCF: some files under ` are opened, not evicted", path);
+    }
+    return 0;
+}
+
+int OcfCachePool::stat(FileSystem::CacheStat *stat, std::string_view pathname) {
+    auto blk_size = m_fs->block_size();
+    stat->refill_unit = blk_size;
+    stat->total_size = m_fs->media_size() / blk_size;
+    if (pathname.empty() || pathname == "/") {
+        OcfNamespace::NsStat ns_stat;
+        m_fs->get_ns_stat(ns_stat);
+        stat->used_size =
+            std::min<uint64_t>(ns_stat.total_blocks - ns_stat.free_blocks, stat->total_size);
+        stat->evict_user = m_evict_user;
+        stat->evict_global = stat->evict_other = 0;
+        return 0;
+    }
+
+    std::vector<OcfNamespace::NsFile> files;
+    if (m_fs->find_files(estring(pathname), files) != 0) {
+        return -1;
+    }
+    uint64_t used = 0;
+    for (auto &file : files) {
+        used += (file.info.file_size + blk_size - 1) / blk_size;
+    }
+    stat->used_size = std::min<uint64_t>(used, UINT32_MAX);
+    stat->evict_user = stat->evict_global = stat->evict_other = 0;
+    return 0;
+}
+
+int OcfCachePool::evict(std::string_view filename) {
+    uint64_t evicted = 0;
+    int ret = m_fs->evict(estring(filename), evicted);
+    m_evict_user += evicted;
+    return ret;
+}
+
 } /* namespace Cache */
 
 namespace FileSystem {
 
-IFileSystem *new_ocf_cached_fs(IFileSystem *src_fs, IFileSystem *namespace_fs, size_t blk_size,
-                               size_t prefetch_unit, IFile *media_file, bool reload_media,
-                               IOAlloc *io_alloc) {
+ICachedFileSystem *new_ocf_cached_fs(IFileSystem *src_fs, IFileSystem *namespace_fs,
+                                     size_t blk_size, size_t prefetch_unit, IFile *media_file,
+                                     bool reload_media, IOAlloc *io_alloc, int media_io_engine,
+                                     uint32_t io_queues) {
     auto ocf_ns = new_ocf_namespace_on_fs(blk_size, namespace_fs);
     if (ocf_ns->init() != 0) {
         delete ocf_ns;
@@ -284,7 +456,8 @@ IFileSystem *new_ocf_cached_fs(IFileSystem *src_fs, IFileSystem *namespace_fs, s
     }
 
     auto fs =
-        new Cache::OcfCachedFs(src_fs, prefetch_unit, ocf_ns, media_file, reload_media, io_alloc);
+        new Cache::OcfCachedFs(src_fs, prefetch_unit, ocf_ns, media_file, reload_media, io_alloc,
+                               media_io_engine, io_queues);
     if (fs->init() != 0) {
         delete fs;
         LOG_ERROR_RETURN(0, nullptr, "OCF: init cache fs failed");
@@ -2,6 +2,8 @@
 
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <algorithm>
+#include <map>
 
 #include <photon/common/enumerable.h>
 #include <photon/fs/localfs.h>
@@ -35,23 +37,31 @@ public:
             LOG_ERROR_RETURN(0, -1, "OCF: invalid cache line size");
         }
 
-        off_t max_blk_idx = 0;
-        off_t last_num_blocks = 0;
-
+        // blk_idx -> num_blocks of files
+        std::map<off_t, size_t> used;
         for (auto file_path : enumerable(photon::fs::Walker(m_fs, ""))) {
             NsInfo info;
             if (get_ns_info(file_path, info) != 0) {
                 return -1;
             }
-
-            if (max_blk_idx < info.blk_idx) {
-                max_blk_idx = info.blk_idx;
-                last_num_blocks = DIV_ROUND_UP(info.file_size, m_blk_size);
+            size_t num_blocks = DIV_ROUND_UP(info.file_size, m_blk_size);
+            if (num_blocks > 0) {
+                used[info.blk_idx] = std::max(used[info.blk_idx], num_blocks);
             }
         }
 
-        m_total_blocks = max_blk_idx + last_num_blocks;
-        LOG_DEBUG("OCF: set total_blocks to `", m_total_blocks);
+        // gaps between files are left by removed ones
+        size_t end = 0;
+        for (auto &it : used) {
+            if ((size_t)it.first > end) {
+                m_free_blocks[end] = it.first - end;
+                m_num_free_blocks += it.first - end;
+            }
+            end = std::max(end, it.first + it.second);
+        }
+        m_total_blocks = end;
+        LOG_DEBUG("OCF: set total_blocks to `, free blocks `", m_total_blocks,
+                  m_num_free_blocks);
         return 0;
     }
 
@@ -72,6 +82,56 @@ public:
         return 0;
     }
 
+    int remove_file(const estring &file_path, NsInfo &info) override {
+        if (get_ns_info(file_path, info) != 0) {
+            LOG_ERROR_RETURN(0, -1, "OCF: get ns info failed, path `", file_path);
+        }
+        if (m_fs->unlink(file_path.c_str()) != 0) {
+            LOG_ERRNO_RETURN(0, -1, "OCF: failed to unlink ns file `", file_path);
+        }
+        size_t num_blocks = DIV_ROUND_UP(info.file_size, m_blk_size);
+        if (num_blocks > 0) {
+            photon::scoped_lock lock(m_mutex);
+            free_blocks(info.blk_idx, num_blocks);
+        }
+        LOG_INFO("OCF: remove namespace, file `, blk_idx `, size `", file_path, info.blk_idx,
+                 info.file_size);
+        return 0;
+    }
+
+    int find_files(const estring &path, std::vector<NsFile> &files) override {
+        struct stat st {};
+        if (m_fs->stat(path.c_str(), &st) != 0) {
+            LOG_ERRNO_RETURN(0, -1, "OCF: failed to stat `", path);
+        }
+        NsFile file;
+        if (!S_ISDIR(st.st_mode)) {
+            file.path = path;
+            if (get_ns_info(path, file.info) != 0) {
+                return -1;
+            }
+            files.push_back(file);
+            return 0;
+        }
+        for (auto file_path : enumerable(photon::fs::Walker(m_fs, path))) {
+            if (estring_view(file_path).ends_with(".tmp")) {
+                continue;
+            }
+            file.path = estring(file_path);
+            if (get_ns_info(file.path, file.info) != 0) {
+                return -1;
+            }
+            files.push_back(file);
+        }
+        return 0;
+    }
+
+    void get_stat(NsStat &stat) override {
+        photon::scoped_lock lock(m_mutex);
+        stat.total_blocks = m_total_blocks;
+        stat.free_blocks = m_num_free_blocks;
+    }
+
 private:
     struct NsFileFormat {
         uint32_t magic;
@@ -118,17 +178,29 @@ private:
         // Lock in case of concurrent append
         photon::scoped_lock lock(m_mutex);
 
-        // Persist ns_info into ns_fs
-        info.blk_idx = (off_t)m_total_blocks;
+        // Persist ns_info into ns_fs, reuse the blocks of removed files if possible
+        size_t num_blocks = DIV_ROUND_UP(file_size, m_blk_size);
+        auto it = m_free_blocks.begin();
+        while (it != m_free_blocks.end() && (num_blocks == 0 || it->second < num_blocks)) {
+            ++it;
+        }
+        info.blk_idx = it != m_free_blocks.end() ? it->first : (off_t)m_total_blocks;
         info.file_size = file_size;
 
         if (write_ns_info(file_path, info) != 0) {
             LOG_ERROR_RETURN(0, -1, "OCF: failed to write namespace file");
         }
 
-        // Update total_blocks at last
-        size_t num_blocks = DIV_ROUND_UP(file_size, m_blk_size);
-        m_total_blocks += num_blocks;
+        // Update free blocks or total_blocks at last
+        if (it != m_free_blocks.end()) {
+            if (it->second > num_blocks) {
+                m_free_blocks[it->first + num_blocks] = it->second - num_blocks;
+            }
+            m_free_blocks.erase(it);
+            m_num_free_blocks -= num_blocks;
+        } else {
+            m_total_blocks += num_blocks;
+        }
 
         LOG_DEBUG("OCF: append namespace, file `, blk_idx `, size `", file_path, info.blk_idx,
                   info.file_size);
@@ -167,8 +239,36 @@ private:
         return 0;
     }
 
+    // called with m_mutex held
+    void free_blocks(off_t blk_idx, size_t num_blocks) {
+        m_num_free_blocks += num_blocks;
+        auto next = m_free_blocks.lower_bound(blk_idx);
+        if (next != m_free_blocks.end() && (size_t)blk_idx + num_blocks == (size_t)next->first) {
+            num_blocks += next->second;
+            next = m_free_blocks.erase(next);
+        }
+        if (next != m_free_blocks.begin()) {
+            auto prev = std::prev(next);
+            if ((size_t)prev->first + prev->second == (size_t)blk_idx) {
+                blk_idx = prev->first;
+                num_blocks += prev->second;
+                m_free_blocks.erase(prev);
+            }
+        }
+        if ((size_t)blk_idx + num_blocks >= m_total_blocks) {
+            // free blocks at the end are given back to appending
+            m_num_free_blocks -= num_blocks;
+            m_total_blocks = blk_idx;
+        } else {
+            m_free_blocks[blk_idx] = num_blocks;
+        }
+    }
+
     const uint32_t NS_FILE_MAGIC = UINT32_MAX - 1;
     size_t m_total_blocks = 0;
+    // blk_idx -> num_blocks, of the ranges left by removed files
+    std::map<off_t, size_t> m_free_blocks;
+    size_t m_num_free_blocks = 0;
     photon::fs::IFileSystem *m_fs; // owned by external class
     photon::mutex m_mutex;
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <unistd.h>
+#include <vector>
 
 #include <photon/common/object.h>
 #include <photon/common/estring.h>
@@ -34,6 +35,34 @@ public:
     virtual int locate_file(const estring &file_path, photon::fs::IFile *src_file,
                             NsInfo &info) = 0;
 
+    /**
+     * @brief Remove a file from namespace. Its blocks are reused by files located later, so
+     * the caller should invalidate them in cache first.
+     * @param[in] file_path
+     * @param[out] info the removed file's location
+     * @retval 0 for success
+     */
+    virtual int remove_file(const estring &file_path, NsInfo &info) = 0;
+
+    struct NsFile {
+        estring path;
+        NsInfo info;
+    };
+
+    /**
+     * @brief Find the file itself, or the files under the dir `path`
+     * @retval 0 for success, -1 with ENOENT if `path` is not found
+     */
+    virtual int find_files(const estring &path, std::vector<NsFile> &files) = 0;
+
+    /** Blocks of the address space, and those not used by any file */
+    struct NsStat {
+        size_t total_blocks;
+        size_t free_blocks;
+    };
+
+    virtual void get_stat(NsStat &stat) = 0;
+
     size_t block_size() const {
         return m_blk_size;
     }
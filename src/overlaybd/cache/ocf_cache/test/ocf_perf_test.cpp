@@ -1,6 +1,8 @@
 #include <fcntl.h>
 #include <unistd.h>
+#include <atomic>
 #include <ctime>
+#include <thread>
 #include <vector>
 
 #include <gflags/gflags.h>
@@ -14,6 +16,7 @@
 #include <photon/net/curl.h>
 #include "../../../zfile/crc32/crc32c.h"
 #include "../../cache.h"
+#include "../../../../image_service.h"
 
 // Common params
 DEFINE_bool(ut_pass, false, "pass unit test directly. This suite is only for manual test");
@@ -25,6 +28,8 @@ DEFINE_uint64(media_file_size_gb, 1, "media file size in gb");
 DEFINE_int64(io_engine, 0, "0: psync, 1: libaio, 3: iouring");
 DEFINE_uint64(concurrency, 16, "read concurrency");
 DEFINE_uint64(ocf_prefetch_unit, 0, "prefetch unit in bytes");
+DEFINE_uint64(threads, 1, "num of OS threads (vcpus) doing reads, for the IOPS scaling of ocf cache");
+DEFINE_uint64(io_queues, 0, "num of ocf io queues, 0 means the default");
 
 // Single file test params
 DEFINE_bool(random_read, true, "random read or sequential read");
@@ -39,9 +44,10 @@ DEFINE_uint64(num_files, 100, "num of files");
 DEFINE_uint64(file_size_mb, 10, "file size in mb");
 
 // Global variables
-int qps, last_qps = 0;
-uint64_t total_req = 0;
-bool stop_test = false;
+std::atomic<int> qps{0};
+int last_qps = 0;
+std::atomic<uint64_t> total_req{0};
+std::atomic<bool> stop_test{false};
 
 static void handle_signal(int) {
     LOG_INFO("try to stop test");
@@ -49,9 +55,10 @@ static void handle_signal(int) {
 }
 
 static void handle_qps() {
-    if (qps - last_qps > 3000 || last_qps - qps > 3000) {
+    int cur = qps;
+    if (cur - last_qps > 3000 || last_qps - cur > 3000) {
         // avoid CPU 100% and no log
-        last_qps = qps;
+        last_qps = cur;
         photon::thread_yield();
     }
     ++qps;
@@ -63,8 +70,7 @@ static void handle_qps() {
 static void show_qps_loop() {
     while (!stop_test) {
         photon::thread_sleep(1);
-        LOG_INFO("qps: `", qps);
-        qps = 0;
+        LOG_INFO("qps: `", qps.exchange(0));
     }
 }
 
@@ -170,6 +176,26 @@ static int work(T *cache_file, IOAlloc *io_alloc) {
     return 0;
 }
 
+// run work() on `FLAGS_threads` vcpus, each of them in an OS thread, to see how IOPS scales
+template <typename T>
+static int work_threads(T *cache_file, IOAlloc *io_alloc) {
+    std::vector<std::thread> threads;
+    for (uint64_t i = 1; i < FLAGS_threads; i++) {
+        threads.emplace_back([&] {
+            // media I/O of ocf io queues may run on the vcpus doing reads
+            photon::init(event_engine_for(FLAGS_io_engine, photon::INIT_EVENT_DEFAULT),
+                         photon::INIT_IO_NONE);
+            DEFER(photon::fini());
+            work(cache_file, io_alloc);
+        });
+    }
+    int ret = work(cache_file, io_alloc);
+    for (auto &th : threads) {
+        th.join();
+    }
+    return ret;
+}
+
 static int single_file_ocf_cache(IOAlloc *io_alloc, photon::fs::IFileSystem *src_fs,
                                  const std::string &root_dir) {
     LOG_INFO("Start single file ocf cache test");
@@ -197,9 +223,9 @@ static int single_file_ocf_cache(IOAlloc *io_alloc, photon::fs::IFileSystem *src
     }
     DEFER(delete media_file);
 
-    auto ocf_cached_fs =
-        FileSystem::new_ocf_cached_fs(src_fs, namespace_fs, FLAGS_page_size,
-                                      FLAGS_ocf_prefetch_unit, media_file, reload_media, io_alloc);
+    auto ocf_cached_fs = FileSystem::new_ocf_cached_fs(
+        src_fs, namespace_fs, FLAGS_page_size, FLAGS_ocf_prefetch_unit, media_file, reload_media,
+        io_alloc, FLAGS_io_engine, FLAGS_io_queues);
     if (ocf_cached_fs == nullptr) {
         LOG_ERROR_RETURN(0, -1, "new_ocf_cached_fs error");
     }
@@ -211,7 +237,7 @@ static int single_file_ocf_cache(IOAlloc *io_alloc, photon::fs::IFileSystem *src
     }
     DEFER(delete file);
 
-    work(file, io_alloc);
+    work_threads(file, io_alloc);
     return 0;
 }
 
@@ -246,7 +272,7 @@ static int single_file_file_cache(IOAlloc *io_alloc, photon::fs::IFileSystem *sr
 }
 
 static int single_file_test(IOAlloc *io_alloc) {
-    if (!FLAGS_dst_file.empty() && FLAGS_concurrency != 1) {
+    if (!FLAGS_dst_file.empty() && (FLAGS_concurrency != 1 || FLAGS_threads != 1)) {
         LOG_ERROR_RETURN(0, -1, "Doesn't make sense to do concurrent writes on the same file")
     }
 
@@ -491,7 +517,8 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-photon::init(photon::INIT_EVENT_DEFAULT, photon::INIT_IO_DEFAULT);
+    photon::init(event_engine_for(FLAGS_io_engine, photon::INIT_EVENT_DEFAULT),
+                 photon::INIT_IO_DEFAULT);
 
 
     auto pooled_allocator = new PooledAllocator<2 * 1024 * 1024, 1024, 4096>;
@@ -57,6 +57,23 @@ public:
         m_size++;
         return m_head = i;
     }
+    // Insert a value as the least recently used one, so that it's the first to be evicted.
+    key_type push_back(value_type v) {
+        assert(m_size < LIMIT);
+        auto i = do_alloc();
+        PTR(i)->val = v;
+        auto dummy = PTR(m_head)->prev;
+        do_insert(PTR(dummy)->prev, dummy, i);
+        m_size++;
+        if (m_head == dummy) {
+            m_head = i;
+        }
+        return i;
+    }
+    value_type &get(key_type i) {
+        assert(i < m_array.size());
+        return PTR(i)->val;
+    }
     void access(key_type i) {
         assert(i < m_array.size());
         if (m_size == 1 || i == m_head)
@@ -96,6 +113,14 @@ public:
     size_t size() {
         return m_size;
     }
+    // visit values from the back (least recently used) to the front
+    template <typename Visitor>
+    void for_each_from_back(Visitor visit) {
+        auto dummy = PTR(m_head)->prev;
+        for (auto i = PTR(dummy)->prev; i != dummy; i = PTR(i)->prev) {
+            visit(PTR(i)->val);
+        }
+    }
     bool empty() {
         return m_head == PTR(m_head)->prev;
     }
@@ -0,0 +1,117 @@
+/*
+   Copyright The Overlaybd Authors
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+#include "lru.h"
+
+namespace FileSystem {
+// A segmented LRU container, as the 2Q policy. New values enter the probation segment,
+// and are promoted to the protected segment when accessed again, so that a scan of data
+// read only once can only flush the probation segment. The protected segment is limited
+// to `protected_percent` of all values, its least recently used values are demoted back
+// to the front of probation. Values are evicted from the back of probation first.
+// protected_percent == 0 disables segmentation, then it's a plain LRU.
+//
+// Keys of the probation segment have the highest bit set, so only LIMIT entries of each
+// segment are allowed.
+template <typename ValueType, typename KeyType = uint16_t>
+class SegmentedLRU {
+public:
+    using value_type = ValueType;
+    using key_type = KeyType;
+    using lru_type = LRU<ValueType, KeyType>;
+
+    const static key_type kProbation = (key_type)1 << (sizeof(key_type) * 8 - 1);
+    const static size_t LIMIT = kProbation - 1;
+
+    explicit SegmentedLRU(uint32_t protected_percent = 0)
+        : m_protected_percent(protected_percent) {
+    }
+
+    // MUST be set while empty
+    void set_protected_percent(uint32_t protected_percent) {
+        assert(empty());
+        m_protected_percent = protected_percent;
+    }
+    bool segmented() const {
+        return m_protected_percent > 0 && m_protected_percent < 100;
+    }
+
+    key_type push_front(value_type v) {
+        if (!segmented())
+            return m_protected.push_front(v);
+        return m_probation.push_front(v) | kProbation;
+    }
+    // insert as the least recently used, e.g. data of a bulk scan
+    key_type push_back(value_type v) {
+        if (!segmented())
+            return m_protected.push_back(v);
+        return m_probation.push_back(v) | kProbation;
+    }
+    // Accessing a value in probation moves it to the protected segment, which may in turn
+    // demote others. `rekey(value_type &, key_type)` is called for every value whose key
+    // has been changed.
+    template <typename Rekey>
+    void access(key_type i, Rekey rekey) {
+        if (!(i & kProbation)) {
+            m_protected.access(i);
+            return;
+        }
+        auto v = m_probation.get(i & ~kProbation);
+        m_probation.remove(i & ~kProbation);
+        rekey(v, m_protected.push_front(v));
+        while (m_protected.size() > 1 &&
+               m_protected.size() * 100 > m_protected_percent * size()) {
+            if (m_protected.empty())
+                break; // the rest are cleared
+            auto d = m_protected.back();
+            m_protected.pop_back();
+            rekey(d, m_probation.push_front(d) | kProbation);
+        }
+    }
+    void mark_key_cleared(key_type i) {
+        segment(i).mark_key_cleared(i & ~kProbation);
+    }
+    void remove(key_type i) {
+        segment(i).remove(i & ~kProbation);
+    }
+    value_type &get(key_type i) {
+        return segment(i).get(i & ~kProbation);
+    }
+    value_type &back() {
+        return m_probation.empty() ? m_protected.back() : m_probation.back();
+    }
+    size_t size() {
+        return m_probation.size() + m_protected.size();
+    }
+    bool empty() {
+        return m_probation.empty() && m_protected.empty();
+    }
+    // visit values in the order of eviction
+    template <typename Visitor>
+    void for_each_from_back(Visitor visit) {
+        m_probation.for_each_from_back(visit);
+        m_protected.for_each_from_back(visit);
+    }
+
+protected:
+    lru_type m_probation, m_protected;
+    uint32_t m_protected_percent;
+
+    lru_type &segment(key_type i) {
+        return (i & kProbation) ? m_probation : m_protected;
+    }
+};
+} // namespace FileSystem
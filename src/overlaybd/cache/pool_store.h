@@ -38,6 +38,7 @@ enum ResetType : int {
     RST_ALL = 0x0,    // reset all cache's data, include file meta
     RST_MEMORY = 0x1, // reset memory cache's data
     RST_DISK = 0x2,   // reset disk cache's data
+    RST_STAT = 0x4,   // reset eviction counters reported by stat()
     RST_UPPER = 0x10, // reset upper layer cache's data
     RST_LOWER = 0x20, // reset lower layer cache's data
 };
@@ -50,6 +51,12 @@ enum ResizeType : int {
     RSZ_LOWER = 0x20, // resize lower layer cache's capacity
 };
 
+// replacement policy of cache pools
+enum PolicyType : int {
+    POLICY_LRU = 0, // least recently used
+    POLICY_2Q = 1,  // data hit only once can't displace data hit more than once
+};
+
 namespace FileSystem {
 // `CacheFnTransFunc` use to transform the filename in the cached store.
 // `std::string_view` is the filename before transformation (as src_name).
@@ -60,14 +67,15 @@ namespace FileSystem {
 // otherwise, it returns string length after transformation.
 using CacheFnTransFunc = Delegate<size_t, std::string_view, char *, size_t>;
 class ICacheStore;
+class RefillScheduler;
 struct CacheStat {
     uint32_t struct_size = sizeof(CacheStat);
     uint32_t refill_unit;  // in bytes
     uint32_t total_size;   // in refill_unit
     uint32_t used_size;    // in refill_unit
-    uint64_t evict_other;  // in bytes, initialized to -1UL means reset
-    uint64_t evict_global; // in bytes, initialized to -1UL means reset
-    uint64_t evict_user;   // in bytes, initialized to -1UL means reset
+    uint64_t evict_other;  // in bytes, since the last reset(RST_STAT)
+    uint64_t evict_global; // in bytes, since the last reset(RST_STAT)
+    uint64_t evict_user;   // in bytes, since the last reset(RST_STAT)
 };
 
 class ICachePool : public Object {
@@ -89,6 +97,9 @@ public:
     // force to evict specified files(s)
     virtual int evict(std::string_view filename) = 0;
 
+    // evict the store of `filename`, named as by open(), fails with EBUSY if it's opened
+    int evict_file(std::string_view filename);
+
     // try to evict at least `size` bytes, and also make sure
     // available space meet other requirements as well
     virtual int evict(size_t size = 0) = 0;
@@ -123,8 +134,31 @@ public:
         return -1;
     }
 
+    // merges concurrent refills of the same store into fewer source reads
+    RefillScheduler *get_refill_scheduler() {
+        return m_refill_scheduler;
+    }
+
+    // The refill size of each store adapts to its misses within [min, max], it's doubled
+    // on sequential misses and halved on random ones. Both need to be power of 2, and
+    // max == 0 disables it, so refills are sized by the store only.
+    int set_refill_bounds(size_t min, size_t max);
+
+    struct RefillStat {
+        uint64_t refills;  // refills of misses
+        uint64_t bytes;    // sum of the refill sizes
+        uint64_t max_size; // the largest refill size since the last call
+    };
+    void get_refill_stat(RefillStat *stat);
+
 protected:
     void *m_stores;
+    RefillScheduler *m_refill_scheduler;
+    size_t m_min_refill = 0;
+    size_t m_max_refill = 0;
+    std::atomic<uint64_t> m_refills{0};
+    std::atomic<uint64_t> m_refill_bytes{0};
+    std::atomic<uint64_t> m_refill_max{0};
     CacheFnTransFunc fn_trans_func;
     void *m_thread_pool = nullptr;
     void *m_vcpu = nullptr; // vcpu where m_therad_pool is created
@@ -250,6 +284,9 @@ private:
     ssize_t pwritev2_extend(const struct iovec *iov, int iovcnt, off_t offset, int flags);
     ssize_t do_refill_range(uint64_t refill_off, uint64_t refill_size, size_t count,
                             IOVector *input = nullptr, off_t offset = 0, int flags = 0);
+    // resize the refill range of a miss of [offset, offset + count) by the access pattern
+    std::pair<off_t, size_t> adapt_refill(off_t offset, size_t count, off_t refill_off,
+                                          size_t refill_size);
     int tryget_size();
     static void *async_refill(void *args);
 
@@ -267,6 +304,8 @@ protected:
     IOAlloc *allocator_ = nullptr;
     RangeLock range_lock_;
     photon::mutex open_lock_;
+    size_t refill_size_ = 0; // adapted refill size, 0 before the first miss
+    off_t last_refill_end_ = -1;
     friend class ICachePool;
 };
 
@@ -0,0 +1,299 @@
+/*
+   Copyright The Overlaybd Authors
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "pooled_alloc.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <photon/common/alog.h>
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+namespace FileSystem {
+
+const size_t PooledIOAlloc::kMinSize;
+const size_t PooledIOAlloc::kChunkSize;
+const int PooledIOAlloc::kClasses;
+const int PooledIOAlloc::kMaxThreads;
+
+// free lists of a thread keep up to kCacheBytes of a size, and give back kBatchBytes of them
+// to their nodes at a time
+static const size_t kBatchBytes = 4UL << 20;
+static const size_t kCacheBytes = 16UL << 20;
+static const int kMaxNodes = 64;
+
+// pools alive, and thread slots not taken
+static std::mutex g_pools_lock;
+static std::vector<PooledIOAlloc *> g_pools;
+static std::vector<int> g_free_threads;
+static int g_next_thread = 0;
+static thread_local int t_node = -1;
+
+static int online_nodes() {
+    // e.g. "0", "0-1" or "0,2-3"
+    std::ifstream f("/sys/devices/system/node/online");
+    std::string s;
+    if (!(f >> s)) {
+        return 1;
+    }
+    auto pos = s.find_last_of("-,");
+    int last = atoi(s.c_str() + (pos == std::string::npos ? 0 : pos + 1));
+    return std::max(1, std::min(last + 1, kMaxNodes));
+}
+
+static int size_class(size_t size) {
+    if (size > (PooledIOAlloc::kMinSize << (PooledIOAlloc::kClasses - 1))) {
+        return -1;
+    }
+    int cls = 0;
+    while ((PooledIOAlloc::kMinSize << cls) < size) {
+        cls++;
+    }
+    return cls;
+}
+
+PooledIOAlloc::PooledIOAlloc()
+    : IOAlloc({this, &PooledIOAlloc::do_alloc}, {this, &PooledIOAlloc::do_dealloc}) {
+}
+
+PooledIOAlloc::~PooledIOAlloc() {
+    if (m_threads) {
+        std::lock_guard<std::mutex> lock(g_pools_lock);
+        g_pools.erase(std::find(g_pools.begin(), g_pools.end(), this));
+    }
+    delete[] m_threads;
+    if (m_base) {
+        munmap(m_base, m_map_size);
+    }
+}
+
+int PooledIOAlloc::init(size_t capacity) {
+    m_nnodes = online_nodes();
+    size_t chunks = std::max((capacity / m_nnodes + kChunkSize - 1) / kChunkSize, (size_t)1);
+    m_node_size = chunks * kChunkSize;
+    size_t size = m_node_size * m_nnodes;
+
+    // hugetlbfs pages are taken at mmap(), so it fails if not enough of them are reserved
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        m_hugetlb = true;
+    } else {
+        // transparent huge pages are disabled for the process, see main()
+        LOG_INFO("hugetlb pages not reserved enough, io buffers are on normal pages");
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED) {
+            LOG_ERRNO_RETURN(0, -1, "failed to reserve ` bytes for io buffers", size);
+        }
+    }
+    m_base = (char *)p;
+    m_map_size = size;
+    if (m_nnodes > 1) {
+        // pages are allocated from the node when touched, and from others when it's short
+        for (int i = 0; i < m_nnodes; i++) {
+            unsigned long mask[kMaxNodes / 64] = {};
+            mask[i / 64] = 1UL << (i % 64);
+            if (syscall(SYS_mbind, m_base + m_node_size * i, m_node_size, MPOL_PREFERRED, mask,
+                        kMaxNodes + 1, 0) != 0) {
+                LOG_WARN("failed to bind io buffers to NUMA node `, ", i, ERRNO());
+                break;
+            }
+        }
+    }
+
+    m_nodes.reset(new Node[m_nnodes]);
+    for (int i = 0; i < m_nnodes; i++) {
+        m_nodes[i].next = m_base + m_node_size * i;
+        m_nodes[i].end = m_nodes[i].next + m_node_size;
+    }
+    m_chunk_class.assign(size / kChunkSize, 0);
+    m_threads = new ThreadLists[kMaxThreads];
+    {
+        std::lock_guard<std::mutex> lock(g_pools_lock);
+        g_pools.push_back(this);
+    }
+    LOG_INFO("io buffers reserved: ` MB, hugetlb: `, NUMA nodes: `", size >> 20, m_hugetlb,
+             m_nnodes);
+    return 0;
+}
+
+size_t PooledIOAlloc::batch_count(int cls) {
+    return std::max(kBatchBytes / (kMinSize << cls), (size_t)1);
+}
+
+PooledIOAlloc::ThreadLists *PooledIOAlloc::thread_lists() {
+    static thread_local ThreadSlot slot;
+    if (slot.index == -1) {
+        std::lock_guard<std::mutex> lock(g_pools_lock);
+        if (!g_free_threads.empty()) {
+            slot.index = g_free_threads.back();
+            g_free_threads.pop_back();
+        } else {
+            slot.index = g_next_thread < kMaxThreads ? g_next_thread++ : -2;
+        }
+    }
+    return slot.index >= 0 ? &m_threads[slot.index] : nullptr;
+}
+
+PooledIOAlloc::ThreadSlot::~ThreadSlot() {
+    if (index < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(g_pools_lock);
+    for (auto pool : g_pools) {
+        pool->flush_thread(index);
+    }
+    g_free_threads.push_back(index);
+}
+
+void PooledIOAlloc::flush_thread(int index) {
+    for (int cls = 0; cls < kClasses; cls++) {
+        auto &free = m_threads[index].free[cls];
+        give(cls, free.data(), free.size());
+        std::vector<void *>().swap(free);
+    }
+}
+
+int PooledIOAlloc::thread_node() {
+    if (t_node < 0) {
+        unsigned cpu = 0, node = 0;
+        t_node = syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 ? (int)node : 0;
+    }
+    return t_node < m_nnodes ? t_node : 0;
+}
+
+size_t PooledIOAlloc::take(int node, int cls, size_t count, std::vector<void *> &out) {
+    auto &n = m_nodes[node];
+    std::lock_guard<std::mutex> lock(n.lock);
+    auto &free = n.free[cls];
+    if (free.empty()) {
+        if (n.next == n.end) {
+            return 0;
+        }
+        auto chunk = n.next;
+        n.next += kChunkSize;
+        m_chunk_class[(chunk - m_base) / kChunkSize] = cls;
+        // taken from the back, in the order of addresses
+        size_t bs = kMinSize << cls;
+        for (size_t off = kChunkSize; off >= bs; off -= bs) {
+            free.push_back(chunk + off - bs);
+        }
+        m_chunks.fetch_add(1, std::memory_order_relaxed);
+    }
+    count = std::min(count, free.size());
+    out.insert(out.end(), free.end() - count, free.end());
+    free.resize(free.size() - count);
+    return count;
+}
+
+void PooledIOAlloc::give(int cls, void **ptrs, size_t count) {
+    for (size_t i = 0; i < count;) {
+        int node = buffer_node(ptrs[i]);
+        std::lock_guard<std::mutex> lock(m_nodes[node].lock);
+        for (; i < count && buffer_node(ptrs[i]) == node; i++) {
+            m_nodes[node].free[cls].push_back(ptrs[i]);
+        }
+    }
+}
+
+void *PooledIOAlloc::alloc_buffer(size_t size) {
+    int cls = size_class(size);
+    if (cls >= 0) {
+        auto lists = thread_lists();
+        std::vector<void *> one;
+        auto &free = lists ? lists->free[cls] : one;
+        int node = thread_node();
+        // from other nodes when the arena of its own runs out
+        for (int i = 0; i < m_nnodes && free.empty(); i++) {
+            take((node + i) % m_nnodes, cls, lists ? batch_count(cls) : 1, free);
+        }
+        if (!free.empty()) {
+            auto ptr = free.back();
+            free.pop_back();
+            m_allocs.fetch_add(1, std::memory_order_relaxed);
+            return ptr;
+        }
+    }
+    m_fallbacks.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, kMinSize, size) != 0) {
+        return nullptr;
+    }
+    return ptr;
+}
+
+void PooledIOAlloc::free_buffer(void *ptr) {
+    if (!in_region(ptr)) {
+        ::free(ptr);
+        return;
+    }
+    int cls = m_chunk_class[((char *)ptr - m_base) / kChunkSize];
+    auto lists = thread_lists();
+    if (lists == nullptr) {
+        give(cls, &ptr, 1);
+        return;
+    }
+    auto &free = lists->free[cls];
+    free.push_back(ptr);
+    auto batch = batch_count(cls);
+    if (free.size() > batch && free.size() * (kMinSize << cls) > kCacheBytes) {
+        // give back those freed earliest
+        give(cls, free.data(), batch);
+        free.erase(free.begin(), free.begin() + batch);
+    }
+}
+
+int PooledIOAlloc::do_alloc(IOAlloc::RangeSize size, void **ptr) {
+    *ptr = alloc_buffer(size.max);
+    return *ptr ? size.max : -1;
+}
+
+int PooledIOAlloc::do_dealloc(void *ptr) {
+    free_buffer(ptr);
+    return 0;
+}
+
+void PooledIOAlloc::get_stat(Stat *stat) {
+    stat->allocs = m_allocs.load(std::memory_order_relaxed);
+    stat->fallbacks = m_fallbacks.load(std::memory_order_relaxed);
+    stat->chunks = m_chunks.load(std::memory_order_relaxed);
+    stat->hugetlb = m_hugetlb;
+    stat->nodes = m_nnodes;
+}
+
+PooledIOAlloc *new_pooled_io_alloc(size_t capacity) {
+    auto alloc = new PooledIOAlloc;
+    if (alloc->init(capacity) != 0) {
+        delete alloc;
+        return nullptr;
+    }
+    return alloc;
+}
+
+} // namespace FileSystem
@@ -0,0 +1,111 @@
+/*
+   Copyright The Overlaybd Authors
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <photon/common/io-alloc.h>
+
+namespace FileSystem {
+
+// An IOAlloc of buffers of power of 2 sizes, from 4KB to 4MB, all 4KB aligned, taken from
+// a region reserved when it's created. The region is backed by hugetlbfs pages if enough
+// of them are reserved, or normal pages otherwise, and it's split into an arena for each
+// NUMA node, bound to the node. An arena is carved into 4MB chunks, each
+// of buffers of a single size.
+//
+// Buffers freed are kept in free lists of the OS thread, i.e. the vcpu, freeing them, and
+// move to and from the free lists of their node in batches. Threads allocate from their
+// own lists first, then from those of their node. The lists of a thread are given back to
+// the nodes when it exits. Buffers of other sizes, or after the arena of the node runs out,
+// are from posix_memalign().
+class PooledIOAlloc : public IOAlloc {
+public:
+    static const size_t kMinSize = 4096;
+    static const size_t kChunkSize = 4UL << 20;
+    static const int kClasses = 11; // 4KB .. 4MB
+    // threads having free lists of their own at a time, the others go to their nodes directly
+    static const int kMaxThreads = 256;
+
+    PooledIOAlloc();
+    ~PooledIOAlloc();
+
+    // reserve `capacity` bytes, rounded up to chunks of each node
+    int init(size_t capacity);
+
+    struct Stat {
+        uint64_t allocs;    // from the region
+        uint64_t fallbacks; // from posix_memalign()
+        uint64_t chunks;    // chunks carved
+        bool hugetlb;       // hugetlbfs pages, or normal ones
+        int nodes;
+    };
+    void get_stat(Stat *stat);
+
+protected:
+    struct Node {
+        std::mutex lock;
+        char *next = nullptr, *end = nullptr; // chunks not carved yet
+        std::vector<void *> free[kClasses];
+    };
+    struct ThreadLists {
+        std::vector<void *> free[kClasses];
+    };
+    // index of the free lists of a thread in each pool, recycled when the thread exits
+    struct ThreadSlot {
+        int index = -1; // -2 if the thread has none
+        ~ThreadSlot();
+    };
+
+    int do_alloc(IOAlloc::RangeSize size, void **ptr);
+    int do_dealloc(void *ptr);
+
+    void *alloc_buffer(size_t size);
+    void free_buffer(void *ptr);
+    ThreadLists *thread_lists();
+    // give the free lists of an exited thread back to the nodes
+    void flush_thread(int index);
+    int thread_node();
+    // move up to `count` buffers of the node to `out`, carving a chunk if needed
+    size_t take(int node, int cls, size_t count, std::vector<void *> &out);
+    // move buffers back to the free lists of their nodes
+    void give(int cls, void **ptrs, size_t count);
+    int buffer_node(void *ptr) const {
+        return ((char *)ptr - m_base) / m_node_size;
+    }
+    bool in_region(void *ptr) const {
+        return (char *)ptr >= m_base && (char *)ptr < m_base + m_node_size * m_nnodes;
+    }
+    // buffers moved between free lists at a time
+    static size_t batch_count(int cls);
+
+    char *m_base = nullptr;
+    size_t m_map_size = 0;
+    size_t m_node_size = 0;
+    std::unique_ptr<Node[]> m_nodes;
+    int m_nnodes = 0;
+    // chunk index -> size class of its buffers
+    std::vector<uint8_t> m_chunk_class;
+    ThreadLists *m_threads = nullptr;
+    bool m_hugetlb = false;
+    std::atomic<uint64_t> m_allocs{0}, m_fallbacks{0}, m_chunks{0};
+};
+
+// returns nullptr if the region can't be reserved
+PooledIOAlloc *new_pooled_io_alloc(size_t capacity);
+
+} // namespace FileSystem
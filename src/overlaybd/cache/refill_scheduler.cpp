@@ -0,0 +1,230 @@
+/*
+   Copyright The Overlaybd Authors
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "refill_scheduler.h"
+#include <algorithm>
+#include <vector>
+#include <photon/common/alog.h>
+#include <photon/common/io-alloc.h>
+#include <photon/common/iovector.h>
+
+namespace FileSystem {
+
+ssize_t RefillScheduler::read(std::string_view key, photon::fs::IFile *src, IOAlloc *allocator,
+                              struct iovec *iov, int iovcnt, off_t offset, int flags) {
+    Request req;
+    req.iov = iov;
+    req.iovcnt = iovcnt;
+    req.offset = offset;
+    size_t count = iovector_view(iov, iovcnt).sum();
+    if (count == 0) {
+        return 0;
+    }
+
+    Blob *blob = nullptr;
+    std::vector<Fetch *> leads;
+    {
+        photon::scoped_lock lock(m_lock);
+        m_reads++;
+        auto it = m_blobs.find(key);
+        if (it == m_blobs.end()) {
+            it = m_blobs.emplace(key, std::unique_ptr<Blob>(new Blob)).first;
+        }
+        blob = it->second.get();
+        split(blob, &req, count);
+        for (auto &p : req.parts) {
+            if (p.fetch != nullptr) {
+                continue;
+            }
+            if (blob->inflight < m_max_inflight) {
+                blob->inflight++;
+                leads.push_back(new_fetch(blob, &p));
+            } else {
+                blob->pending.push_back(&p);
+            }
+        }
+    }
+
+    for (;;) {
+        for (auto f : leads) {
+            fetch(key, blob, src, allocator, f, flags);
+        }
+        leads.clear();
+        req.done.wait(1);
+        // the signaler holds m_lock until all is done with req
+        photon::scoped_lock lock(m_lock);
+        if (req.waiting == 0) {
+            break;
+        }
+        for (auto &p : req.parts) {
+            if (p.lead) {
+                // promoted, inflight was counted by the promoter
+                p.lead = false;
+                leads.push_back(new_fetch(blob, &p));
+            }
+        }
+    }
+
+    ssize_t ret = 0;
+    for (auto &p : req.parts) {
+        if (p.ret < 0) {
+            errno = p.err;
+            return -1;
+        }
+        ret += p.ret;
+        if (static_cast<size_t>(p.ret) < p.count) {
+            break;
+        }
+    }
+    return ret;
+}
+
+void RefillScheduler::split(Blob *blob, Request *req, size_t count) {
+    off_t pos = req->offset, end = req->offset + count;
+    while (pos < end) {
+        Fetch *cover = nullptr;
+        off_t next = end;
+        for (auto f : blob->fetches) {
+            if (f->begin <= pos && pos < f->end) {
+                cover = f;
+                break;
+            }
+            if (f->begin > pos) {
+                next = std::min(next, f->begin);
+            }
+        }
+        off_t e = cover ? std::min(end, cover->end) : next;
+        req->parts.push_back({req, pos, static_cast<size_t>(e - pos), cover});
+        pos = e;
+    }
+    for (auto &p : req->parts) {
+        if (p.fetch != nullptr) {
+            p.fetch->parts.push_back(&p);
+            m_merged++;
+        }
+    }
+    req->waiting = req->parts.size();
+}
+
+RefillScheduler::Fetch *RefillScheduler::new_fetch(Blob *blob, Part *part) {
+    auto f = new Fetch;
+    f->begin = part->offset;
+    f->end = part->offset + part->count;
+    f->parts.push_back(part);
+    part->fetch = f;
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (auto it = blob->pending.begin(); it != blob->pending.end();) {
+            auto p = *it;
+            off_t b = std::min(f->begin, p->offset);
+            off_t e = std::max(f->end, p->offset + static_cast<off_t>(p->count));
+            if (p->offset > f->end || p->offset + static_cast<off_t>(p->count) < f->begin ||
+                static_cast<size_t>(e - b) > m_max_request_size) {
+                ++it;
+                continue;
+            }
+            f->begin = b;
+            f->end = e;
+            f->parts.push_back(p);
+            p->fetch = f;
+            it = blob->pending.erase(it);
+            merged = true;
+        }
+    }
+    blob->fetches.push_back(f);
+    m_fetches++;
+    m_merged += f->parts.size() - 1;
+    return f;
+}
+
+void RefillScheduler::fetch(std::string_view key, Blob *blob, photon::fs::IFile *src,
+                            IOAlloc *allocator, Fetch *f, int flags) {
+    // the range of a fetch is not changed once it's created, but parts may be added to it
+    // until it's done, so they are copied from the request leading it if it's the whole range
+    auto lead = f->parts[0];
+    bool direct = lead->req->parts.size() == 1 &&
+                  lead->count == static_cast<size_t>(f->end - f->begin);
+    size_t count = f->end - f->begin;
+    ssize_t ret = -1;
+    int err = 0;
+    IOVector buffer(*allocator);
+    if (direct) {
+        ret = src->preadv2(lead->req->iov, lead->req->iovcnt, f->begin, flags);
+        err = ret < 0 ? errno : 0;
+    } else if (buffer.push_back(count) < count) {
+        err = ENOMEM;
+        LOG_ERROR("memory allocate failed, size : `", count);
+    } else {
+        ret = src->preadv2(buffer.iovec(), buffer.iovcnt(), f->begin, flags);
+        err = ret < 0 ? errno : 0;
+    }
+
+    {
+        photon::scoped_lock lock(m_lock);
+        blob->fetches.remove(f);
+    }
+    auto data = direct ? lead->req->iov : buffer.iovec();
+    int datacnt = direct ? lead->req->iovcnt : buffer.iovcnt();
+    for (auto p : f->parts) {
+        p->err = err;
+        if (ret < 0) {
+            p->ret = -1;
+            continue;
+        }
+        off_t skip = p->offset - f->begin;
+        if (ret <= skip) {
+            p->ret = 0;
+            continue;
+        }
+        size_t n = std::min(p->count, static_cast<size_t>(ret - skip));
+        if (direct && p == lead) {
+            p->ret = n;
+            continue;
+        }
+        IOVector slice(data, datacnt);
+        slice.extract_front(skip);
+        IOVector dst(p->req->iov, p->req->iovcnt);
+        dst.extract_front(p->offset - p->req->offset);
+        iovector_view view(dst.iovec(), dst.iovcnt());
+        p->ret = slice.memcpy_to(&view, n);
+    }
+
+    photon::scoped_lock lock(m_lock);
+    for (auto p : f->parts) {
+        p->req->waiting--;
+        p->req->done.signal(1);
+    }
+    delete f;
+    blob->inflight--;
+    if (!blob->pending.empty()) {
+        auto next = blob->pending.front();
+        blob->pending.pop_front();
+        blob->inflight++;
+        next->lead = true;
+        next->req->done.signal(1);
+    } else if (blob->inflight == 0) {
+        m_blobs.erase(m_blobs.find(key));
+    }
+}
+
+void RefillScheduler::get_stat(Stat *stat) {
+    photon::scoped_lock lock(m_lock);
+    stat->reads = m_reads;
+    stat->fetches = m_fetches;
+    stat->merged = m_merged;
+}
+
+} // namespace FileSystem
@@ -0,0 +1,100 @@
+/*
+   Copyright The Overlaybd Authors
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+#include <list>
+#include <vector>
+#include <memory>
+#include <sys/uio.h>
+#include <photon/common/string-keyed.h>
+#include <photon/fs/filesystem.h>
+#include <photon/thread/thread.h>
+
+struct IOAlloc;
+
+namespace FileSystem {
+
+// Reads of source files for cache refills go through RefillScheduler, so that concurrent
+// misses of the same blob become fewer and larger ranged requests. A read is split into the
+// parts covered by fetches of the blob in flight, which are completed by those fetches, and
+// those that are not, each fetched by a source read of its own. At most `max_inflight`
+// source reads of a blob are issued at the same time; parts that arrive while the limit is
+// reached wait in a queue, and the next source read issued takes with it all the queued
+// parts that are adjacent to or overlap with it, as long as the merged range is within
+// `max_request_size`. All of them are completed from that single response.
+class RefillScheduler {
+public:
+    RefillScheduler(size_t max_request_size, uint32_t max_inflight)
+        : m_max_request_size(max_request_size), m_max_inflight(max_inflight) {
+    }
+
+    // read [offset, offset + sum of iov) of the blob `key` from `src`
+    ssize_t read(std::string_view key, photon::fs::IFile *src, IOAlloc *allocator,
+                 struct iovec *iov, int iovcnt, off_t offset, int flags);
+
+    struct Stat {
+        uint64_t reads;   // source reads requested
+        uint64_t fetches; // source reads issued
+        uint64_t merged;  // parts of requested reads completed by the fetch of another one
+    };
+    void get_stat(Stat *stat);
+
+protected:
+    struct Request;
+    struct Fetch;
+    // a range of a request, completed by a single fetch
+    struct Part {
+        Request *req;
+        off_t offset;
+        size_t count;
+        Fetch *fetch;
+        ssize_t ret = -1;
+        int err = 0;
+        bool lead = false; // to issue a fetch of its own
+    };
+    struct Request {
+        struct iovec *iov;
+        int iovcnt;
+        off_t offset;
+        std::vector<Part> parts; // in the order of offsets
+        size_t waiting = 0;      // parts not completed yet
+        photon::semaphore done;  // signaled for each part completed or to lead
+    };
+    struct Fetch {
+        off_t begin, end;
+        std::vector<Part *> parts;
+    };
+    struct Blob {
+        std::list<Fetch *> fetches; // in flight, parts may still be added to them
+        std::list<Part *> pending;
+        uint32_t inflight = 0;      // source reads issued or to be issued
+    };
+
+    // split `req` into parts, adding those covered by `blob->fetches` to them, called with
+    // m_lock held
+    void split(Blob *blob, Request *req, size_t count);
+    // a fetch of `part` with the pending parts mergeable with it, called with m_lock held
+    Fetch *new_fetch(Blob *blob, Part *part);
+    void fetch(std::string_view key, Blob *blob, photon::fs::IFile *src, IOAlloc *allocator,
+               Fetch *f, int flags);
+
+    size_t m_max_request_size;
+    uint32_t m_max_inflight;
+    photon::mutex m_lock;
+    map_string_key<std::unique_ptr<Blob>> m_blobs;
+    uint64_t m_reads = 0, m_fetches = 0, m_merged = 0;
+};
+
+} // namespace FileSystem
@@ -15,11 +15,13 @@
 */
 #include "pool_store.h"
 #include "cache.h"
+#include "refill_scheduler.h"
 #include <photon/common/alog.h>
 #include <photon/common/alog-stdstring.h>
 #include <photon/common/alog-audit.h>
 #include <photon/common/io-alloc.h>
 #include <photon/common/iovector.h>
+#include <photon/common/utility.h>
 #include <photon/common/expirecontainer.h>
 #include <photon/thread/thread-pool.h>
 
@@ -81,13 +83,57 @@ again:
         return tr.size;
     }
 
-    ssize_t ret =
-        do_refill_range(tr.refill_offset, tr.refill_size, iov_size, &input, offset, flags);
+    auto refill = adapt_refill(offset, iov_size, tr.refill_offset, tr.refill_size);
+    ssize_t ret = do_refill_range(refill.first, refill.second, iov_size, &input, offset, flags);
     if (ret == -EAGAIN)
         goto again;
     return ret;
 }
 
+std::pair<off_t, size_t> ICacheStore::adapt_refill(off_t offset, size_t count, off_t refill_off,
+                                                   size_t refill_size) {
+    if (!pool_) {
+        return {refill_off, refill_size};
+    }
+    DEFER({
+        pool_->m_refills.fetch_add(1, std::memory_order_relaxed);
+        pool_->m_refill_bytes.fetch_add(refill_size, std::memory_order_relaxed);
+        auto max = pool_->m_refill_max.load(std::memory_order_relaxed);
+        while (refill_size > max && !pool_->m_refill_max.compare_exchange_weak(max, refill_size))
+            ;
+        last_refill_end_ = refill_off + refill_size;
+    });
+    size_t lo = pool_->m_min_refill, hi = pool_->m_max_refill;
+    if (hi == 0) {
+        return {refill_off, refill_size};
+    }
+    off_t end = refill_off + refill_size;
+    // a sequential reader misses again where the last refill ends
+    bool sequential = refill_off <= last_refill_end_ && last_refill_end_ < end;
+    size_t size = std::min(std::max(refill_size, lo), hi);
+    // the first miss, with no pattern seen yet, takes the configured size
+    if (refill_size_ != 0) {
+        size = sequential ? std::min(refill_size_ * 2, hi) : std::max(refill_size_ / 2, lo);
+    }
+    refill_size_ = size;
+
+    if (sequential && size > refill_size) {
+        // extend forward, only over the data not cached yet
+        off_t want = std::min(static_cast<off_t>(refill_off + size), actual_size_);
+        if (want > end) {
+            auto q = queryRefillRange(end, want - end);
+            if (q.first == end && q.second > 0) {
+                end = std::min(static_cast<off_t>(end + q.second), want);
+            }
+        }
+    } else if (size < refill_size) {
+        refill_off = std::max(refill_off, align_down(offset, size));
+        end = std::min(end, static_cast<off_t>(align_up(offset + count, size)));
+    }
+    refill_size = end - refill_off;
+    return {refill_off, refill_size};
+}
+
 ssize_t ICacheStore::pwritev2(const struct iovec *iov, int iovcnt, off_t offset, int flags) {
     if (open_flags_ & (O_WRITE_THROUGH | O_CACHE_ONLY | O_WRITE_BACK)) {
         return pwritev2_extend(iov, iovcnt, offset, flags);
@@ -232,7 +278,13 @@ ssize_t ICacheStore::do_refill_range(uint64_t refill_off, uint64_t refill_size,
 
         {
             SCOPE_AUDIT("download", AU_FILEOP(get_src_name(), refill_off, ret));
-            ret = src_file_->preadv2(buffer.iovec(), buffer.iovcnt(), refill_off, flags);
+            if (pool_) {
+                ret = pool_->m_refill_scheduler->read(store_key_, src_file_, allocator_,
+                                                      buffer.iovec(), buffer.iovcnt(), refill_off,
+                                                      flags);
+            } else {
+                ret = src_file_->preadv2(buffer.iovec(), buffer.iovcnt(), refill_off, flags);
+            }
         }
 
         if (ret != static_cast<ssize_t>(refill_size)) {
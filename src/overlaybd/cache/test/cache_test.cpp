@@ -25,16 +25,23 @@
 #include <random>
 #include <algorithm>
 #include <memory>
+#include <thread>
 
 #include "photon/common/alog.h"
 #include "photon/common/callback.h"
 #include "photon/fs/localfs.h"
 #include "photon/fs/aligned-file.h"
+#include "photon/fs/forwardfs.h"
 #include "photon/thread/thread.h"
 #include "photon/io/fd-events.h"
 #include "photon/io/aio-wrapper.h"
 #include "photon/common/io-alloc.h"
 #include "../cache.h"
+#include "../full_file_cache/cache_pool.h"
+#include "../memory_cache/tiered_pool.h"
+#include "../ocf_cache/ocf_namespace.h"
+#include "../refill_scheduler.h"
+#include "../pooled_alloc.h"
 #include "random_generator.h"
 
 namespace Cache {
@@ -532,6 +539,724 @@ TEST(CachedFS, fn_trans_func) {
   auto cs1 = cachedFile1->get_store();
   auto cs2 = cachedFile2->get_store();
   EXPECT_EQ(cs1, cs2);
+
+  // evicted by the name before transformation, once neither name has it opened
+  delete cFile;
+  delete cachedFile1;
+  EXPECT_NE(0, cachedFs->get_pool()->evict_file("/path_aaa/sha256:test"));
+  EXPECT_EQ(EBUSY, errno);
+  EXPECT_EQ(0, mediaFs->access("/sha256:test", F_OK));
+  delete cachedFile2;
+  EXPECT_EQ(0, cachedFs->get_pool()->evict_file("/path_bbb/sha256:test"));
+  // the store may be still kept open by the pool, then it's truncated instead
+  struct stat st = {};
+  EXPECT_TRUE(mediaFs->stat("/sha256:test", &st) != 0 || st.st_blocks == 0);
+}
+
+class UnitEvictionPool : public FileCachePool {
+public:
+  UnitEvictionPool(IFileSystem *mediaFs, uint64_t waterMark, int policy = POLICY_LRU)
+    : FileCachePool(mediaFs, 1, 100 * 1000, 0, 1024 * 1024, policy) {
+    waterMark_ = waterMark;
+  }
+  void evict_now() {
+    eviction();
+  }
+};
+
+TEST(FileCachePool, evict_cold_units) {
+  std::string root("/tmp/ease/cache/cache_test/");
+  SetupTestDir(root);
+  const size_t unit = 1024 * 1024;
+  const int nunits = 16, nhot = 4;
+  auto mediaFs = new_localfs_adaptor(root.c_str());
+  auto pool = new UnitEvictionPool(mediaFs, nhot * unit);
+  DEFER(delete pool);
+  auto store = pool->open("/blob", O_RDWR | O_CREAT, 0644);
+  ASSERT_NE(nullptr, store);
+  DEFER(store->release());
+  store->set_actual_size(nunits * unit);
+
+  std::vector<char> data(unit), buf(unit);
+  for (int i = 0; i < nunits; i++) {
+    memset(data.data(), 'a' + i, unit);
+    ASSERT_EQ((ssize_t)unit, store->pwrite(data.data(), unit, i * unit));
+  }
+  for (int k = 0; k < 3; k++) {
+    for (int i = 0; i < nhot; i++) {
+      ASSERT_EQ((ssize_t)unit, store->pread(buf.data(), unit, i * unit));
+    }
+  }
+  pool->evict_now();
+
+  // the hot units survive, cold ones are punched out while the file is kept
+  auto checkFs = new_localfs_adaptor(root.c_str());
+  DEFER(delete checkFs);
+  auto file = checkFs->open("/blob", O_RDONLY);
+  ASSERT_NE(nullptr, file);
+  DEFER(delete file);
+  struct stat st = {};
+  file->fstat(&st);
+  EXPECT_EQ((off_t)(nunits * unit), st.st_size);
+  EXPECT_LE((uint64_t)st.st_blocks * 512, nhot * unit);
+  for (int i = 0; i < nhot; i++) {
+    memset(data.data(), 'a' + i, unit);
+    ASSERT_EQ((ssize_t)unit, file->pread(buf.data(), unit, i * unit));
+    EXPECT_EQ(0, memcmp(data.data(), buf.data(), unit));
+  }
+  memset(data.data(), 0, unit);
+  ASSERT_EQ((ssize_t)unit, file->pread(buf.data(), unit, (nunits - 1) * unit));
+  EXPECT_EQ(0, memcmp(data.data(), buf.data(), unit));
+}
+
+TEST(FileCachePool, cached_units) {
+  std::string root("/tmp/ease/cache/cache_test/");
+  SetupTestDir(root);
+  const size_t unit = 1024 * 1024;
+  const int nunits = 8;
+  auto mediaFs = new_localfs_adaptor(root.c_str());
+  auto pool = new FileCachePool(mediaFs, 1, 100 * 1000, 0, unit);
+  DEFER(delete pool);
+  std::vector<char> buf(unit);
+  {
+    auto store = pool->open("/blob", O_RDWR | O_CREAT, 0644);
+    ASSERT_NE(nullptr, store);
+    DEFER(store->release());
+    store->set_actual_size(nunits * unit - 4096);
+    for (int i = 0; i < nunits; i++) {
+      auto count = std::min(unit, nunits * unit - 4096 - i * unit);
+      ASSERT_EQ((ssize_t)count, store->pwrite(buf.data(), count, i * unit));
+    }
+    EXPECT_EQ(0, store->queryRefillRange(0, nunits * unit - 4096).second);
+  }
+
+  // reopen, the cached units are loaded from media file
+  auto store = pool->open("/blob", O_RDWR, 0644);
+  ASSERT_NE(nullptr, store);
+  DEFER(store->release());
+  store->set_actual_size(nunits * unit - 4096);
+  EXPECT_EQ(0, store->queryRefillRange(0, nunits * unit - 4096).second);
+  EXPECT_EQ((ssize_t)unit, store->pread(buf.data(), unit, 0));
+
+  // an evicted unit misses, and the source file is absent
+  ASSERT_EQ(0, store->evict(2 * unit, unit));
+  auto r = store->queryRefillRange(2 * unit + 4096, 4096);
+  EXPECT_EQ((off_t)(2 * unit), r.first);
+  EXPECT_EQ(unit, r.second);
+  EXPECT_EQ(-1, store->pread(buf.data(), 4096, 2 * unit));
+  EXPECT_EQ((ssize_t)unit, store->pread(buf.data(), unit, 3 * unit));
+
+  // partially written unit is still found by fiemap
+  ASSERT_EQ(4096, store->pwrite(buf.data(), 4096, 2 * unit + 4096));
+  EXPECT_EQ(0, store->queryRefillRange(2 * unit + 4096, 4096).second);
+  EXPECT_EQ((ssize_t)4096, store->pread(buf.data(), 4096, 2 * unit + 4096));
+}
+
+TEST(SegmentedLRU, scan_resistant) {
+  FileSystem::SegmentedLRU<int, uint32_t> lru(50);
+  std::vector<uint32_t> keys(32);
+  auto rekey = [&](int v, uint32_t key) { keys[v] = key; };
+  for (int i = 0; i < 4; i++) {
+    keys[i] = lru.push_front(i);
+  }
+  for (int i = 0; i < 4; i++) {
+    lru.access(keys[i], rekey);
+  }
+  // a scan only flushes probation, where 2 of the 4 hit units are demoted to
+  for (int i = 10; i < 30; i++) {
+    keys[i] = lru.push_front(i);
+  }
+  keys[31] = lru.push_back(31);
+  EXPECT_EQ(25UL, lru.size());
+  EXPECT_EQ(31, lru.back());
+  std::vector<int> evicted;
+  while (!lru.empty()) {
+    evicted.push_back(lru.back());
+    lru.remove(keys[lru.back()]);
+  }
+  EXPECT_EQ(std::vector<int>({31, 0, 1}), std::vector<int>(evicted.begin(), evicted.begin() + 3));
+  EXPECT_EQ(std::vector<int>({2, 3}), std::vector<int>(evicted.end() - 2, evicted.end()));
+}
+
+TEST(FileCachePool, scan_resistant) {
+  std::string root("/tmp/ease/cache/cache_test/");
+  const size_t unit = 1024 * 1024;
+  const int nunits = 16, nhot = 2;
+  // returns # of hot units kept after writing a scan of cold units
+  auto run = [&](int policy, int scanFlags) {
+    SetupTestDir(root);
+    auto pool = new UnitEvictionPool(new_localfs_adaptor(root.c_str()), nhot * unit, policy);
+    DEFER(delete pool);
+    auto store = pool->open("/blob", O_RDWR | O_CREAT, 0644);
+    EXPECT_NE(nullptr, store);
+    DEFER(store->release());
+    store->set_actual_size(nunits * unit);
+    std::vector<char> buf(unit, 'x');
+    for (int i = 0; i < nhot; i++) {
+      EXPECT_EQ((ssize_t)unit, store->pwrite(buf.data(), unit, i * unit));
+      EXPECT_EQ((ssize_t)unit, store->pread(buf.data(), unit, i * unit));
+    }
+    struct iovec iov{buf.data(), unit};
+    for (int i = nhot; i < nunits; i++) {
+      EXPECT_EQ((ssize_t)unit, store->pwritev2(&iov, 1, i * unit, scanFlags));
+    }
+    pool->evict_now();
+    int kept = 0;
+    for (int i = 0; i < nhot; i++) {
+      kept += store->queryRefillRange(i * unit, unit).second == 0;
+    }
+    return kept;
+  };
+  EXPECT_EQ(0, run(POLICY_LRU, 0));
+  EXPECT_EQ(nhot, run(POLICY_2Q, 0));
+  EXPECT_EQ(nhot, run(POLICY_LRU, RW_V2_LOW_PRIORITY));
+}
+
+class SlowFile : public ForwardFile_Ownership {
+public:
+  std::atomic<int> reads{0};
+  SlowFile(IFile *file) : ForwardFile_Ownership(file, true) {}
+  ssize_t preadv2(const struct iovec *iov, int iovcnt, off_t offset, int flags) override {
+    reads++;
+    photon::thread_usleep(10 * 1000);
+    return m_file->preadv(iov, iovcnt, offset);
+  }
+};
+
+class RefillSchedulerTest : public ::testing::Test {
+public:
+  const size_t unit = 64 * 1024;
+  const int nunits = 8;
+  IFileSystem *srcFs = nullptr;
+  SlowFile *src = nullptr;
+  IOAlloc alloc;
+  std::vector<char> data;
+
+  struct Reader {
+    RefillScheduler *scheduler;
+    SlowFile *src;
+    IOAlloc *alloc;
+    off_t offset;
+    size_t count;
+    std::vector<char> buf;
+    ssize_t ret;
+  };
+
+  void SetUp() override {
+    std::string srcRoot("/tmp/ease/cache/src_test/");
+    SetupTestDir(srcRoot);
+    srcFs = new_localfs_adaptor(srcRoot.c_str());
+    data.resize(nunits * unit);
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] = i * 7 % 251;
+    }
+    auto file = srcFs->open("/blob", O_RDWR | O_CREAT, 0644);
+    ASSERT_EQ((ssize_t)data.size(), file->pwrite(data.data(), data.size(), 0));
+    delete file;
+    src = new SlowFile(srcFs->open("/blob", O_RDONLY));
+  }
+  void TearDown() override {
+    delete src;
+    delete srcFs;
+  }
+
+  // read the {offset, count} ranges concurrently, started in order, and check the data
+  void read_all(RefillScheduler *scheduler, std::vector<std::pair<off_t, size_t>> ranges) {
+    std::vector<Reader> readers;
+    for (auto &r : ranges) {
+      readers.push_back({scheduler, src, &alloc, r.first, r.second,
+                         std::vector<char>(r.second), 0});
+    }
+    auto run = [](void *args) -> void * {
+      auto r = (Reader *)args;
+      struct iovec iov{r->buf.data(), r->count};
+      r->ret = r->scheduler->read("/blob", r->src, r->alloc, &iov, 1, r->offset, 0);
+      return nullptr;
+    };
+    std::vector<photon::join_handle *> jhs;
+    for (auto &r : readers) {
+      jhs.emplace_back(photon::thread_enable_join(photon::thread_create(run, &r)));
+    }
+    for (auto x : jhs) {
+      photon::thread_join(x);
+    }
+    for (auto &r : readers) {
+      EXPECT_EQ((ssize_t)r.count, r.ret);
+      EXPECT_EQ(0, memcmp(data.data() + r.offset, r.buf.data(), r.count));
+    }
+  }
+};
+
+TEST_F(RefillSchedulerTest, merge_adjacent) {
+  // the reads wait for the first one, and then are merged in one,
+  // except the last one that would exceed the max request size
+  RefillScheduler scheduler((nunits - 2) * unit, 1);
+  std::vector<std::pair<off_t, size_t>> ranges;
+  for (int i = 0; i < nunits; i++) {
+    ranges.emplace_back(i * unit, unit);
+  }
+  read_all(&scheduler, ranges);
+  EXPECT_EQ(3, src->reads.load());
+  RefillScheduler::Stat stat;
+  scheduler.get_stat(&stat);
+  EXPECT_EQ((uint64_t)nunits, stat.reads);
+  EXPECT_EQ(3UL, stat.fetches);
+  EXPECT_EQ((uint64_t)nunits - 3, stat.merged);
+}
+
+TEST_F(RefillSchedulerTest, attach_inflight) {
+  // the 2nd read is covered by the fetch of the 1st in flight, and the 3rd partly, which
+  // fetches only the rest of it
+  RefillScheduler scheduler(nunits * unit, 32);
+  read_all(&scheduler, {{0, 4 * unit}, {unit, unit}, {3 * unit, 2 * unit}});
+  EXPECT_EQ(2, src->reads.load());
+  RefillScheduler::Stat stat;
+  scheduler.get_stat(&stat);
+  EXPECT_EQ(3UL, stat.reads);
+  EXPECT_EQ(2UL, stat.fetches);
+  EXPECT_EQ(2UL, stat.merged);
+}
+
+TEST(CachedFS, adaptive_refill) {
+  std::string srcRoot("/tmp/ease/cache/src_test/");
+  SetupTestDir(srcRoot);
+  std::string root("/tmp/ease/cache/cache_test/");
+  SetupTestDir(root);
+  const size_t size = 16UL * 1024 * 1024;
+  std::vector<char> data(size);
+  for (size_t i = 0; i < size; i++) {
+    data[i] = i * 13 % 241;
+  }
+  auto srcFs = new_localfs_adaptor(srcRoot.c_str());
+  {
+    auto file = srcFs->open("/blob", O_RDWR | O_CREAT, 0644);
+    ASSERT_EQ((ssize_t)size, file->pwrite(data.data(), size, 0));
+    delete file;
+  }
+  auto cachedFs = new_full_file_cached_fs(srcFs, new_localfs_adaptor(root.c_str()), 256 * 1024,
+                                          1, 100 * 1000 * 1, 128ul * 1024 * 1024, nullptr, 0);
+  ASSERT_NE(nullptr, cachedFs);
+  DEFER(delete cachedFs);
+  auto pool = cachedFs->get_pool();
+  EXPECT_EQ(-1, pool->set_refill_bounds(64 * 1024, 3 * 1024 * 1024));
+  ASSERT_EQ(0, pool->set_refill_bounds(64 * 1024, 2 * 1024 * 1024));
+  auto file = cachedFs->open("/blob", O_RDONLY);
+  ASSERT_NE(nullptr, file);
+  DEFER(delete file);
+
+  // the first miss refills the configured size
+  char buf[4096];
+  ASSERT_EQ((ssize_t)sizeof(buf), file->pread(buf, sizeof(buf), 0));
+  ICachePool::RefillStat stat;
+  pool->get_refill_stat(&stat);
+  EXPECT_EQ(1UL, stat.refills);
+  EXPECT_EQ(256UL * 1024, stat.max_size);
+
+  // sequential misses grow the refill size up to the max
+  for (off_t offset = 0; offset < (off_t)size / 2; offset += sizeof(buf)) {
+    ASSERT_EQ((ssize_t)sizeof(buf), file->pread(buf, sizeof(buf), offset));
+    ASSERT_EQ(0, memcmp(data.data() + offset, buf, sizeof(buf)));
+  }
+  pool->get_refill_stat(&stat);
+  EXPECT_EQ(2UL * 1024 * 1024, stat.max_size);
+  EXPECT_GE(stat.bytes, size / 2);
+  EXPECT_LT(stat.refills, 10UL);
+
+  // random misses shrink it down to the min
+  for (int i = 0; i < 6; i++) {
+    off_t offset = size / 2 + i * 1024 * 1024 + 12345;
+    ASSERT_EQ((ssize_t)sizeof(buf), file->pread(buf, sizeof(buf), offset));
+    ASSERT_EQ(0, memcmp(data.data() + offset, buf, sizeof(buf)));
+  }
+  pool->get_refill_stat(&stat);
+  ASSERT_EQ((ssize_t)sizeof(buf), file->pread(buf, sizeof(buf), size - 4096));
+  pool->get_refill_stat(&stat);
+  EXPECT_EQ(64UL * 1024, stat.max_size);
+}
+
+class IndexedPool : public FileCachePool {
+public:
+  IndexedPool(IFileSystem *mediaFs)
+    : FileCachePool(mediaFs, 1, 100 * 1000, 0, 1024 * 1024) {
+  }
+  int64_t used() {
+    return totalUsed_;
+  }
+  bool tracked(std::string_view name) {
+    auto &index = fileIndex_[indexShard(name)];
+    return index.find(name) != index.end();
+  }
+  void insert(std::string_view name, uint64_t size) {
+    insertEntry(name, size, false);
+  }
+};
+
+TEST(FileCachePool, persistent_index) {
+  std::string root("/tmp/ease/cache/cache_test/");
+  SetupTestDir(root);
+  const size_t unit = 1024 * 1024;
+  std::vector<char> buf(unit, 'x');
+  int64_t used = 0;
+  {
+    auto pool = new IndexedPool(new_localfs_adaptor(root.c_str()));
+    pool->Init();
+    for (auto name : {"/a", "/dir/b"}) {
+      auto store = pool->open(name, O_RDWR | O_CREAT, 0644);
+      ASSERT_NE(nullptr, store);
+      store->set_actual_size(2 * unit);
+      EXPECT_EQ((ssize_t)unit, store->pwrite(buf.data(), unit, 0));
+      store->release();
+    }
+    used = pool->used();
+    EXPECT_LT(0, used);
+    delete pool;
+  }
+  auto localFs = new_localfs_adaptor(root.c_str());
+  DEFER(delete localFs);
+  EXPECT_EQ(0, localFs->access(FileCachePool::kPoolIndexFile, F_OK));
+  // not in the index, so not found when the index is loaded
+  auto stray = localFs->open("/c", O_RDWR | O_CREAT, 0644);
+  stray->pwrite(buf.data(), unit, 0);
+  delete stray;
+
+  {
+    auto pool = new IndexedPool(new_localfs_adaptor(root.c_str()));
+    pool->Init();
+    EXPECT_NE(0, localFs->access(FileCachePool::kPoolIndexFile, F_OK));
+    EXPECT_EQ(used, pool->used());
+    EXPECT_TRUE(pool->tracked("/a"));
+    EXPECT_TRUE(pool->tracked("/dir/b"));
+    EXPECT_FALSE(pool->tracked("/c"));
+    delete pool;
+  }
+
+  // corrupted index falls back to traverse the media dir
+  auto index = localFs->open(FileCachePool::kPoolIndexFile, O_RDWR);
+  ASSERT_NE(nullptr, index);
+  char c = 0;
+  index->pwrite(&c, 1, 30);
+  delete index;
+  {
+    auto pool = new IndexedPool(new_localfs_adaptor(root.c_str()));
+    pool->Init();
+    EXPECT_TRUE(pool->tracked("/a"));
+    EXPECT_TRUE(pool->tracked("/c"));
+    EXPECT_FALSE(pool->tracked(FileCachePool::kPoolIndexFile));
+    delete pool;
+  }
+
+  // so does an index of a length beyond its file, without allocating that length
+  index = localFs->open(FileCachePool::kPoolIndexFile, O_RDWR);
+  ASSERT_NE(nullptr, index);
+  uint64_t length = 1UL << 62;
+  index->pwrite(&length, sizeof(length), 16);
+  delete index;
+  {
+    auto pool = new IndexedPool(new_localfs_adaptor(root.c_str()));
+    pool->Init();
+    EXPECT_TRUE(pool->tracked("/a"));
+    EXPECT_TRUE(pool->tracked("/c"));
+    // a file inserted again is counted once
+    used = pool->used();
+    pool->insert("/a", unit);
+    EXPECT_EQ(used, pool->used());
+    delete pool;
+  }
+}
+
+
+TEST(FileCachePool, stat_quota_evict) {
+  std::string root("/tmp/ease/cache/cache_test/");
+  SetupTestDir(root);
+  const size_t unit = 1024 * 1024;
+  const int nunits = 4;
+  auto mediaFs = new_localfs_adaptor(root.c_str());
+  auto pool = new UnitEvictionPool(mediaFs, 1024 * unit);
+  DEFER(delete pool);
+  std::vector<char> data(unit, 'x');
+  std::vector<ICacheStore *> stores;
+  for (auto name : {"/img1/a", "/img1/b", "/img2/c"}) {
+    auto store = pool->open(name, O_RDWR | O_CREAT, 0644);
+    ASSERT_NE(nullptr, store);
+    store->set_actual_size(nunits * unit);
+    for (int i = 0; i < nunits; i++) {
+      ASSERT_EQ((ssize_t)unit, store->pwrite(data.data(), unit, i * unit));
+    }
+    stores.push_back(store);
+  }
+  stores[0]->release();
+  stores[2]->release();
+  DEFER(stores[1]->release());
+
+  CacheStat stat = {};
+  ASSERT_EQ(0, pool->stat(&stat));
+  EXPECT_EQ(unit, stat.refill_unit);
+  EXPECT_EQ(1024U, stat.total_size);
+  EXPECT_EQ(3U * nunits, stat.used_size);
+  ASSERT_EQ(0, pool->stat(&stat, "/img1/a"));
+  EXPECT_EQ((uint32_t)nunits, stat.total_size);
+  EXPECT_EQ((uint32_t)nunits, stat.used_size);
+  ASSERT_EQ(0, pool->stat(&stat, "/img1/"));
+  EXPECT_EQ(2U * nunits, stat.used_size);
+  EXPECT_NE(0, pool->stat(&stat, "/img3"));
+  EXPECT_EQ(ENOENT, errno);
+
+  // cold units under the dir are evicted down to its quota
+  ASSERT_EQ(0, pool->set_quota("/img1", 5 * unit));
+  ASSERT_EQ(0, pool->stat(&stat, "/img1"));
+  EXPECT_EQ(5U, stat.total_size);
+  ASSERT_EQ(0, pool->evict());
+  ASSERT_EQ(0, pool->stat(&stat, "/img1"));
+  EXPECT_LE(stat.used_size, 5U);
+  ASSERT_EQ(0, pool->stat(&stat, "/img2/c"));
+  EXPECT_EQ((uint32_t)nunits, stat.used_size);
+
+  // a dir of blobs is removed at once
+  ASSERT_EQ(0, pool->evict("/img2"));
+  EXPECT_NE(0, mediaFs->access("/img2/c", F_OK));
+  EXPECT_NE(0, pool->stat(&stat, "/img2"));
+
+  EXPECT_NE(0, pool->rename("/img1/b", "/img3/b"));
+  EXPECT_EQ(EBUSY, errno);
+  ASSERT_EQ(0, pool->rename("/img1/a", "/img3/a"));
+  EXPECT_EQ(0, mediaFs->access("/img3/a", F_OK));
+  EXPECT_EQ(0, pool->evict("/img3/a"));
+  EXPECT_NE(0, mediaFs->access("/img3/a", F_OK));
+
+  ASSERT_EQ(0, pool->stat(&stat));
+  EXPECT_EQ((uint32_t)nunits, stat.used_size);
+  EXPECT_LE(3 * unit, stat.evict_other);
+  EXPECT_LE(nunits * unit, stat.evict_user);
+  ASSERT_EQ(0, pool->reset(FileSystem::RST_STAT));
+  ASSERT_EQ(0, pool->stat(&stat));
+  EXPECT_EQ(0U, stat.evict_user);
+  EXPECT_EQ(0U, stat.evict_other);
+}
+
+TEST(OcfNamespace, reuse_removed_blocks) {
+  std::string root("/tmp/ease/cache/cache_test/");
+  SetupTestDir(root);
+  const size_t blk = 4096;
+  auto localFs = new_localfs_adaptor(root.c_str());
+  DEFER(delete localFs);
+  ASSERT_EQ(0, localFs->mkdir("/ns", 0755));
+  auto nsFs = new_localfs_adaptor((root + "ns").c_str());
+  DEFER(delete nsFs);
+
+  auto locate = [&](OcfNamespace *ns, const char *name, size_t blocks) {
+    auto src = localFs->open("/src", O_RDWR | O_CREAT, 0644);
+    src->ftruncate(blocks * blk);
+    DEFER(delete src);
+    OcfNamespace::NsInfo info{};
+    EXPECT_EQ(0, ns->locate_file(name, src, info));
+    return info.blk_idx;
+  };
+  auto stat = [](OcfNamespace *ns) {
+    OcfNamespace::NsStat st{};
+    ns->get_stat(st);
+    return std::make_pair(st.total_blocks, st.free_blocks);
+  };
+
+  std::unique_ptr<OcfNamespace> ns(new_ocf_namespace_on_fs(blk, nsFs));
+  ASSERT_EQ(0, ns->init());
+  EXPECT_EQ(0, locate(ns.get(), "/dir/a", 3));
+  EXPECT_EQ(3, locate(ns.get(), "/dir/b", 2));
+  EXPECT_EQ(5, locate(ns.get(), "/dir/c", 1));
+
+  OcfNamespace::NsInfo info{};
+  EXPECT_EQ(0, ns->remove_file("/dir/b", info));
+  EXPECT_EQ(3, info.blk_idx);
+  EXPECT_EQ(std::make_pair(6UL, 2UL), stat(ns.get()));
+  // first fit in the range of the removed file
+  EXPECT_EQ(3, locate(ns.get(), "/dir/d", 1));
+  EXPECT_EQ(std::make_pair(6UL, 1UL), stat(ns.get()));
+
+  std::vector<OcfNamespace::NsFile> files;
+  EXPECT_EQ(0, ns->find_files("/dir", files));
+  EXPECT_EQ(3UL, files.size());
+  files.clear();
+  EXPECT_NE(0, ns->find_files("/dir/b", files));
+  EXPECT_EQ(ENOENT, errno);
+
+  // free ranges are found again from the gaps, and those at the end are given back
+  ns.reset(new_ocf_namespace_on_fs(blk, nsFs));
+  ASSERT_EQ(0, ns->init());
+  EXPECT_EQ(std::make_pair(6UL, 1UL), stat(ns.get()));
+  EXPECT_EQ(0, ns->remove_file("/dir/c", info));
+  EXPECT_EQ(std::make_pair(4UL, 0UL), stat(ns.get()));
+  EXPECT_EQ(4, locate(ns.get(), "/dir/e", 2));
+}
+
+TEST(OcfCachedFs, multiple_io_queues) {
+  std::string root("/tmp/ease/cache/cache_test/");
+  SetupTestDir(root);
+  const size_t blk = 4096;
+  const size_t size = 8 * 1024 * 1024;
+  auto localFs = new_localfs_adaptor(root.c_str());
+  DEFER(delete localFs);
+  ASSERT_EQ(0, localFs->mkdir("/ns", 0755));
+  auto nsFs = new_localfs_adaptor((root + "ns").c_str());
+  DEFER(delete nsFs);
+
+  std::vector<char> data(size);
+  std::mt19937 gen(41);
+  for (auto &c : data) c = gen();
+  {
+    auto src = localFs->open("/blob", O_RDWR | O_CREAT, 0644);
+    ASSERT_EQ((ssize_t)size, src->pwrite(data.data(), size, 0));
+    delete src;
+  }
+  auto media = localFs->open("/media", O_RDWR | O_CREAT, 0644);
+  DEFER(delete media);
+  ASSERT_EQ(0, media->ftruncate(1024UL * 1024 * 1024));
+
+  IOAlloc alloc;
+  std::unique_ptr<ICachedFileSystem> cachedFs(
+      FileSystem::new_ocf_cached_fs(localFs, nsFs, blk, 0, media, false, &alloc, 0, 3));
+  ASSERT_NE(nullptr, cachedFs);
+  std::unique_ptr<IFile> file(cachedFs->open("/blob", O_RDONLY, 0644));
+  ASSERT_NE(nullptr, file);
+
+  // concurrent reads are spread over the queues, a miss and a hit of each range give its data
+  struct Reader {
+    IFile *file;
+    const std::vector<char> *data;
+    off_t first;
+    size_t stride;
+    int bad;
+  };
+  auto run = [](void *args) -> void * {
+    auto r = (Reader *)args;
+    std::vector<char> buf(4 * 4096);
+    for (int round = 0; round < 2; round++) {
+      for (off_t off = r->first; off < (off_t)r->data->size(); off += r->stride) {
+        if (r->file->pread(buf.data(), buf.size(), off) != (ssize_t)buf.size() ||
+            memcmp(buf.data(), r->data->data() + off, buf.size()) != 0) {
+          r->bad++;
+        }
+      }
+    }
+    return nullptr;
+  };
+  const int nreaders = 8;
+  std::vector<Reader> readers;
+  for (int i = 0; i < nreaders; i++) {
+    readers.push_back({file.get(), &data, (off_t)(i * 4 * blk), nreaders * 4 * blk, 0});
+  }
+  std::vector<photon::join_handle *> jhs;
+  for (auto &r : readers) {
+    jhs.emplace_back(photon::thread_enable_join(photon::thread_create(run, &r)));
+  }
+  for (auto x : jhs) {
+    photon::thread_join(x);
+  }
+  for (auto &r : readers) {
+    EXPECT_EQ(0, r.bad);
+  }
+}
+
+TEST(TieredCachePool, promote_hot_units) {
+  std::string root("/tmp/ease/cache/cache_test/");
+  SetupTestDir(root);
+  const size_t unit = 1024 * 1024;
+  auto mediaFs = new_localfs_adaptor(root.c_str());
+  auto lower = new FileCachePool(mediaFs, 1, 100 * 1000, 0, unit);
+  auto pool = static_cast<TieredCachePool *>(new_tiered_cache_pool(lower, 2 * unit, unit, 2));
+  ASSERT_NE(nullptr, pool);
+  DEFER(delete pool);
+  EXPECT_EQ(nullptr, new_tiered_cache_pool(nullptr, unit, 3 * 4096, 2));
+
+  std::vector<char> data(unit), buf(unit);
+  auto store = pool->open("/blob", O_RDWR | O_CREAT, 0644);
+  ASSERT_NE(nullptr, store);
+  DEFER(store->release());
+  store->set_actual_size(4 * unit);
+  for (int i = 0; i < 4; i++) {
+    memset(data.data(), 'a' + i, unit);
+    ASSERT_EQ((ssize_t)unit, store->pwrite(data.data(), unit, i * unit));
+  }
+
+  // the 2nd read from the lower pool promotes the unit, the 3rd is served by memory
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ((ssize_t)unit, store->pread(buf.data(), unit, 3 * unit));
+    EXPECT_EQ('d', buf[unit - 1]);
+  }
+  TierStat stat;
+  pool->get_tier_stat(&stat);
+  EXPECT_EQ(2UL, stat.lower_hits);
+  EXPECT_EQ(1UL, stat.mem_hits);
+  EXPECT_EQ(1UL, stat.promotions);
+  EXPECT_EQ(unit, stat.mem_used);
+
+  // least recently used units are dropped when memory is full
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 3; i++) {
+      ASSERT_EQ((ssize_t)unit, store->pread(buf.data(), unit, i * unit));
+      EXPECT_EQ('a' + i, buf[0]);
+    }
+  }
+  pool->get_tier_stat(&stat);
+  EXPECT_EQ(2 * unit, stat.mem_used);
+
+  // writes invalidate the units in memory
+  memset(data.data(), 'z', unit);
+  ASSERT_EQ((ssize_t)unit, store->pwrite(data.data(), unit, 2 * unit));
+  ASSERT_EQ((ssize_t)unit, store->pread(buf.data(), unit, 2 * unit));
+  EXPECT_EQ('z', buf[0]);
+
+  EXPECT_EQ(0, pool->reset(FileSystem::RST_MEMORY));
+  pool->get_tier_stat(&stat);
+  EXPECT_EQ(0UL, stat.mem_used);
+}
+
+TEST(PooledIOAlloc, reuse) {
+  std::unique_ptr<FileSystem::PooledIOAlloc> alloc(FileSystem::new_pooled_io_alloc(16UL << 20));
+  ASSERT_NE(nullptr, alloc);
+
+  auto buf = alloc->alloc(64 * 1024);
+  ASSERT_NE(nullptr, buf);
+  EXPECT_EQ(0UL, (uint64_t)buf % 4096);
+  memset(buf, 'x', 64 * 1024);
+  alloc->dealloc(buf);
+  // freed buffers are taken again by the thread
+  EXPECT_EQ(buf, alloc->alloc(40 * 1024));
+  alloc->dealloc(buf);
+
+  // sizes above 4MB are not pooled
+  auto big = alloc->alloc(8UL << 20);
+  ASSERT_NE(nullptr, big);
+  EXPECT_EQ(0UL, (uint64_t)big % 4096);
+  alloc->dealloc(big);
+
+  FileSystem::PooledIOAlloc::Stat stat;
+  alloc->get_stat(&stat);
+  EXPECT_EQ(2UL, stat.allocs);
+  EXPECT_EQ(1UL, stat.fallbacks);
+  EXPECT_EQ(1UL, stat.chunks);
+  EXPECT_LE(1, stat.nodes);
+}
+
+TEST(PooledIOAlloc, thread_exit) {
+  // a chunk of each node, which a thread takes all the 4KB buffers of at once
+  std::unique_ptr<FileSystem::PooledIOAlloc> alloc(FileSystem::new_pooled_io_alloc(4UL << 20));
+  ASSERT_NE(nullptr, alloc);
+
+  // more threads than those having free lists at a time, one after another
+  for (int i = 0; i < FileSystem::PooledIOAlloc::kMaxThreads + 8; i++) {
+    std::thread th([&] {
+      auto buf = alloc->alloc(4096);
+      EXPECT_NE(nullptr, buf);
+      alloc->dealloc(buf);
+    });
+    th.join();
+  }
+
+  // buffers cached by threads exited are given back, so none are from posix_memalign()
+  FileSystem::PooledIOAlloc::Stat stat;
+  alloc->get_stat(&stat);
+  EXPECT_EQ((uint64_t)FileSystem::PooledIOAlloc::kMaxThreads + 8, stat.allocs);
+  EXPECT_EQ(0UL, stat.fallbacks);
+  EXPECT_GE((uint64_t)stat.nodes, stat.chunks);
 }
 
 }  //  namespace Cache
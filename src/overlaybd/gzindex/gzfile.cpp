@@ -19,8 +19,11 @@
 #include <string.h>
 #include <zlib.h>
 #include <list>
+#include <map>
+#include <memory>
 #include <sys/stat.h>
 #include <algorithm>
+#include "gzfile.h"
 #include "gzfile_index.h"
 #include "photon/common/alog.h"
 #include "photon/common/alog-stdstring.h"
@@ -33,12 +36,124 @@
 namespace FileSystem {
 using namespace photon::fs;
 
+struct GzSpan {
+    std::unique_ptr<unsigned char[]> data;
+    size_t len;
+};
+typedef std::shared_ptr<GzSpan> GzSpanPtr;
+
+class GzSpanCacheImpl : public GzSpanCache {
+public:
+    explicit GzSpanCacheImpl(size_t capacity) : capacity_(capacity) {
+    }
+
+    virtual void get_stat(Stat *stat) override {
+        SCOPED_LOCK(mutex_);
+        stat->used = used_;
+        stat->hits = hits_;
+        stat->misses = misses_;
+    }
+
+    uint64_t new_file_id() {
+        SCOPED_LOCK(mutex_);
+        return ++last_file_id_;
+    }
+
+    GzSpanPtr get(uint64_t file_id, size_t index) {
+        SCOPED_LOCK(mutex_);
+        auto it = map_.find(Key(file_id, index));
+        if (it == map_.end()) {
+            misses_++;
+            return nullptr;
+        }
+        hits_++;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return it->second->span;
+    }
+
+    void put(uint64_t file_id, size_t index, GzSpanPtr span) {
+        if (span->len > capacity_) {
+            return;
+        }
+        SCOPED_LOCK(mutex_);
+        // inflated by another read at the same time
+        if (map_.count(Key(file_id, index))) {
+            return;
+        }
+        lru_.push_front(Entry{Key(file_id, index), span});
+        map_[lru_.front().key] = lru_.begin();
+        used_ += span->len;
+        while (used_ > capacity_) {
+            erase(std::prev(lru_.end()));
+        }
+    }
+
+    // drop the spans of a file closed
+    void drop(uint64_t file_id) {
+        SCOPED_LOCK(mutex_);
+        auto it = map_.lower_bound(Key(file_id, 0));
+        while (it != map_.end() && it->first.first == file_id) {
+            erase((it++)->second);
+        }
+    }
+
+private:
+    typedef std::pair<uint64_t, size_t> Key; // {file id, index of the span}
+    struct Entry {
+        Key key;
+        GzSpanPtr span;
+    };
+
+    void erase(std::list<Entry>::iterator it) {
+        used_ -= it->span->len;
+        map_.erase(it->key);
+        lru_.erase(it);
+    }
+
+    photon::mutex mutex_;
+    size_t capacity_;
+    size_t used_ = 0;
+    uint64_t hits_ = 0, misses_ = 0;
+    uint64_t last_file_id_ = 0;
+    std::list<Entry> lru_; // most recently used first
+    std::map<Key, std::list<Entry>::iterator> map_;
+};
+
+// An inflate stream kept by a gzfile after a read, and continued by a read at or after
+// where it stopped, instead of starting over from the index point
+struct InflateCursor {
+    static const int CHUNK = 65536;
+    z_stream strm;
+    off_t de_start = 0; // of the index point it started from
+    off_t en_pos = 0;   // of the next compressed byte to read
+    bool ended = false;
+    unsigned char inbuf[CHUNK];
+
+    InflateCursor() {
+        memset(&strm, 0, sizeof(strm));
+    }
+    ~InflateCursor() {
+        inflateEnd(&strm);
+    }
+    // of the next byte to inflate
+    off_t de_pos() const {
+        return de_start + strm.total_out;
+    }
+};
+
 class GzFile : public VirtualReadOnlyFile {
 public:
     bool m_file_ownership = false;
     GzFile() = delete;
-    explicit GzFile(photon::fs::IFile* gzip_file, photon::fs::IFile* index);
+    explicit GzFile(photon::fs::IFile* gzip_file, photon::fs::IFile* index,
+                    GzSpanCache *span_cache = nullptr);
     virtual ~GzFile(){
+        if (span_cache_) {
+            span_cache_->drop(file_id_);
+        }
+        for (auto c : cursors_) {
+            delete c;
+        }
         if (m_file_ownership) {
             delete gzip_file_;
             delete index_file_;
@@ -64,12 +179,27 @@ private:
     INDEX index_;
     bool inited_ = false;
     photon::mutex init_mutex_;
+    GzSpanCacheImpl *span_cache_ = nullptr;
+    uint64_t file_id_ = 0; // of the spans in span_cache_
+    // idle, most recently used first
+    std::list<InflateCursor *> cursors_;
+    photon::mutex cursors_mutex_;
+    static const size_t MAX_CURSORS = 4;
     int init();
     int parse_index();
+    ssize_t seek_index_no(INDEX &index, off_t offset);
     IndexEntry *seek_index(INDEX &index, off_t offset);
+    // read through span_cache_, starting from the span of index `i`
+    ssize_t pread_spans(size_t i, unsigned char *buf, size_t count, off_t offset);
+    GzSpanPtr get_span(size_t i, off_t begin, off_t end);
     ssize_t extract(const struct IndexEntry *found_idx,
                     off_t offset, unsigned char *buf, int len);
     int get_dict_by_index(const IndexEntry *found_idx, unsigned char *window_buf);
+    InflateCursor *new_cursor(const IndexEntry *found_idx);
+    // an idle cursor between found_idx and offset, nullptr if none
+    InflateCursor *take_cursor(const IndexEntry *found_idx, off_t offset);
+    void put_cursor(InflateCursor *cursor);
+    ssize_t inflate_cursor(InflateCursor *cursor, off_t offset, unsigned char *buf, int buf_len);
 };
 
 static int zlib_decompress(unsigned char *in, int in_len, unsigned char *out, int& out_len) {
@@ -93,9 +223,13 @@ static int zlib_decompress(unsigned char *in, int in_len, unsigned char *out, in
     return 0;
 }
 
-GzFile::GzFile(photon::fs::IFile* gzip_file, photon::fs::IFile* index) {
+GzFile::GzFile(photon::fs::IFile* gzip_file, photon::fs::IFile* index, GzSpanCache *span_cache) {
     gzip_file_ = gzip_file;
     index_file_ = index;
+    span_cache_ = static_cast<GzSpanCacheImpl *>(span_cache);
+    if (span_cache_) {
+        file_id_ = span_cache_->new_file_id();
+    }
 }
 int GzFile::fstat(struct stat *buf) {
     if (!inited_) {
@@ -205,21 +339,26 @@ int GzFile::init() {
 }
 
 static bool indx_compare(struct IndexEntry* i, struct IndexEntry* j) { return i->de_pos < j->de_pos; }
-IndexEntry *GzFile::seek_index(INDEX &index, off_t offset) {
+ssize_t GzFile::seek_index_no(INDEX &index, off_t offset) {
     if (index.size() == 0) {
-        return nullptr;
+        return -1;
     }
     struct IndexEntry tmp;
     tmp.de_pos = offset;
     INDEX::iterator iter = std::upper_bound(index.begin(), index.end(), &tmp, indx_compare);
     if (iter == index.end()) {
-        return index.at(index.size() - 1);
+        return index.size() - 1;
     }
-    int idx = iter - index.begin();
+    ssize_t idx = iter - index.begin();
     if (idx > 0) {
         idx --;
     }
-    return index.at(idx);
+    return idx;
+}
+
+IndexEntry *GzFile::seek_index(INDEX &index, off_t offset) {
+    auto idx = seek_index_no(index, offset);
+    return idx < 0 ? nullptr : index.at(idx);
 }
 
 int GzFile::get_dict_by_index(const IndexEntry *found_idx, unsigned char *dict_buf) {
@@ -255,45 +394,72 @@ int GzFile::get_dict_by_index(const IndexEntry *found_idx, unsigned char *dict_b
     return 0;
 }
 
-ssize_t GzFile::extract(
-        const struct IndexEntry *found_idx,
-        off_t offset,
-        unsigned char *buf, int buf_len) {
-#define CHUNK 65536
-    unsigned char inbuf[CHUNK];
+InflateCursor *GzFile::new_cursor(const IndexEntry *found_idx) {
     unsigned char dict[WINSIZE];
-    unsigned char discard[CHUNK];
-
-    z_stream strm;
-    memset(&strm, 0, sizeof(strm));
+    auto cursor = new InflateCursor;
+    std::unique_ptr<InflateCursor> guard(cursor);
+    z_stream &strm = cursor->strm;
 
     int ret = inflateInit2(&strm, -15);
     if (ret != Z_OK) {
-        LOG_ERRNO_RETURN(0, -1, "Fail to inflateInit2(&strm, -15)");
+        LOG_ERRNO_RETURN(0, nullptr, "Fail to inflateInit2(&strm, -15)");
     }
-    DEFER(inflateEnd(&strm));
 
     off_t start_pos = found_idx->en_pos - (found_idx->bits ? 1 : 0);
-    // ret = gzip_file_->lseek(start_pos, SEEK_SET);
-    if (ret == -1){
-        LOG_ERRNO_RETURN(0, -1, "Fail to gzip_file->lseek(`, SEEK_SET)", start_pos);
-    }
     if (found_idx->bits) {
         unsigned char tmp;
         if (gzip_file_->pread(&tmp, 1, start_pos) != 1) {
-            LOG_ERRNO_RETURN(0, -1, "Fail to gzip_file->pread");
+            LOG_ERRNO_RETURN(0, nullptr, "Fail to gzip_file->pread");
         }
         start_pos++;
         inflatePrime(&strm, found_idx->bits, tmp >> (8 - found_idx->bits));
     }
 
     if (get_dict_by_index(found_idx, dict) != 0) {
-        LOG_ERRNO_RETURN(0, -1, "Faild to get window data.");
+        LOG_ERRNO_RETURN(0, nullptr, "Faild to get window data.");
     }
     inflateSetDictionary(&strm, dict, WINSIZE);
-
-    offset -= found_idx->de_pos;
     strm.avail_in = 0;
+    cursor->de_start = found_idx->de_pos;
+    cursor->en_pos = start_pos;
+    return guard.release();
+}
+
+InflateCursor *GzFile::take_cursor(const IndexEntry *found_idx, off_t offset) {
+    SCOPED_LOCK(cursors_mutex_);
+    // the one nearest to offset, which is no farther than the index point
+    auto found = cursors_.end();
+    for (auto it = cursors_.begin(); it != cursors_.end(); ++it) {
+        auto pos = (*it)->de_pos();
+        if (pos >= found_idx->de_pos && pos <= offset &&
+            (found == cursors_.end() || pos > (*found)->de_pos())) {
+            found = it;
+        }
+    }
+    if (found == cursors_.end()) {
+        return nullptr;
+    }
+    auto cursor = *found;
+    cursors_.erase(found);
+    return cursor;
+}
+
+void GzFile::put_cursor(InflateCursor *cursor) {
+    SCOPED_LOCK(cursors_mutex_);
+    cursors_.push_front(cursor);
+    if (cursors_.size() > MAX_CURSORS) {
+        delete cursors_.back();
+        cursors_.pop_back();
+    }
+}
+
+ssize_t GzFile::inflate_cursor(InflateCursor *cursor, off_t offset, unsigned char *buf, int buf_len) {
+    const int CHUNK = InflateCursor::CHUNK;
+    unsigned char discard[CHUNK];
+    z_stream &strm = cursor->strm;
+    int ret = Z_OK;
+
+    offset -= cursor->de_pos();
     bool skip = true;
     do {
         if (offset == 0 && skip) {
@@ -313,16 +479,16 @@ ssize_t GzFile::extract(
 
         do {
             if (strm.avail_in == 0) {
-                ssize_t read_cnt = gzip_file_->pread(inbuf, CHUNK, start_pos);
+                ssize_t read_cnt = gzip_file_->pread(cursor->inbuf, CHUNK, cursor->en_pos);
                 if (read_cnt < 0 ) {
-                    LOG_ERRNO_RETURN(0, -1, "Fail to gzip_file->pread(input, CHUNK, `)", start_pos);
+                    LOG_ERRNO_RETURN(0, -1, "Fail to gzip_file->pread(input, CHUNK, `)", cursor->en_pos);
                 }
                 if (read_cnt == 0) {
-                    LOG_ERRNO_RETURN(Z_DATA_ERROR, -1, "Fail to gzip_file->pread(input, CHUNK, `)", start_pos);
+                    LOG_ERRNO_RETURN(Z_DATA_ERROR, -1, "Fail to gzip_file->pread(input, CHUNK, `)", cursor->en_pos);
                 }
-                start_pos += read_cnt;
+                cursor->en_pos += read_cnt;
                 strm.avail_in = read_cnt;
-                strm.next_in = inbuf;
+                strm.next_in = cursor->inbuf;
             }
             ret = inflate(&strm, Z_NO_FLUSH);
             if (ret == Z_STREAM_END) {
@@ -333,6 +499,7 @@ ssize_t GzFile::extract(
             }
         } while (strm.avail_out != 0);
         if (ret == Z_STREAM_END) {
+            cursor->ended = true;
             break;
         }
     } while (skip);
@@ -341,7 +508,27 @@ ssize_t GzFile::extract(
     }
     //LOG_DEBUG("offset:`,len:`,return:`", offset, len, len - strm.avail_out);
     return buf_len - strm.avail_out;
-#undef CHUNK
+}
+
+ssize_t GzFile::extract(
+        const struct IndexEntry *found_idx,
+        off_t offset,
+        unsigned char *buf, int buf_len) {
+    // sequential reads continue from where the previous one stopped
+    auto cursor = take_cursor(found_idx, offset);
+    if (cursor == nullptr) {
+        cursor = new_cursor(found_idx);
+        if (cursor == nullptr) {
+            return -1;
+        }
+    }
+    auto ret = inflate_cursor(cursor, offset, buf, buf_len);
+    if (ret < 0 || cursor->ended) {
+        delete cursor;
+    } else {
+        put_cursor(cursor);
+    }
+    return ret;
 }
 
 ssize_t GzFile::pread(void *buf, size_t count, off_t offset) {
@@ -354,21 +541,78 @@ ssize_t GzFile::pread(void *buf, size_t count, off_t offset) {
         LOG_ERRNO_RETURN(EINVAL, -1, "invalid offset: ` < 0", offset);
     }
 
-    struct IndexEntry * p = seek_index(index_, offset);
-    if (p == nullptr) {
+    auto idx = seek_index_no(index_, offset);
+    if (idx < 0) {
         LOG_ERRNO_RETURN(0, -1, "Failed to seek_index(,`)", offset);
     }
+    if (span_cache_) {
+        return pread_spans(idx, (unsigned char*)buf, count, offset);
+    }
+    return extract(index_[idx], offset, (unsigned char*)buf, count);
+}
 
-    return extract(p, offset, (unsigned char*)buf, count);
+GzSpanPtr GzFile::get_span(size_t i, off_t begin, off_t end) {
+    auto span = span_cache_->get(file_id_, i);
+    if (span) {
+        return span;
+    }
+    span = std::make_shared<GzSpan>();
+    span->len = end - begin;
+    span->data.reset(new unsigned char[span->len]);
+    auto ret = extract(index_[i], begin, span->data.get(), span->len);
+    if (ret != (ssize_t)span->len) {
+        LOG_ERROR_RETURN(EIO, nullptr, "Failed to inflate span `, {offset: `, length: `}, ret: `",
+                         i, begin, span->len, ret);
+    }
+    span_cache_->put(file_id_, i, span);
+    return span;
+}
+
+ssize_t GzFile::pread_spans(size_t i, unsigned char *buf, size_t count, off_t offset) {
+    off_t file_size = index_header_.uncompress_file_size;
+    if (offset >= file_size) {
+        return 0;
+    }
+    count = std::min(count, (size_t)(file_size - offset));
+    size_t done = 0;
+    while (done < count) {
+        while (i + 1 < index_.size() && index_[i + 1]->de_pos <= offset) {
+            i++;
+        }
+        off_t begin = index_[i]->de_pos;
+        off_t end = i + 1 < index_.size() ? index_[i + 1]->de_pos : file_size;
+        if (offset < begin || end <= offset) {
+            // not covered by spans of the index, as it is without the cache
+            auto ret = extract(index_[i], offset, buf + done, count - done);
+            if (ret < 0) {
+                return ret;
+            }
+            return done + ret;
+        }
+        auto span = get_span(i, begin, end);
+        if (!span) {
+            return -1;
+        }
+        size_t n = std::min(count - done, (size_t)(end - offset));
+        memcpy(buf + done, span->data.get() + (offset - begin), n);
+        done += n;
+        offset += n;
+    }
+    return done;
 }
 
 } // namespace FileSystem
 
-photon::fs::IFile* new_gzfile(photon::fs::IFile* gzip_file, photon::fs::IFile* index, bool ownership) {
+GzSpanCache *new_gz_span_cache(size_t capacity) {
+    return new FileSystem::GzSpanCacheImpl(capacity);
+}
+
+photon::fs::IFile* new_gzfile(photon::fs::IFile* gzip_file, photon::fs::IFile* index, bool ownership,
+                              GzSpanCache *span_cache) {
     if (!gzip_file || !index) {
         LOG_ERRNO_RETURN(0, nullptr, "invalid file ptr. file: `, `", gzip_file, index);
     }
-    auto rst = new FileSystem::GzFile(gzip_file, index);
+    auto rst = new FileSystem::GzFile(gzip_file, index, span_cache);
     rst->m_file_ownership = ownership;
     return rst;
 }
@@ -19,7 +19,24 @@
 #include "gzfile_index.h"
 
 
-extern photon::fs::IFile* new_gzfile(photon::fs::IFile* gzip_file, photon::fs::IFile* index, bool ownership = false);
+// An LRU cache of the data between index points, i.e. spans, inflated, shared by gzfiles.
+// Reads from a gzfile with it cost a copy from the span cached, instead of inflating from
+// the index point before.
+class GzSpanCache {
+public:
+    struct Stat {
+        uint64_t used; // bytes of spans cached
+        uint64_t hits;
+        uint64_t misses;
+    };
+    virtual ~GzSpanCache() {}
+    virtual void get_stat(Stat *stat) = 0;
+};
+GzSpanCache *new_gz_span_cache(size_t capacity);
+
+// span_cache is not owned, and must outlive the gzfile
+extern photon::fs::IFile* new_gzfile(photon::fs::IFile* gzip_file, photon::fs::IFile* index, bool ownership = false,
+                                     GzSpanCache *span_cache = nullptr);
 
 //chunksize:
 //1MB: 1048576
@@ -46,6 +46,8 @@ class GzIndexTest : public ::testing::Test {
 protected:
     static photon::fs::IFile *defile;
     static photon::fs::IFile *gzfile;
+    static photon::fs::IFile *span_gzfile;
+    static GzSpanCache *span_cache;
     static const size_t vsize = 10 << 20;
 
     virtual void SetUp() override {
@@ -68,9 +70,13 @@ protected:
             LOG_ERROR("failed to new_gzfile(...)");
             exit(-1);
         }
+        span_cache = new_gz_span_cache(4 << 20);
+        span_gzfile = new_gzfile(gzdata, gzindex, false, span_cache);
     }
 
     static void TearDownTestSuite() {
+        delete span_gzfile;
+        delete span_cache;
         delete gzdata;
         delete gzindex;
         delete defile;
@@ -190,6 +196,8 @@ private:
 photon::fs::IFileSystem *GzIndexTest::lfs = nullptr;
 photon::fs::IFile *GzIndexTest::defile = nullptr;
 photon::fs::IFile *GzIndexTest::gzfile = nullptr;
+photon::fs::IFile *GzIndexTest::span_gzfile = nullptr;
+GzSpanCache *GzIndexTest::span_cache = nullptr;
 photon::fs::IFile *GzIndexTest::gzdata = nullptr;
 photon::fs::IFile *GzIndexTest::gzindex = nullptr;
 const char *GzIndexTest::fn_defile = "/fdata";
@@ -366,6 +374,51 @@ TEST_F(GzIndexTest, pread_rand) {
     group_test_pread(t);
 }
 
+TEST_F(GzIndexTest, pread_sequential) {
+    // reads continue inflating from where the previous ones stopped, interleaved
+    std::vector<PreadTestCase> t;
+    off_t offset = 0, rand_offset = vsize / 2;
+    while (offset < (off_t)vsize) {
+        size_t count = 4096 + rand() % 65536;
+        t.push_back({offset, count, (ssize_t)std::min(count, vsize - offset)});
+        t.push_back({rand_offset, 512, 512});
+        offset += count;
+        rand_offset = (rand_offset + 100000 + rand() % 4096) % (vsize - 512);
+    }
+    group_test_pread(t);
+}
+
+TEST_F(GzIndexTest, pread_span_cache) {
+    std::vector<char> buf1(1 << 20), buf2(1 << 20);
+    GzSpanCache::Stat st;
+    span_cache->get_stat(&st);
+    auto misses = st.misses;
+    // the second read of a span is from the cache
+    for (int i = 0; i < 2; i++) {
+        EXPECT_EQ(4096, span_gzfile->pread(buf2.data(), 4096, 3000000));
+    }
+    span_cache->get_stat(&st);
+    EXPECT_EQ(misses + 1, st.misses);
+    EXPECT_LE(1UL, st.hits);
+    EXPECT_EQ(defile->pread(buf1.data(), 4096, 3000000), 4096);
+    EXPECT_EQ(0, memcmp(buf1.data(), buf2.data(), 4096));
+
+    // across spans and the end of file, with spans evicted
+    for (size_t i = 0; i < 1000; i++) {
+        off_t offset = rand() % (vsize + 4096);
+        size_t count = rand() % buf1.size();
+        auto ret1 = defile->pread(buf1.data(), count, offset);
+        auto ret2 = span_gzfile->pread(buf2.data(), count, offset);
+        ASSERT_EQ(ret1, ret2);
+        if (ret1 > 0) {
+            ASSERT_EQ(0, memcmp(buf1.data(), buf2.data(), ret1));
+        }
+    }
+    span_cache->get_stat(&st);
+    EXPECT_GE(4UL << 20, st.used);
+    EXPECT_EQ(span_gzfile->pread(buf2.data(), 10, -1), -1);
+}
+
 TEST_F(GzIndexTest, fstat) {
     size_t data_size = vsize;
     struct stat st;
@@ -36,16 +36,19 @@ public:
     const static uint8_t LZ4 = 1;
     const static uint8_t ZSTD = 2;
     const static uint32_t DEFAULT_BLOCK_SIZE = 4096; // 8192;//32768;
+    const static uint8_t CRC32C = 0;
+    const static uint8_t XXH64 = 1;
 
     uint32_t block_size = DEFAULT_BLOCK_SIZE;
     uint8_t algo = LZ4; // algorithm
     uint8_t level = 0;  // compress level
     uint8_t use_dict = 0;
-    uint8_t __padding_0 = 0;
+    uint8_t raw_block = 0; // store incompressible blocks uncompressed
     uint32_t reserved = 0;
     uint32_t dict_size = 0;
     uint8_t verify = 0;
-    uint8_t __padding_1[7] = {0};
+    uint8_t checksum = CRC32C; // algorithm of the per-block checksum, if verify
+    uint8_t __padding_1[6] = {0};
 
     CompressOptions(uint8_t type = LZ4, uint32_t block_size = DEFAULT_BLOCK_SIZE,
                     uint8_t verify = 0)
@@ -61,6 +64,7 @@ public:
     CompressOptions opt;
     bool overwrite_header;
     int workers;
+    bool compact_index = false; // write the index as jump table pages loaded on demand
 
     CompressArgs(const CompressOptions &opt, photon::fs::IFile *dict = nullptr,
                  unsigned char *dict_buf = nullptr, bool overwrite_header = false, int workers = 1)
@@ -17,6 +17,8 @@
 #include <stdint.h>
 #include <unistd.h>
 
+#include <string.h>
+
 #include <algorithm>
 #include <iostream>
 
@@ -31,6 +33,9 @@ extern "C" {
 #ifdef ENABLE_ISAL
 #include <crc.h>
 #endif
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #if (defined(__aarch64__) && defined(__ARM_FEATURE_CRC32))
 #define __builtin_ia32_crc32di __builtin_aarch64_crc32cx
@@ -47,6 +52,7 @@ namespace crc32 {
 #endif
 
 static uint32_t (*crc32c_func)(const uint8_t *, size_t, uint32_t) = nullptr;
+static uint32_t (*crc32c_copy_func)(uint8_t *, const uint8_t *, size_t, uint32_t) = nullptr;
 
 static void crc_init() __attribute__((constructor));
 static void crc_deinit() __attribute__((destructor));
@@ -82,6 +88,111 @@ static uint32_t crc32c_hw(const uint8_t *data, size_t nbytes, uint32_t crc) {
     return sum;
 }
 
+#if defined(__x86_64__)
+// Multi-stream CRC32C, see "Fast CRC Computation for iSCSI Polynomial Using CRC32
+// Instruction" by Intel. A crc32 instruction has a latency of 3 cycles but a throughput of
+// 1, so three independent streams are computed at once, and then merged by shifting the
+// partial crcs with carry-less multiplication.
+
+static const size_t CRC_LONG = 8192;  // bytes of each stream
+static const size_t CRC_SHORT = 256;
+static uint32_t crc_long_k[2], crc_short_k[2];
+
+// x^n mod P, bit-reflected
+static uint32_t crc32c_xpow(size_t n) {
+    uint32_t p = 0x80000000u;
+    while (n--) {
+        p = (p >> 1) ^ ((p & 1) ? 0x82F63B78u : 0);
+    }
+    return p;
+}
+
+static void crc32c_multi_init() {
+    // shifting a crc by n bytes is a multiplication by x^(8n), and the clmul + crc32
+    // sequence below contributes another x^33
+    crc_long_k[0] = crc32c_xpow(8 * CRC_LONG - 33);
+    crc_long_k[1] = crc32c_xpow(16 * CRC_LONG - 33);
+    crc_short_k[0] = crc32c_xpow(8 * CRC_SHORT - 33);
+    crc_short_k[1] = crc32c_xpow(16 * CRC_SHORT - 33);
+}
+
+__attribute__((target("sse4.2,pclmul"))) static inline uint32_t crc32c_shift(uint32_t crc,
+                                                                            uint32_t k) {
+    __m128i r = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc), _mm_cvtsi32_si128((int)k), 0);
+    return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(r));
+}
+
+static inline uint64_t load64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// with COPY, also copy data to dst while it is being read
+template <bool COPY>
+__attribute__((target("sse4.2,pclmul"))) static inline uint32_t
+crc32c_streams(uint8_t *&dst, const uint8_t *&data, size_t &nbytes, uint32_t crc, size_t len,
+               const uint32_t *k) {
+    while (nbytes >= 3 * len) {
+        uint64_t c0 = crc, c1 = 0, c2 = 0;
+        for (size_t i = 0; i < len; i += sizeof(uint64_t)) {
+            auto v0 = load64(data + i), v1 = load64(data + len + i), v2 = load64(data + 2 * len + i);
+            c0 = _mm_crc32_u64(c0, v0);
+            c1 = _mm_crc32_u64(c1, v1);
+            c2 = _mm_crc32_u64(c2, v2);
+            if (COPY) {
+                memcpy(dst + i, &v0, sizeof(v0));
+                memcpy(dst + len + i, &v1, sizeof(v1));
+                memcpy(dst + 2 * len + i, &v2, sizeof(v2));
+            }
+        }
+        crc = crc32c_shift((uint32_t)c0, k[1]) ^ crc32c_shift((uint32_t)c1, k[0]) ^ (uint32_t)c2;
+        data += 3 * len;
+        if (COPY) {
+            dst += 3 * len;
+        }
+        nbytes -= 3 * len;
+    }
+    return crc;
+}
+
+template <bool COPY>
+__attribute__((target("sse4.2,pclmul"))) static uint32_t
+crc32c_multi(uint8_t *dst, const uint8_t *data, size_t nbytes, uint32_t crc) {
+    crc = crc32c_streams<COPY>(dst, data, nbytes, crc, CRC_LONG, crc_long_k);
+    crc = crc32c_streams<COPY>(dst, data, nbytes, crc, CRC_SHORT, crc_short_k);
+    uint64_t sum = crc;
+    while (nbytes >= sizeof(uint64_t)) {
+        auto v = load64(data);
+        sum = _mm_crc32_u64(sum, v);
+        if (COPY) {
+            memcpy(dst, &v, sizeof(v));
+            dst += sizeof(v);
+        }
+        data += sizeof(uint64_t);
+        nbytes -= sizeof(uint64_t);
+    }
+    crc = (uint32_t)sum;
+    while (nbytes--) {
+        crc = _mm_crc32_u8(crc, *data);
+        if (COPY) {
+            *dst++ = *data;
+        }
+        data++;
+    }
+    return crc;
+}
+
+static uint32_t crc32c_hw_multi(const uint8_t *data, size_t nbytes, uint32_t crc) {
+    return crc32c_multi<false>(nullptr, data, nbytes, crc);
+}
+
+static uint32_t crc32c_copy_hw_multi(uint8_t *dst, const uint8_t *data, size_t nbytes,
+                                     uint32_t crc) {
+    return crc32c_multi<true>(dst, data, nbytes, crc);
+}
+#endif
+
 /* CRC32C routines, these use a different polynomial */
 /*****************************************************************/
 /*                                                               */
@@ -670,7 +781,14 @@ static uint32_t crc32c_isal(const uint8_t *data, size_t nbytes, uint32_t crc) {
 }
 #endif
 
+static uint32_t crc32c_copy_generic(uint8_t *dst, const uint8_t *data, size_t nbytes,
+                                    uint32_t crc) {
+    memcpy(dst, data, nbytes);
+    return crc32c_func(data, nbytes, crc);
+}
+
 static void crc_init() {
+    crc32c_copy_func = crc32c_copy_generic;
 #if ((defined(__x86_64__) || defined(__i386__)) && defined(__SSE4_2__))
     __builtin_cpu_init();
 #ifdef ENABLE_DSA
@@ -686,6 +804,14 @@ static void crc_init() {
         crc32c_func = crc32c_isal;
         return;
     }
+#endif
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+        crc32c_multi_init();
+        crc32c_func = crc32c_hw_multi;
+        crc32c_copy_func = crc32c_copy_hw_multi;
+        return;
+    }
 #endif
     if (__builtin_cpu_supports("sse4.2")) {
         crc32c_func = crc32c_hw;
@@ -706,6 +832,11 @@ uint32_t crc32c_extend(const void *data, size_t nbytes, uint32_t crc) {
     return crc32c_func(reinterpret_cast<const uint8_t *>(data), nbytes, crc);
 }
 
+uint32_t crc32c_copy_extend(void *dst, const void *data, size_t nbytes, uint32_t crc) {
+    return crc32c_copy_func(reinterpret_cast<uint8_t *>(dst),
+                            reinterpret_cast<const uint8_t *>(data), nbytes, crc);
+}
+
 uint32_t crc32c_extend(const std::string &text, uint32_t crc) {
     return crc32c_extend(text.data(), text.size(), crc);
 }
@@ -718,6 +849,84 @@ uint32_t crc32c(const std::string &text) {
     return crc32c_extend(text.data(), text.size(), 0);
 }
 
+// XXH64, see https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+static const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t xxh_rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    acc = xxh_rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t xxh64(const void *data, size_t nbytes, uint64_t seed) {
+    auto p = reinterpret_cast<const uint8_t *>(data);
+    auto end = p + nbytes;
+    uint64_t h;
+    if (nbytes >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        do {
+            v1 = xxh64_round(v1, xxh_read64(p));
+            v2 = xxh64_round(v2, xxh_read64(p + 8));
+            v3 = xxh64_round(v3, xxh_read64(p + 16));
+            v4 = xxh64_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = xxh_rotl64(v1, 1) + xxh_rotl64(v2, 7) + xxh_rotl64(v3, 12) + xxh_rotl64(v4, 18);
+        h = xxh64_merge_round(h, v1);
+        h = xxh64_merge_round(h, v2);
+        h = xxh64_merge_round(h, v3);
+        h = xxh64_merge_round(h, v4);
+    } else {
+        h = seed + XXH_PRIME64_5;
+    }
+    h += nbytes;
+    while (p + 8 <= end) {
+        h ^= xxh64_round(0, xxh_read64(p));
+        h = xxh_rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        h ^= (uint64_t)v * XXH_PRIME64_1;
+        h = xxh_rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = xxh_rotl64(h, 11) * XXH_PRIME64_1;
+        p++;
+    }
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
 namespace testing {
 
 uint32_t crc32c_slow(const void *data, size_t nbytes, uint32_t crc) {
@@ -728,6 +937,18 @@ uint32_t crc32c_fast(const void *data, size_t nbytes, uint32_t crc) {
     return crc32c_hw(reinterpret_cast<const uint8_t *>(data), nbytes, crc);
 }
 
+uint32_t crc32c_multi(const void *data, size_t nbytes, uint32_t crc) {
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("pclmul")) {
+        if (crc_long_k[0] == 0) {
+            crc32c_multi_init();
+        }
+        return crc32c_hw_multi(reinterpret_cast<const uint8_t *>(data), nbytes, crc);
+    }
+#endif
+    return crc32c_fast(data, nbytes, crc);
+}
+
 } // namespace testing
 
 } // namespace crc32
\ No newline at end of file
@@ -27,9 +27,15 @@ extern uint32_t crc32c(const std::string &text);
 extern uint32_t crc32c_extend(const void *data, size_t nbytes, uint32_t crc);
 extern uint32_t crc32c_extend(const std::string &text, uint32_t crc);
 
+// copy `nbytes` from `data` to `dst`, and return the crc extended with the copied data
+extern uint32_t crc32c_copy_extend(void *dst, const void *data, size_t nbytes, uint32_t crc);
+
+extern uint64_t xxh64(const void *data, size_t nbytes, uint64_t seed);
+
 namespace testing {
 extern uint32_t crc32c_slow(const void *data, size_t nbytes, uint32_t crc);
 extern uint32_t crc32c_fast(const void *data, size_t nbytes, uint32_t crc);
+extern uint32_t crc32c_multi(const void *data, size_t nbytes, uint32_t crc);
 } // namespace testing
 
 } // namespace crc32
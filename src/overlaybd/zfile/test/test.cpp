@@ -220,6 +220,102 @@ TEST_F(ZFileTest, verify_compression) {
     }
 }
 
+TEST_F(ZFileTest, raw_block) {
+    auto fn_src = "raw_block.data";
+    auto fn_zfile = "raw_block.zfile";
+    auto fn_dec = "raw_block.data.0";
+    unique_ptr<IFile> fsrc(lfs->open(fn_src, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    ASSERT_NE(fsrc, nullptr);
+    // interleave incompressible and compressible blocks, with an unaligned tail
+    for (int i = 0; i < 1024; i++) {
+        unsigned char data[4096]{};
+        if (i % 2 == 0) {
+            for (auto &c : data)
+                c = rand();
+        }
+        fsrc->write(data, sizeof(data));
+    }
+    unsigned char tail[1000];
+    for (auto &c : tail)
+        c = rand();
+    fsrc->write(tail, sizeof(tail));
+    struct stat _st;
+    ASSERT_EQ(fsrc->fstat(&_st), 0);
+
+    for (auto enable_crc = 0; enable_crc <= 1; enable_crc++) {
+        for (auto algorithm = 1; algorithm <= 2; algorithm++) {
+            unique_ptr<IFile> fdst(lfs->open(fn_zfile, O_CREAT | O_TRUNC | O_RDWR, 0644));
+            unique_ptr<IFile> fdec(lfs->open(fn_dec, O_CREAT | O_TRUNC | O_RDWR, 0644));
+            CompressOptions opt;
+            opt.algo = algorithm;
+            opt.verify = enable_crc;
+            opt.raw_block = 1;
+            CompressArgs args(opt);
+            fsrc->lseek(0, SEEK_SET);
+            EXPECT_EQ(zfile_compress(fsrc.get(), fdst.get(), &args), 0);
+            struct stat _zst;
+            fdst->fstat(&_zst);
+            EXPECT_LT(_zst.st_size, _st.st_size);
+            unique_ptr<IFile> fzfile(zfile_open_ro(fdst.get(), opt.verify));
+            ASSERT_NE(fzfile, nullptr);
+            seqread(fsrc.get(), fzfile.get());
+            randread(fsrc.get(), fzfile.get());
+            EXPECT_EQ(zfile_decompress(fdst.get(), fdec.get()), 0);
+            char data0[4096], data1[4096];
+            for (off_t i = 0; i < _st.st_size; i += sizeof(data0)) {
+                auto n = fsrc->pread(data0, sizeof(data0), i);
+                EXPECT_EQ(fdec->pread(data1, sizeof(data1), i), n);
+                EXPECT_EQ(memcmp(data0, data1, n), 0);
+            }
+            if (enable_crc) {
+                EXPECT_EQ(zfile_validation_check(fdst.get()), 0);
+            }
+        }
+    }
+}
+
+TEST_F(ZFileTest, map_ranges) {
+    auto fn_src = "map_ranges.data";
+    auto fn_zfile = "map_ranges.zfile";
+    unique_ptr<IFile> fsrc(lfs->open(fn_src, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    ASSERT_NE(fsrc, nullptr);
+    randwrite(fsrc.get(), 64);
+    struct stat _st;
+    ASSERT_EQ(fsrc->fstat(&_st), 0);
+    unique_ptr<IFile> fdst(lfs->open(fn_zfile, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    CompressOptions opt;
+    opt.verify = 1;
+    CompressArgs args(opt);
+    fsrc->lseek(0, SEEK_SET);
+    ASSERT_EQ(zfile_compress(fsrc.get(), fdst.get(), &args), 0);
+    struct stat _zst;
+    ASSERT_EQ(fdst->fstat(&_zst), 0);
+    unique_ptr<IFile> fzfile(zfile_open_ro(fdst.get(), opt.verify));
+    ASSERT_NE(fzfile, nullptr);
+
+    off_t bs = opt.block_size;
+    vector<pair<off_t, size_t>> ranges{{0, (size_t)_st.st_size}, {0, (size_t)bs},
+                                       {bs, 1}, {bs + 10, (size_t)bs - 10}, {bs, (size_t)bs + 1},
+                                       {_st.st_size, 10}, {bs, 0}};
+    ASSERT_EQ(zfile_map_ranges(fzfile.get(), ranges), 0);
+    // the whole file maps to all the compressed blocks, in the data of the zfile
+    EXPECT_GT(ranges[0].first, 0);
+    EXPECT_LT(ranges[0].first + ranges[0].second, (size_t)_zst.st_size);
+    // ranges of a block map to the same one, right after the block before it
+    EXPECT_EQ(ranges[0].first, ranges[1].first);
+    EXPECT_EQ(ranges[1].first + (off_t)ranges[1].second, ranges[2].first);
+    EXPECT_EQ(ranges[2], ranges[3]);
+    EXPECT_EQ(ranges[2].first, ranges[4].first);
+    EXPECT_GT(ranges[4].second, ranges[2].second);
+    // nothing for those out of the file or empty
+    EXPECT_EQ(make_pair((off_t)0, (size_t)0), ranges[5]);
+    EXPECT_EQ(make_pair((off_t)0, (size_t)0), ranges[6]);
+
+    ranges = {{0, (size_t)bs}};
+    EXPECT_EQ(zfile_map_ranges(fsrc.get(), ranges), -1);
+    EXPECT_EQ(errno, EINVAL);
+}
+
 TEST_F(ZFileTest, validation_check) {
     // log_output_level = 1;
     auto fn_src = "verify.data";
@@ -252,6 +348,153 @@ TEST_F(ZFileTest, validation_check) {
     EXPECT_NE(zfile_validation_check(fdst.get()), 0);
 }
 
+TEST_F(ZFileTest, parallel_compression) {
+    auto fn_src = "verify.data";
+    auto fn_zfile = "verify.zfile";
+    auto fn_zfile_mp = "verify.zfile.mp";
+    auto fn_dec = "verify.data.mp";
+    unique_ptr<IFile> fsrc(lfs->open(fn_src, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    ASSERT_NE(fsrc, nullptr);
+    randwrite(fsrc.get(), write_times);
+    unsigned char tail[1000]{};
+    fsrc->write(tail, sizeof(tail));
+    struct stat _st;
+    ASSERT_EQ(fsrc->fstat(&_st), 0);
+
+    unique_ptr<IFile> fdst(lfs->open(fn_zfile, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    unique_ptr<IFile> fdst_mp(lfs->open(fn_zfile_mp, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    unique_ptr<IFile> fdec(lfs->open(fn_dec, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    CompressOptions opt;
+    opt.verify = 1;
+    CompressArgs args(opt);
+    fsrc->lseek(0, SEEK_SET);
+    EXPECT_EQ(zfile_compress(fsrc.get(), fdst.get(), &args), 0);
+    args.workers = 4;
+    fsrc->lseek(0, SEEK_SET);
+    EXPECT_EQ(zfile_compress(fsrc.get(), fdst_mp.get(), &args), 0);
+
+    // parallel compression must produce the very same blob
+    struct stat _zst, _zst_mp;
+    fdst->fstat(&_zst);
+    fdst_mp->fstat(&_zst_mp);
+    ASSERT_EQ(_zst.st_size, _zst_mp.st_size);
+    char data0[16384], data1[16384];
+    for (off_t i = 0; i < _zst.st_size; i += sizeof(data0)) {
+        auto n = fdst->pread(data0, sizeof(data0), i);
+        EXPECT_EQ(fdst_mp->pread(data1, sizeof(data1), i), n);
+        EXPECT_EQ(memcmp(data0, data1, n), 0);
+    }
+
+    EXPECT_EQ(zfile_validation_check(fdst_mp.get(), 4), 0);
+    EXPECT_EQ(zfile_decompress(fdst_mp.get(), fdec.get(), 4), 0);
+    for (off_t i = 0; i < _st.st_size; i += sizeof(data0)) {
+        auto n = fsrc->pread(data0, sizeof(data0), i);
+        EXPECT_EQ(fdec->pread(data1, sizeof(data1), i), n);
+        EXPECT_EQ(memcmp(data0, data1, n), 0);
+    }
+
+    char error_data[8192]{};
+    fdst_mp->pwrite(error_data, 8192, 8192);
+    EXPECT_NE(zfile_validation_check(fdst_mp.get(), 4), 0);
+}
+
+class FadviseCountFile : public ForwardFile {
+public:
+    int count = 0;
+    FadviseCountFile(IFile *file) : ForwardFile(file) {
+    }
+    int fadvise(off_t offset, off_t len, int advice) override {
+        count++;
+        return m_file->fadvise(offset, len, advice);
+    }
+};
+
+TEST_F(ZFileTest, compact_index) {
+    auto fn_src = "compact_index.data";
+    auto fn_zfile = "compact_index.zfile";
+    auto fn_zfile_compact = "compact_index.zfile.compact";
+    auto fn_dec = "compact_index.data.0";
+    unique_ptr<IFile> fsrc(lfs->open(fn_src, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    ASSERT_NE(fsrc, nullptr);
+    randwrite(fsrc.get(), write_times);
+    struct stat _st;
+    ASSERT_EQ(fsrc->fstat(&_st), 0);
+
+    unique_ptr<IFile> fdst(lfs->open(fn_zfile, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    unique_ptr<IFile> fdst_compact(lfs->open(fn_zfile_compact, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    unique_ptr<IFile> fdec(lfs->open(fn_dec, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    CompressOptions opt;
+    opt.verify = 1;
+    CompressArgs args(opt);
+    fsrc->lseek(0, SEEK_SET);
+    EXPECT_EQ(zfile_compress(fsrc.get(), fdst.get(), &args), 0);
+    args.compact_index = true;
+    fsrc->lseek(0, SEEK_SET);
+    EXPECT_EQ(zfile_compress(fsrc.get(), fdst_compact.get(), &args), 0);
+
+    unique_ptr<IFile> fzfile(zfile_open_ro(fdst.get(), true));
+    unique_ptr<IFile> fzfile_compact(zfile_open_ro(fdst_compact.get(), true));
+    ASSERT_NE(fzfile, nullptr);
+    ASSERT_NE(fzfile_compact, nullptr);
+    auto &jt = ((CompressionFile *)fzfile.get())->m_jump_table;
+    auto &jt_compact = ((CompressionFile *)fzfile_compact.get())->m_jump_table;
+    auto loaded_pages = [&]() {
+        return std::count_if(jt_compact.pages.begin(), jt_compact.pages.end(),
+                             [](const std::unique_ptr<unsigned char[]> &p) { return !!p; });
+    };
+    ASSERT_EQ(jt.size(), jt_compact.size());
+    ASSERT_GT(jt_compact.pages.size(), 2UL);
+    // only the last page is loaded at open, the others on first access
+    EXPECT_EQ(loaded_pages(), 1);
+    char data0[16384], data1[16384];
+    fsrc->pread(data0, sizeof(data0), 0);
+    fzfile_compact->pread(data1, sizeof(data1), 0);
+    EXPECT_EQ(memcmp(data0, data1, sizeof(data0)), 0);
+    EXPECT_EQ(loaded_pages(), 2);
+
+    seqread(fsrc.get(), fzfile_compact.get());
+    EXPECT_EQ(loaded_pages(), (ssize_t)jt_compact.pages.size());
+    for (size_t i = 0; i < jt.size(); i++) {
+        ASSERT_EQ(jt[i], jt_compact[i]);
+    }
+    randread(fsrc.get(), fzfile_compact.get());
+
+    EXPECT_EQ(zfile_validation_check(fdst_compact.get(), 4), 0);
+    EXPECT_EQ(zfile_decompress(fdst_compact.get(), fdec.get(), 4), 0);
+    for (off_t i = 0; i < _st.st_size; i += sizeof(data0)) {
+        auto n = fsrc->pread(data0, sizeof(data0), i);
+        EXPECT_EQ(fdec->pread(data1, sizeof(data1), i), n);
+        EXPECT_EQ(memcmp(data0, data1, n), 0);
+    }
+}
+
+TEST_F(ZFileTest, readahead) {
+    auto fn_src = "verify.data";
+    auto fn_zfile = "verify.zfile";
+    unique_ptr<IFile> fsrc(lfs->open(fn_src, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    ASSERT_NE(fsrc, nullptr);
+    randwrite(fsrc.get(), 1024);
+    unique_ptr<IFile> fdst(lfs->open(fn_zfile, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    CompressOptions opt;
+    opt.verify = 1;
+    CompressArgs args(opt);
+    fsrc->lseek(0, SEEK_SET);
+    ASSERT_EQ(zfile_compress(fsrc.get(), fdst.get(), &args), 0);
+
+    auto counter = new FadviseCountFile(fdst.get());
+    unique_ptr<IFile> fzfile(zfile_open_ro(counter, true, true));
+    ASSERT_NE(fzfile, nullptr);
+    char data0[4096], data1[4096];
+    fsrc->pread(data0, sizeof(data0), 0);
+    fzfile->pread(data1, sizeof(data1), 0);
+    EXPECT_EQ(memcmp(data0, data1, sizeof(data0)), 0);
+    // a single read is not a stream
+    EXPECT_EQ(counter->count, 0);
+    seqread(fsrc.get(), fzfile.get());
+    EXPECT_GT(counter->count, 0);
+    randread(fsrc.get(), fzfile.get());
+}
+
 TEST_F(ZFileTest, ht_check) {
     // log_output_level = 1;
     auto fn_src = "verify.data";
@@ -302,6 +545,58 @@ TEST_F(ZFileTest, dsa) {
     ASSERT_EQ(ret, 0);
 }
 
+TEST_F(ZFileTest, crc32c_multi) {
+    vector<unsigned char> buf(256 << 10), copy(buf.size() + 8);
+    for (auto &c : buf)
+        c = rand();
+    for (auto i = 0; i < 3000; i++) {
+        size_t offset = rand() % 8;
+        size_t len = (i < 1000) ? i : rand() % (buf.size() - offset);
+        uint32_t seed = rand();
+        auto expected = crc32::testing::crc32c_slow(buf.data() + offset, len, seed);
+        ASSERT_EQ(crc32::testing::crc32c_multi(buf.data() + offset, len, seed), expected);
+        ASSERT_EQ(crc32::crc32c_extend(buf.data() + offset, len, seed), expected);
+        ASSERT_EQ(crc32::crc32c_copy_extend(copy.data() + 1, buf.data() + offset, len, seed),
+                  expected);
+        ASSERT_EQ(memcmp(copy.data() + 1, buf.data() + offset, len), 0);
+    }
+    EXPECT_EQ(crc32::xxh64("", 0, 0), 0xEF46DB3751D8E999ULL);
+    EXPECT_EQ(crc32::xxh64("a", 1, 0), 0xD24EC4F1A98C6E5BULL);
+    EXPECT_EQ(crc32::xxh64("xxhash", 6, 0), 0x32DD38952C4BC720ULL);
+    EXPECT_EQ(crc32::xxh64("xxhash", 6, 20141025), 0xB559B98D844E0635ULL);
+}
+
+TEST_F(ZFileTest, xxh64_checksum) {
+    auto fn_src = "xxh64.data";
+    auto fn_zfile = "xxh64.zfile";
+    unique_ptr<IFile> fsrc(lfs->open(fn_src, O_CREAT | O_TRUNC | O_RDWR, 0644));
+    ASSERT_NE(fsrc, nullptr);
+    randwrite(fsrc.get(), write_times);
+    unsigned char tail[1000]{};
+    fsrc->write(tail, sizeof(tail));
+    for (auto algorithm = 1; algorithm <= 2; algorithm++) {
+        unique_ptr<IFile> fdst(lfs->open(fn_zfile, O_CREAT | O_TRUNC | O_RDWR, 0644));
+        CompressOptions opt;
+        opt.algo = algorithm;
+        opt.verify = 1;
+        opt.checksum = CompressOptions::XXH64;
+        CompressArgs args(opt);
+        fsrc->lseek(0, SEEK_SET);
+        EXPECT_EQ(zfile_compress(fsrc.get(), fdst.get(), &args), 0);
+        unique_ptr<IFile> fzfile(zfile_open_ro(fdst.get(), true));
+        ASSERT_NE(fzfile, nullptr);
+        seqread(fsrc.get(), fzfile.get());
+        randread(fsrc.get(), fzfile.get());
+        EXPECT_EQ(zfile_validation_check(fdst.get()), 0);
+        EXPECT_EQ(zfile_validation_check(fdst.get(), 4), 0);
+
+        char error_data[8192]{};
+        fdst->pwrite(error_data, 8192, 8192);
+        EXPECT_NE(zfile_validation_check(fdst.get()), 0);
+        EXPECT_NE(zfile_validation_check(fdst.get(), 4), 0);
+    }
+}
+
 TEST_F(ZFileTest, verify_builder) {
     auto fn_src = "verify.data";
     auto fn_zfile = "verify.zfile";
@@ -23,6 +23,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <photon/common/io-alloc.h>
 #include <photon/common/utility.h>
 #include <photon/common/uuid.h>
 #include <photon/fs/virtual-file.h>
@@ -46,16 +47,77 @@ uint64_t zfile_blk_cnt = 0;
 
 namespace ZFile {
 
+static std::atomic<IOAlloc *> g_io_alloc{nullptr};
+
+void zfile_set_io_alloc(IOAlloc *alloc) {
+    g_io_alloc = alloc;
+}
+
+static unsigned char *alloc_batch_buf(IOAlloc *alloc, size_t size) {
+    if (alloc) {
+        return (unsigned char *)alloc->alloc(size);
+    }
+    return new unsigned char[size];
+}
+
+static void free_batch_buf(IOAlloc *alloc, unsigned char *buf) {
+    if (buf == nullptr) {
+        return;
+    }
+    if (alloc) {
+        alloc->dealloc(buf);
+    } else {
+        delete[] buf;
+    }
+}
+
 const static size_t BUF_SIZE = 512;
 const static uint64_t MAX_ZFILE_INDEX_SIZE = 1000000000;
 const static uint32_t NOI_WELL_KNOWN_PRIME = 100007;
 const static uint8_t FLAG_VALID_FALSE = 0;
 const static uint8_t FLAG_VALID_TRUE = 1;
 const static uint8_t FLAG_VALID_CRC_CHECK = 2;
+// readahead window of compressed data for sequential reads
+const static size_t RA_MIN_WINDOW = 128UL << 10;
+const static size_t RA_MAX_WINDOW = 8UL << 20;
+const static size_t RA_INIT_WINDOW = 512UL << 10;
+const static int RA_SEQ_THRESHOLD = 2; // consecutive reads to be taken as a stream
 
 inline uint32_t crc32c_salt(void *buf, size_t size) {
     return crc32::crc32c_extend(buf, size, NOI_WELL_KNOWN_PRIME);
 }
+
+// size of the checksum following each compressed block
+inline size_t checksum_size(const CompressOptions &opt) {
+    if (!opt.verify) {
+        return 0;
+    }
+    return opt.checksum == CompressOptions::XXH64 ? sizeof(uint64_t) : sizeof(uint32_t);
+}
+
+// the checksum of a compressed block, whose lower checksum_size() bytes are stored after it
+inline uint64_t block_checksum(const CompressOptions &opt, const void *buf, size_t size) {
+    if (opt.checksum == CompressOptions::XXH64) {
+        return crc32::xxh64(buf, size, NOI_WELL_KNOWN_PRIME);
+    }
+    return crc32c_salt((void *)buf, size);
+}
+
+// copy a compressed block to `dst`, checksumming it on the way
+inline uint64_t copy_block_checksum(const CompressOptions &opt, void *dst, const void *buf,
+                                    size_t size) {
+    if (opt.checksum == CompressOptions::XXH64) {
+        memcpy(dst, buf, size);
+        return block_checksum(opt, dst, size);
+    }
+    return crc32::crc32c_copy_extend(dst, buf, size, NOI_WELL_KNOWN_PRIME);
+}
+
+inline uint64_t stored_checksum(const CompressOptions &opt, const void *buf) {
+    uint64_t checksum = 0;
+    memcpy(&checksum, buf, checksum_size(opt));
+    return checksum;
+}
 /* ZFile Format:
     | Header (512B) | dict (optional) | compressed block 0 [checksum0] | compressed block 1
    [checksum1] | ... | compressed block N [checksumN] | jmp_table(index) | Trailer (512 B)|
@@ -93,6 +155,7 @@ public:
         static const uint32_t FLAG_SHIFT_HEADER_OVERWRITE = 3; // overwrite trailer info to header
         static const uint32_t FLAG_SHIFT_CALC_DIGEST = 4; // caculate digest for zfile header/trailer and jumptable
         static const uint32_t FLAG_SHIFT_IDX_COMP = 5; // compress zfile index(jumptable)
+        static const uint32_t FLAG_SHIFT_IDX_COMPACT = 6; // index stored as pages of jumptable
 
         uint32_t get_flag_bit(uint32_t shift) const {
             return flags & (1 << shift);
@@ -124,6 +187,9 @@ public:
         bool is_digest_enabled() {
             return get_flag_bit(FLAG_SHIFT_CALC_DIGEST);
         }
+        bool is_index_compact() const {
+            return get_flag_bit(FLAG_SHIFT_IDX_COMPACT);
+        }
         bool is_valid() {
             if (!is_digest_enabled()) {
                 LOG_WARN("digest not found in current zfile.");
@@ -166,6 +232,10 @@ public:
             set_flag_bit(FLAG_SHIFT_IDX_COMP);
         }
 
+        void set_index_compact() {
+            set_flag_bit(FLAG_SHIFT_IDX_COMPACT);
+        }
+
         void set_compress_option(const CompressOptions &opt) {
             this->opt = opt;
         }
@@ -182,60 +252,157 @@ public:
     } /* __attribute__((packed)) */;
     static_assert(sizeof(HeaderTrailer) == 96, "sizeof(HeaderTrailer) != 96");
 
+    // Offsets of the blocks, grouped into pages of PAGE_ENTRIES entries. Each page is
+    //   | uinttype deltas[PAGE_ENTRIES] | uint64_t partial_offset[PAGE_ENTRIES / group_size] | crc |
+    // which is also the on-disk form of a compact index, so that its pages can be loaded
+    // lazily on first access instead of expanding the whole index at open time.
     struct JumpTable {
         typedef uint16_t uinttype;
         static const uinttype uinttype_max = UINT16_MAX;
+        static const uint32_t PAGE_SHIFT = 12;
+        static const size_t PAGE_ENTRIES = 1UL << PAGE_SHIFT;
+
         int group_size;
+        int group_shift;
+        size_t n_entries = 0;
+        size_t page_bytes = 0;
+        std::vector<std::unique_ptr<unsigned char[]>> pages;
 
-        std::vector<uint64_t> partial_offset;
-        std::vector<uinttype> deltas; // partial sum in each page;
+        // where the pages of a lazily loaded compact index are
+        IFile *m_file = nullptr;
+        off_t m_page_offset = 0;
 
         off_t operator[](size_t idx) const {
             // return BASE  + deltas[ idx % (page_size) ]
-            off_t part_idx = idx / group_size;
-            off_t inner_idx = idx & (group_size - 1);
-            auto part_offset = partial_offset[part_idx];
-            if (inner_idx) {
-                return part_offset + deltas[idx];
-            }
-            return part_offset;
+            auto page = pages[idx >> PAGE_SHIFT].get();
+            auto inner_idx = idx & (PAGE_ENTRIES - 1);
+            auto deltas = (const uinttype *)page;
+            auto partial_offset = (const uint64_t *)(page + PAGE_ENTRIES * sizeof(uinttype));
+            return partial_offset[inner_idx >> group_shift] + deltas[inner_idx];
         }
 
         size_t size() const {
-            return deltas.size();
+            return n_entries;
         }
 
-        int build(const uint32_t *ibuf, size_t n, off_t offset_begin, uint32_t block_size,
-                  bool enable_crc) {
-            partial_offset.clear();
-            deltas.clear();
+        static size_t get_page_bytes(uint32_t block_size) {
+            return PAGE_ENTRIES * sizeof(uinttype) +
+                   PAGE_ENTRIES / ((uinttype_max + 1) / block_size) * sizeof(uint64_t) +
+                   sizeof(uint32_t);
+        }
+
+        // bytes of a compact index of `n` blocks
+        static size_t get_index_bytes(size_t n, uint32_t block_size) {
+            return (n + PAGE_ENTRIES) / PAGE_ENTRIES * get_page_bytes(block_size);
+        }
+
+        void init(size_t n, uint32_t block_size) {
             group_size = (uinttype_max + 1) / block_size;
-            partial_offset.reserve(n / group_size + 1);
-            deltas.reserve(n + 1);
-            auto raw_offset = offset_begin;
-            partial_offset.push_back(raw_offset);
-            deltas.push_back(0);
-            size_t min_blksize = (enable_crc ? sizeof(uint32_t) : 0);
-            for (ssize_t i = 1; i < (ssize_t)n + 1; i++) {
-                if (ibuf[i - 1] <= min_blksize) {
-                    LOG_ERRNO_RETURN(EIO, -1, "unexpected block size(id: `):", i - 1, ibuf[i - 1]);
+            group_shift = __builtin_ctz(group_size);
+            n_entries = n + 1;
+            page_bytes = get_page_bytes(block_size);
+            pages.clear();
+            pages.resize((n_entries + PAGE_ENTRIES - 1) / PAGE_ENTRIES);
+        }
+
+        int build(const uint32_t *ibuf, size_t n, off_t offset_begin, uint32_t block_size,
+                  size_t min_blksize) {
+            init(n, block_size);
+            for (auto &page : pages) {
+                page.reset(new unsigned char[page_bytes]{});
+            }
+            uint64_t raw_offset = offset_begin, part_offset = offset_begin;
+            for (size_t i = 0; i < n + 1; i++) {
+                auto page = pages[i >> PAGE_SHIFT].get();
+                auto inner_idx = i & (PAGE_ENTRIES - 1);
+                auto deltas = (uinttype *)page;
+                auto partial_offset = (uint64_t *)(page + PAGE_ENTRIES * sizeof(uinttype));
+                if (i > 0) {
+                    if (ibuf[i - 1] <= min_blksize) {
+                        LOG_ERRNO_RETURN(EIO, -1, "unexpected block size(id: `):", i - 1, ibuf[i - 1]);
+                    }
+                    raw_offset += ibuf[i - 1];
                 }
-                raw_offset += ibuf[i - 1];
                 if ((i % group_size) == 0) {
-                    partial_offset.push_back(raw_offset);
-                    deltas.push_back(0);
+                    part_offset = raw_offset;
+                    partial_offset[inner_idx >> group_shift] = part_offset;
                     continue;
                 }
-                if ((uint64_t)deltas[i - 1] + ibuf[i - 1] >= (uint64_t)uinttype_max) {
+                if (raw_offset - part_offset >= (uint64_t)uinttype_max) {
                     LOG_ERROR_RETURN(ERANGE, -1, "build block[`] length failed `+` > ` (exceed)",
-                                     i - 1, deltas[i - 1], ibuf[i - 1], (uint64_t)uinttype_max);
+                                     i - 1, deltas[inner_idx - 1], ibuf[i - 1],
+                                     (uint64_t)uinttype_max);
+                }
+                deltas[inner_idx] = raw_offset - part_offset;
+            }
+            LOG_INFO("create jump table done. {page_count: `, entry_count: `, size: `}",
+                     pages.size(), n_entries, pages.size() * page_bytes);
+            return 0;
+        }
+
+        // write the table as a compact index, and return the crc32c of it in `crc`
+        ssize_t write(IFile *dest, uint32_t *crc) {
+            uint32_t index_crc = 0;
+            for (auto &page : pages) {
+                auto page_crc = (uint32_t *)(page.get() + page_bytes - sizeof(uint32_t));
+                *page_crc = crc32::crc32c(page.get(), page_bytes - sizeof(uint32_t));
+                if (dest->write(page.get(), page_bytes) != (ssize_t)page_bytes) {
+                    LOG_ERRNO_RETURN(0, -1, "failed to write index page.");
+                }
+                index_crc = crc32::crc32c_extend(page.get(), page_bytes, index_crc);
+            }
+            *crc = index_crc;
+            return pages.size() * page_bytes;
+        }
+
+        // open a compact index of `n` blocks, whose pages are loaded on first access
+        int load(IFile *file, off_t index_offset, size_t n, uint32_t block_size) {
+            init(n, block_size);
+            m_file = file;
+            m_page_offset = index_offset;
+            // the last entry marks the end of data, keep it at hand
+            if (ensure(n, n) != 0) {
+                LOG_ERRNO_RETURN(0, -1, "failed to load the last index page");
+            }
+            LOG_INFO("open compact jump table. {page_count: `, entry_count: `, size: `}",
+                     pages.size(), n_entries, pages.size() * page_bytes);
+            return 0;
+        }
+
+        int load_page(size_t idx) {
+            auto buf = std::unique_ptr<unsigned char[]>(new unsigned char[page_bytes]);
+            off_t offset = m_page_offset + idx * page_bytes;
+            int retry = 1;
+        again:
+            if (m_file->pread(buf.get(), page_bytes, offset) != (ssize_t)page_bytes) {
+                LOG_ERRNO_RETURN(0, -1, "failed to read index page {idx: `, offset: `}", idx,
+                                 offset);
+            }
+            auto crc = crc32::crc32c(buf.get(), page_bytes - sizeof(uint32_t));
+            auto expected = *(uint32_t *)(buf.get() + page_bytes - sizeof(uint32_t));
+            if (crc != expected) {
+                if (retry--) {
+                    LOG_WARN("checksum of index page ` is incorrect, trim and reload.", idx);
+                    m_file->trim(offset, page_bytes);
+                    goto again;
+                }
+                LOG_ERROR_RETURN(EIO, -1, "checksum of index page ` is incorrect. {got: `, expected: `}",
+                                 idx, HEX(crc).width(8), HEX(expected).width(8));
+            }
+            // another thread may have loaded it meanwhile
+            if (!pages[idx]) {
+                pages[idx] = std::move(buf);
+            }
+            return 0;
+        }
+
+        // make sure entries [begin, end] are loaded
+        int ensure(size_t begin, size_t end) {
+            for (size_t i = begin >> PAGE_SHIFT; i <= (end >> PAGE_SHIFT); i++) {
+                if (!pages[i] && load_page(i) != 0) {
+                    return -1;
                 }
-                deltas.push_back(deltas[i - 1] + ibuf[i - 1]);
             }
-            LOG_INFO("create jump table done. {part_count: `, deltas_count: `, size: `}",
-                     partial_offset.size(), deltas.size(),
-                     deltas.size() * sizeof(deltas[0]) +
-                         partial_offset.size() * sizeof(partial_offset[0]));
             return 0;
         }
 
@@ -249,12 +416,79 @@ public:
 
     CompressionFile(IFile *file, bool ownership) : m_file(file), m_ownership(ownership){};
 
+    // sequential read detection and readahead state
+    off_t m_ra_next = -1;   // raw offset a sequential read is expected at
+    int m_ra_seq = 0;       // number of consecutive sequential reads
+    off_t m_ra_read = 0;    // compressed offset consumed by the stream
+    off_t m_ra_end = 0;     // compressed offset readahead has been issued up to
+    size_t m_ra_window = RA_INIT_WINDOW;
+    bool m_ra_running = false;
+    bool m_ra_disabled = false;
+    photon::join_handle *m_ra_th = nullptr;
+
     ~CompressionFile() {
+        if (m_ra_th) {
+            photon::thread_join(m_ra_th);
+        }
         if (m_ownership) {
             delete m_file;
         }
     }
 
+    void do_readahead(off_t offset, size_t count) {
+        LOG_DEBUG("zfile readahead {offset: `, count: `}", offset, count);
+        if (m_file->fadvise(offset, count, POSIX_FADV_WILLNEED) < 0) {
+            if (errno == ENOSYS) {
+                LOG_INFO("readahead is not supported by the underlay file, disable it");
+                m_ra_disabled = true;
+            } else {
+                LOG_WARN("readahead {offset: `, count: `} failed, `", offset, count, ERRNO());
+            }
+        }
+        m_ra_running = false;
+    }
+
+    // Detect sequential streams and keep the next m_ra_window bytes of compressed data
+    // being fetched in background. The window grows when reads catch up with readahead
+    // and shrinks when a stream stops before consuming what was fetched for it.
+    void readahead(off_t offset, size_t count) {
+        if (m_ra_disabled) {
+            return;
+        }
+        if (offset != m_ra_next) {
+            if (m_ra_seq >= RA_SEQ_THRESHOLD && m_ra_end > m_ra_read) {
+                m_ra_window = std::max(m_ra_window / 2, RA_MIN_WINDOW);
+            }
+            m_ra_seq = 0;
+            m_ra_end = 0;
+        }
+        m_ra_next = offset + count;
+        if (++m_ra_seq < RA_SEQ_THRESHOLD) {
+            return;
+        }
+        size_t nblocks = m_jump_table.size() - 1;
+        size_t end_idx = std::min((offset + count - 1) / m_ht.opt.block_size + 1, nblocks);
+        m_ra_read = m_jump_table[end_idx];
+        if (m_ra_end != 0 && m_ra_read > m_ra_end) {
+            m_ra_window = std::min(m_ra_window * 2, RA_MAX_WINDOW);
+        }
+        if (m_ra_running || m_ra_end >= m_ra_read + (off_t)m_ra_window / 2) {
+            return;
+        }
+        off_t begin = std::max(m_ra_end, m_ra_read);
+        off_t end = std::min(m_ra_read + (off_t)m_ra_window, m_jump_table[nblocks]);
+        if (begin >= end) {
+            return;
+        }
+        if (m_ra_th) {
+            photon::thread_join(m_ra_th);
+        }
+        m_ra_end = end;
+        m_ra_running = true;
+        m_ra_th = photon::thread_enable_join(
+            photon::thread_create11(&CompressionFile::do_readahead, this, begin, end - begin));
+    }
+
     UNIMPLEMENTED_POINTER(IFileSystem *filesystem() override);
 
     virtual int close() override {
@@ -269,6 +503,26 @@ public:
         return ret;
     }
 
+    // the blocks covering [offset, offset + count) of the original file, as a range of
+    // the underlying file
+    int compressed_range(off_t offset, size_t count, off_t *begin, size_t *length) {
+        *begin = 0;
+        *length = 0;
+        if (offset < 0 || count == 0 || offset >= (off_t)m_ht.original_file_size) {
+            return 0;
+        }
+        count = std::min(count, (size_t)(m_ht.original_file_size - offset));
+        size_t begin_idx = offset / m_ht.opt.block_size;
+        size_t end_idx = (offset + count - 1) / m_ht.opt.block_size + 1;
+        if (m_jump_table.ensure(begin_idx, end_idx) != 0) {
+            LOG_ERROR_RETURN(EIO, -1, "failed to load jump table of range {offset: `, count: `}",
+                             offset, count);
+        }
+        *begin = m_jump_table[begin_idx];
+        *length = m_jump_table[end_idx] - *begin;
+        return 0;
+    }
+
     class BlockReader {
     public:
         BlockReader(){};
@@ -276,6 +530,7 @@ public:
             : m_zfile(zfile), m_offset(offset) /* , m_count(count)  */
         {
             m_verify = zfile->m_ht.opt.verify;
+            m_checksum_size = checksum_size(zfile->m_ht.opt);
             m_block_size = zfile->m_ht.opt.block_size; //+ m_verify * sizeof(uint32_t);
             m_begin_idx = m_offset / m_block_size;
             m_idx = m_begin_idx;
@@ -335,19 +590,30 @@ public:
         }
 
         __attribute__((always_inline)) size_t compressed_size() const {
-            return get_blocks_length(m_idx, m_idx + 1) - (m_verify ? sizeof(uint32_t) : 0);
+            return get_blocks_length(m_idx, m_idx + 1) - m_checksum_size;
         }
 
-        __attribute__((always_inline)) uint32_t crc32_code() const {
+        // with raw_block enabled, a block that didn't shrink is stored uncompressed
+        __attribute__((always_inline)) bool stored_raw() const {
+            if (!m_zfile->m_ht.opt.raw_block) {
+                return false;
+            }
+            auto raw_size = std::min((uint64_t)m_block_size,
+                                     m_zfile->m_ht.original_file_size - m_idx * m_block_size);
+            return compressed_size() == raw_size;
+        }
+
+        __attribute__((always_inline)) uint64_t crc32_code() const {
             if (!m_verify) {
                 LOG_WARN("crc32 not support.");
                 return -1;
             }
-            return *(uint32_t *)&(m_buf[m_buf_offset + compressed_size()]);
+            return stored_checksum(m_zfile->m_ht.opt, &m_buf[m_buf_offset + compressed_size()]);
         }
 
         struct iterator {
             size_t compressed_size;
+            bool stored_raw;
             off_t cp_begin;
             size_t cp_len;
             iterator(BlockReader *reader) : m_reader(reader) {
@@ -366,7 +632,7 @@ public:
                 return (m_reader->m_buf + m_reader->m_buf_offset);
             }
 
-            const uint32_t crc32_code() const {
+            const uint64_t crc32_code() const {
                 return m_reader->crc32_code();
             }
 
@@ -379,6 +645,7 @@ public:
 
                 auto blk_idx = m_reader->m_idx;
                 compressed_size = m_reader->compressed_size();
+                stored_raw = m_reader->stored_raw();
                 if ((size_t)(m_reader->m_buf_offset) + compressed_size > sizeof(m_buf)) {
                     m_reader->m_eno = ERANGE;
                     LOG_ERRNO_RETURN(0, -1,
@@ -451,6 +718,7 @@ public:
         off_t m_offset = 0;
         off_t m_end = 0;
         uint8_t m_verify = 0;
+        uint8_t m_checksum_size = 0;
         uint32_t m_block_size = 0;
         uint8_t m_eno = 0;
         unsigned char m_buf[MAX_READ_SIZE]; //{};
@@ -474,6 +742,14 @@ public:
             return 0;
         }
         ssize_t readn = 0; // final will equal to count
+        if (m_jump_table.ensure(offset / m_ht.opt.block_size,
+                                (offset + cnt - 1) / m_ht.opt.block_size + 1) != 0) {
+            LOG_ERROR_RETURN(EIO, -1, "failed to load jump table of range {offset: `, count: `}",
+                             offset, cnt);
+        }
+        if (buf != nullptr) {
+            readahead(offset, cnt);
+        }
 
         unsigned char raw[MAX_READ_SIZE];
 
@@ -491,13 +767,15 @@ public:
         size_t *batch_src_lens = nullptr;
         size_t *batch_dst_lens = nullptr;  // for flush_batch output
 
+        // the one the buffer is taken from
+        IOAlloc *batch_alloc = g_io_alloc.load(std::memory_order_relaxed);
         if (batch_enable) {
             batch_src_cap = (size_t)cnt * 2;  // worst case: incompressible data
-            batch_src_buf = new unsigned char[batch_src_cap];
+            batch_src_buf = alloc_batch_buf(batch_alloc, batch_src_cap);
             batch_src_lens = new size_t[max_batch];
             batch_dst_lens = new size_t[max_batch];
             if (!batch_src_buf || !batch_src_lens || !batch_dst_lens) {
-                delete[] batch_src_buf;  batch_src_buf = nullptr;
+                free_batch_buf(batch_alloc, batch_src_buf);  batch_src_buf = nullptr;
                 delete[] batch_src_lens; batch_src_lens = nullptr;
                 delete[] batch_dst_lens; batch_dst_lens = nullptr;
                 // fall through to per-block decompress
@@ -521,8 +799,33 @@ public:
             }
             int retry = 3;
         again:
+            /* ---- batch path ---- */
+            bool is_full_block = (block.cp_len == m_ht.opt.block_size);
+            bool can_batch = batch_enable && batch_src_buf && is_full_block &&
+                             !block.stored_raw && (valid != FLAG_VALID_CRC_CHECK);
+            if (can_batch) {
+                /* Flush first if adding this block would overflow the flat buffer */
+                if (batch_src_pos + block.compressed_size > batch_src_cap && batch_count > 0) {
+                    if (flush_batch(batch_src_buf, batch_src_lens, batch_dst_base,
+                                    batch_count) != 0) {
+                        free_batch_buf(batch_alloc, batch_src_buf); delete[] batch_src_lens; delete[] batch_dst_lens;
+                        LOG_ERRNO_RETURN(0, -1, "batch decompress failed");
+                    }
+                    batch_count = 0;
+                    batch_src_pos = 0;
+                }
+
+                if (batch_count == 0) {
+                    batch_dst_base = (unsigned char *)buf;
+                    batch_src_pos = 0;
+                }
+            }
             if (m_ht.opt.verify) {
-                auto c = crc32c_salt((void *)block.buffer(), block.compressed_size);
+                /* a block to batch is checksummed while copied into the flat buffer */
+                auto c = can_batch ? copy_block_checksum(m_ht.opt, batch_src_buf + batch_src_pos,
+                                                         block.buffer(), block.compressed_size)
+                                   : block_checksum(m_ht.opt, block.buffer(),
+                                                    block.compressed_size);
                 if (c != block.crc32_code()) {
                     if ((valid == FLAG_VALID_TRUE) && (retry--)) {
                         int reload_res = block.reload();
@@ -549,28 +852,10 @@ public:
                 continue;
             }
 
-            /* ---- batch path ---- */
-            bool is_full_block = (block.cp_len == m_ht.opt.block_size);
-            bool can_batch = batch_enable && batch_src_buf && is_full_block;
-
             if (can_batch) {
-                /* Flush first if adding this block would overflow the flat buffer */
-                if (batch_src_pos + block.compressed_size > batch_src_cap && batch_count > 0) {
-                    if (flush_batch(batch_src_buf, batch_src_lens, batch_dst_base,
-                                    batch_count) != 0) {
-                        delete[] batch_src_buf; delete[] batch_src_lens; delete[] batch_dst_lens;
-                        LOG_ERRNO_RETURN(0, -1, "batch decompress failed");
-                    }
-                    batch_count = 0;
-                    batch_src_pos = 0;
-                }
-
-                if (batch_count == 0) {
-                    batch_dst_base = (unsigned char *)buf;
-                    batch_src_pos = 0;
+                if (!m_ht.opt.verify) {
+                    memcpy(batch_src_buf + batch_src_pos, block.buffer(), block.compressed_size);
                 }
-                memcpy(batch_src_buf + batch_src_pos,
-                       block.buffer(), block.compressed_size);
                 batch_src_lens[batch_count] = block.compressed_size;
                 batch_src_pos += block.compressed_size;
                 batch_count++;
@@ -581,7 +866,7 @@ public:
                 if (batch_count >= max_batch) {
                     if (flush_batch(batch_src_buf, batch_src_lens, batch_dst_base,
                                     batch_count) != 0) {
-                        delete[] batch_src_buf; delete[] batch_src_lens; delete[] batch_dst_lens;
+                        free_batch_buf(batch_alloc, batch_src_buf); delete[] batch_src_lens; delete[] batch_dst_lens;
                         LOG_ERRNO_RETURN(0, -1, "batch decompress failed");
                     }
                     batch_count = 0;
@@ -595,13 +880,20 @@ public:
             if (batch_count > 0) {
                 if (flush_batch(batch_src_buf, batch_src_lens, batch_dst_base,
                                 batch_count) != 0) {
-                    delete[] batch_src_buf; delete[] batch_src_lens; delete[] batch_dst_lens;
+                    free_batch_buf(batch_alloc, batch_src_buf); delete[] batch_src_lens; delete[] batch_dst_lens;
                     LOG_ERRNO_RETURN(0, -1, "batch decompress failed");
                 }
                 batch_count = 0;
                 batch_src_pos = 0;
             }
 
+            if (block.stored_raw) {
+                memcpy(buf, block.buffer() + block.cp_begin, block.cp_len);
+                readn += block.cp_len;
+                buf = (unsigned char *)buf + block.cp_len;
+                continue;
+            }
+
             int dret = -1;
             if (block.cp_len == m_ht.opt.block_size) {
                 dret = m_compressor->decompress(block.buffer(), block.compressed_size,
@@ -618,12 +910,12 @@ public:
                     LOG_ERROR("decompression failed {offset: `, length: `}, reload result: `",
                         block.m_reader->m_buf_offset, block.compressed_size, reload_res);
                     if (reload_res < 0) {
-                        delete[] batch_src_buf; delete[] batch_src_lens; delete[] batch_dst_lens;
+                        free_batch_buf(batch_alloc, batch_src_buf); delete[] batch_src_lens; delete[] batch_dst_lens;
                         LOG_ERRNO_RETURN(0, -1, "decompression and reload failed");
                     }
                     goto again;
                 }
-                delete[] batch_src_buf; delete[] batch_src_lens; delete[] batch_dst_lens;
+                free_batch_buf(batch_alloc, batch_src_buf); delete[] batch_src_lens; delete[] batch_dst_lens;
                 LOG_ERRNO_RETURN(0, -1,
                                  "decompression failed after retries, {offset: `, length: `}",
                                  block.m_reader->m_buf_offset, block.compressed_size);
@@ -635,11 +927,11 @@ public:
         if (batch_count > 0) {
             if (flush_batch(batch_src_buf, batch_src_lens, batch_dst_base,
                             batch_count) != 0) {
-                delete[] batch_src_buf; delete[] batch_src_lens; delete[] batch_dst_lens;
+                free_batch_buf(batch_alloc, batch_src_buf); delete[] batch_src_lens; delete[] batch_dst_lens;
                 LOG_ERRNO_RETURN(0, -1, "batch decompress failed");
             }
         }
-        delete[] batch_src_buf;
+        free_batch_buf(batch_alloc, batch_src_buf);
         delete[] batch_src_lens;
         delete[] batch_dst_lens;
         if (br.m_eno != 0) {
@@ -652,8 +944,43 @@ public:
 static int write_header_trailer(IFile *file, bool is_header, bool is_sealed, bool is_data_file,
                                 CompressionFile::HeaderTrailer *pht, off_t offset = -1);
 
+// write the index of compressed blocks `block_len` at the current position of `dest`, which
+// is `index_offset`, either as an array of block lengths or, with `compact_index`, as the
+// pages of a jump table that readers load on demand.
+static int write_index(IFile *dest, const CompressArgs *args, CompressionFile::HeaderTrailer *pht,
+                       std::vector<uint32_t> &block_len, uint64_t index_offset) {
+    uint64_t index_size = block_len.size();
+    if (!args->compact_index) {
+        ssize_t index_bytes = index_size * sizeof(uint32_t);
+        LOG_INFO("write index (offset: `, count: ` size: `)", index_offset, index_size,
+                 index_bytes);
+        if (dest->write(&block_len[0], index_bytes) != index_bytes) {
+            LOG_ERRNO_RETURN(0, -1, "failed to write index.");
+        }
+        pht->index_crc = crc32::crc32c(&block_len[0], index_bytes);
+    } else {
+        CompressionFile::JumpTable jump_table;
+        auto ret = jump_table.build(&block_len[0], index_size,
+                                    CompressionFile::HeaderTrailer::SPACE + pht->opt.dict_size,
+                                    pht->opt.block_size, checksum_size(pht->opt));
+        if (ret != 0) {
+            LOG_ERRNO_RETURN(0, -1, "failed to build jump table.");
+        }
+        LOG_INFO("write compact index (offset: `, count: ` size: `)", index_offset, index_size,
+                 CompressionFile::JumpTable::get_index_bytes(index_size, pht->opt.block_size));
+        if (jump_table.write(dest, &pht->index_crc) < 0) {
+            LOG_ERRNO_RETURN(0, -1, "failed to write index.");
+        }
+        pht->set_index_compact();
+    }
+    LOG_INFO("index checksum: `", HEX(pht->index_crc).width(8));
+    pht->index_offset = index_offset;
+    pht->index_size = index_size;
+    return 0;
+}
+
 ssize_t compress_data(ICompressor *compressor, const unsigned char *buf, size_t count,
-                      unsigned char *dest_buf, size_t dest_len, bool gen_crc) {
+                      unsigned char *dest_buf, size_t dest_len, const CompressOptions &opt) {
 
     ssize_t compressed_len = 0;
     auto ret = compressor->compress((const unsigned char *)buf, count, dest_buf, dest_len);
@@ -662,11 +989,16 @@ ssize_t compress_data(ICompressor *compressor, const unsigned char *buf, size_t
     }
     // LOG_DEBUG("compress buffer {offset: `, count: `} into ` bytes.", i, step, ret);
     compressed_len = ret;
-    if (gen_crc) {
-        auto crc32_code = crc32c_salt(dest_buf, compressed_len);
-        *((uint32_t *)&dest_buf[compressed_len]) = crc32_code;
-        LOG_DEBUG("append ` bytes crc32_code: `", sizeof(uint32_t), crc32_code);
-        compressed_len += sizeof(uint32_t);
+    if (opt.raw_block && (size_t)compressed_len >= count) {
+        LOG_DEBUG("block is incompressible (` >= `), store it raw.", compressed_len, count);
+        memcpy(dest_buf, buf, count);
+        compressed_len = count;
+    }
+    if (opt.verify) {
+        auto crc32_code = block_checksum(opt, dest_buf, compressed_len);
+        memcpy(&dest_buf[compressed_len], &crc32_code, checksum_size(opt));
+        LOG_DEBUG("append ` bytes crc32_code: `", checksum_size(opt), crc32_code);
+        compressed_len += checksum_size(opt);
     }
     LOG_DEBUG("compressed ` bytes into ` bytes.", count, compressed_len);
     return compressed_len;
@@ -710,7 +1042,7 @@ public:
 
     int write_buffer(const unsigned char *buf, size_t count) {
         auto compressed_len =
-            compress_data(m_compressor, buf, count, compressed_data, m_buf_size, m_opt.verify);
+            compress_data(m_compressor, buf, count, compressed_data, m_buf_size, m_opt);
         if (compressed_len <= 0) {
             LOG_ERRNO_RETURN(EIO, -1, "compress buffer failed.");
         }
@@ -728,18 +1060,10 @@ public:
             if (write_buffer(reserved_buf, reserved_size) != 0)
                 return -1;
         }
-        uint64_t index_offset = moffset;
-        uint64_t index_size = m_block_len.size();
-        ssize_t index_bytes = index_size * sizeof(uint32_t);
-        LOG_INFO("write index (offset: `, count: ` size: `)", index_offset, index_size,
-                 index_bytes);
-        if (m_dest->write(&m_block_len[0], index_bytes) != index_bytes) {
-            LOG_ERRNO_RETURN(0, -1, "failed to write index.");
-        }
         auto pht = (CompressionFile::HeaderTrailer *)m_ht;
-        pht->index_crc = crc32::crc32c(&m_block_len[0], index_bytes);
-        pht->index_offset = index_offset;
-        pht->index_size = index_size;
+        if (write_index(m_dest, m_args, pht, m_block_len, moffset) != 0) {
+            return -1;
+        }
         pht->original_file_size = raw_data_size;
         LOG_INFO("write trailer.");
         auto ret = write_header_trailer(m_dest, false, true, true, pht);
@@ -896,7 +1220,8 @@ public:
                         break;
                     }
                     auto compressed_size =
-                        compress_data(compressor, ctx->ibuf, ctx->size, ctx->obuf, ctx->buf_size, m_opt.verify);
+                        compress_data(compressor, ctx->ibuf, ctx->size, ctx->obuf, ctx->buf_size,
+                                      m_opt);
                     if (compressed_size < 0) {
                         ctx->result = -1;
                         LOG_ERRNO_RETURN(EIO, -1, "failed to compress");
@@ -942,18 +1267,10 @@ public:
         }
 
         // compress done
-        uint64_t index_offset = moffset;
-        uint64_t index_size = m_block_len.size();
-        ssize_t index_bytes = index_size * sizeof(uint32_t);
-        LOG_INFO("write index (offset: `, count: ` size: `)", index_offset, index_size, index_bytes);
-        if (m_dest->write(&m_block_len[0], index_bytes) != index_bytes) {
-            LOG_ERRNO_RETURN(0, -1, "failed to write index.");
-        }
         auto pht = (CompressionFile::HeaderTrailer *)m_ht;
-        pht->index_crc = crc32::crc32c(&m_block_len[0], index_bytes);
-        LOG_INFO("index crc: ", pht->index_crc);
-        pht->index_offset = index_offset;
-        pht->index_size = index_size;
+        if (write_index(m_dest, m_args, pht, m_block_len, moffset) != 0) {
+            return -1;
+        }
         pht->original_file_size = raw_data_size;
         LOG_INFO("write trailer.");
         auto ret = write_header_trailer(m_dest, false, true, true, pht);
@@ -1054,6 +1371,13 @@ ssize_t read_chunk(IFile *file, char *buf, off_t offset, size_t length, ssize_t
     return 0;
 }
 
+static uint64_t get_index_bytes(CompressionFile::HeaderTrailer *pht) {
+    if (pht->is_index_compact()) {
+        return CompressionFile::JumpTable::get_index_bytes(pht->index_size, pht->opt.block_size);
+    }
+    return pht->index_size * sizeof(uint32_t);
+}
+
 bool load_jump_table(IFile *file, CompressionFile::HeaderTrailer *pheader_trailer,
                      CompressionFile::JumpTable &jump_table, bool trailer = true) {
     char buf[CompressionFile::HeaderTrailer::SPACE];
@@ -1069,6 +1393,9 @@ bool load_jump_table(IFile *file, CompressionFile::HeaderTrailer *pheader_traile
     if (pht->is_valid() == false) {
         LOG_ERROR_RETURN(0, false, "digest verification failed.");
     }
+    if (pht->opt.checksum > CompressOptions::XXH64) {
+        LOG_ERROR_RETURN(ENOTSUP, false, "unsupported block checksum `", pht->opt.checksum + 0);
+    }
     struct stat stat;
     ret = file->fstat(&stat);
     if (ret < 0) {
@@ -1100,7 +1427,7 @@ bool load_jump_table(IFile *file, CompressionFile::HeaderTrailer *pheader_traile
             LOG_ERROR_RETURN(0, false, "ZFile index size ` exceeds maximum `",
                              pht->index_size + 0, MAX_ZFILE_INDEX_SIZE);
 
-        index_bytes = pht->index_size * sizeof(uint32_t);
+        index_bytes = get_index_bytes(pht);
         LOG_INFO("trailer_offset: `, idx_offset: `, idx_bytes: `, dict_size: `, use_dict: `",
                  trailer_offset, pht->index_offset, index_bytes, pht->opt.dict_size,
                  pht->opt.use_dict);
@@ -1112,10 +1439,20 @@ bool load_jump_table(IFile *file, CompressionFile::HeaderTrailer *pheader_traile
             LOG_ERROR_RETURN(0, false, "ZFile index size ` exceeds maximum `",
                              pht->index_size + 0, MAX_ZFILE_INDEX_SIZE);
 
-        index_bytes = pht->index_size * sizeof(uint32_t);
+        index_bytes = get_index_bytes(pht);
         LOG_INFO("read overwrite header. idx_offset: `, idx_bytes: `, dict_size: `, use_dict: `",
                  pht->index_offset, index_bytes, pht->opt.dict_size, pht->opt.use_dict);
     }
+    if (pht->is_index_compact()) {
+        // pages of a compact index carry their own checksum, and are loaded on demand
+        ret = jump_table.load(file, pht->index_offset, pht->index_size, pht->opt.block_size);
+        if (ret != 0) {
+            LOG_ERRNO_RETURN(0, false, "failed to load compact jump table");
+        }
+        if (pheader_trailer)
+            *pheader_trailer = *pht;
+        return true;
+    }
     auto ibuf = std::unique_ptr<uint32_t[]>(new uint32_t[pht->index_size]);
     LOG_DEBUG("index_offset: `", pht->index_offset);
 
@@ -1150,7 +1487,7 @@ bool load_jump_table(IFile *file, CompressionFile::HeaderTrailer *pheader_traile
     }
     ret = jump_table.build(ibuf.get(), pht->index_size,
                            CompressionFile::HeaderTrailer::SPACE + pht->opt.dict_size,
-                           pht->opt.block_size, pht->opt.verify);
+                           pht->opt.block_size, checksum_size(pht->opt));
     if (ret != 0) {
         LOG_ERRNO_RETURN(0, false, "failed to build jump table");
     }
@@ -1225,34 +1562,43 @@ static int write_header_trailer(IFile *file, bool is_header, bool is_sealed, boo
     return (int)file->pwrite(pht, CompressionFile::HeaderTrailer::SPACE, offset);
 }
 
-int zfile_compress(IFile *file, IFile *as, const CompressArgs *args) {
-    if (args == nullptr) {
-        LOG_ERROR_RETURN(EINVAL, -1, "CompressArgs is null");
+// raw bytes handled by one task of the block-range worker pool
+const static size_t MP_RANGE_SIZE = 1UL << 20;
+
+// run work(id) on `nworkers` threads, each with its own photon environment
+template <typename Work>
+static int run_workers(int nworkers, Work &&work) {
+    std::vector<std::thread> ths;
+    std::vector<int> results(nworkers, 0);
+    for (int i = 0; i < nworkers; i++) {
+        ths.emplace_back([&, id = i] {
+            photon::init(photon::INIT_EVENT_EPOLL, photon::INIT_IO_NONE);
+            DEFER(photon::fini());
+            results[id] = work(id);
+        });
     }
-    if (file == nullptr || as == nullptr) {
-        LOG_ERROR_RETURN(EINVAL, -1, "file ptr is NULL (file: `, as: `)", file, as);
+    for (auto &th : ths) {
+        th.join();
     }
-    CompressOptions opt = args->opt;
-    LOG_INFO("create compress file. [ block size: `, type: `, enable_checksum: `]", opt.block_size,
-             opt.algo, opt.verify);
+    for (auto r : results) {
+        if (r != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int compress_blocks(IFile *file, IFile *as, const CompressArgs *args,
+                           std::vector<uint32_t> &block_len, uint64_t &moffset,
+                           off_t &infile_size) {
+    const CompressOptions &opt = args->opt;
     auto compressor = create_compressor(args);
     DEFER(delete compressor);
     if (compressor == nullptr)
         return -1;
-    char buf[CompressionFile::HeaderTrailer::SPACE] = {};
-    auto pht = new (buf) CompressionFile::HeaderTrailer;
-    pht->set_compress_option(opt);
-    LOG_INFO("write header.");
-    auto ret = write_header_trailer(as, true, false, true, pht);
-    if (ret < 0) {
-        LOG_ERRNO_RETURN(0, -1, "failed to write header");
-    }
     auto block_size = opt.block_size;
-    LOG_INFO("block size: `", block_size);
     auto buf_size = block_size + BUF_SIZE;
     bool crc32_verify = opt.verify;
-    std::vector<uint32_t> block_len{};
-    uint64_t moffset = CompressionFile::HeaderTrailer::SPACE + opt.dict_size;
+    size_t crc_size = checksum_size(opt);
     int nbatch = compressor->nbatch();
     LOG_DEBUG("nbatch: `, buffer need allocate: `", nbatch, nbatch * buf_size);
     auto raw_data = new unsigned char[nbatch * buf_size];
@@ -1263,7 +1609,6 @@ int zfile_compress(IFile *file, IFile *as, const CompressArgs *args) {
     compressed_len.resize(nbatch);
     raw_chunk_len.resize(nbatch);
     LOG_INFO("compress with start....");
-    off_t infile_size = 0;
     while (true) {
         int n = 0;
         auto readn = file->read(raw_data, block_size * nbatch);
@@ -1287,17 +1632,22 @@ int zfile_compress(IFile *file, IFile *as, const CompressArgs *args) {
         if (readn != 0)
             return -1;
         for (off_t j = 0; j < n; j++) {
-            readn = as->write(&compressed_data[j * buf_size], compressed_len[j]);
+            auto block_data = &compressed_data[j * buf_size];
+            if (opt.raw_block && compressed_len[j] >= raw_chunk_len[j]) {
+                block_data = &raw_data[j * block_size];
+                compressed_len[j] = raw_chunk_len[j];
+            }
+            readn = as->write(block_data, compressed_len[j]);
             if (readn < (ssize_t)compressed_len[j]) {
                 LOG_ERRNO_RETURN(0, -1, "failed to write compressed data.");
             }
             if (crc32_verify) {
-                auto crc32_code = crc32c_salt(&compressed_data[j * buf_size], compressed_len[j]);
+                auto crc32_code = block_checksum(opt, block_data, compressed_len[j]);
                 LOG_DEBUG("append ` bytes crc32_code: {offset: `, count: `, crc32: `}",
-                          sizeof(uint32_t), moffset, compressed_len[j], HEX(crc32_code).width(8));
-                compressed_len[j] += sizeof(uint32_t);
-                readn = as->write(&crc32_code, sizeof(uint32_t));
-                if (readn < (ssize_t)sizeof(uint32_t)) {
+                          crc_size, moffset, compressed_len[j], HEX(crc32_code).width(8));
+                compressed_len[j] += crc_size;
+                readn = as->write(&crc32_code, crc_size);
+                if (readn < (ssize_t)crc_size) {
                     LOG_ERRNO_RETURN(0, -1, "failed to write crc32code, offset: `, crc32: `",
                                      moffset, HEX(crc32_code).width(8));
                 }
@@ -1306,17 +1656,133 @@ int zfile_compress(IFile *file, IFile *as, const CompressArgs *args) {
             moffset += compressed_len[j];
         }
     }
-    uint64_t index_offset = moffset;
-    uint64_t index_size = block_len.size();
-    ssize_t index_bytes = index_size * sizeof(uint32_t);
-    LOG_INFO("write index (offset: `, count: ` size: `)", index_offset, index_size, index_bytes);
-    if (as->write(&block_len[0], index_bytes) != index_bytes) {
-        LOG_ERRNO_RETURN(0, -1, "failed to write index.");
+    return 0;
+}
+
+// Each worker takes the next range of blocks in turn: ranges are read from `file` and
+// written to `as` in order, while compression of different ranges runs in parallel.
+static int compress_blocks_mp(IFile *file, IFile *as, const CompressArgs *args,
+                              std::vector<uint32_t> &block_len, uint64_t &moffset,
+                              off_t &infile_size) {
+    const CompressOptions &opt = args->opt;
+    int nworkers = args->workers;
+    size_t block_size = opt.block_size;
+    size_t buf_size = block_size + BUF_SIZE;
+    size_t range_blocks = std::max(MP_RANGE_SIZE / block_size, (size_t)1);
+    size_t range_size = range_blocks * block_size;
+    std::vector<std::unique_ptr<photon::semaphore>> read_sem, write_sem;
+    for (int i = 0; i < nworkers; i++) {
+        read_sem.emplace_back(new photon::semaphore(i == 0 ? 1 : 0));
+        write_sem.emplace_back(new photon::semaphore(i == 0 ? 1 : 0));
+    }
+    bool eof = false;
+    std::atomic<bool> failed{false};
+    LOG_INFO("compress with ` workers, ` blocks per range", nworkers, range_blocks);
+    auto res = run_workers(nworkers, [&](int id) -> int {
+        auto next = (id + 1) % nworkers;
+        int ret = 0;
+        auto compressor = create_compressor(args);
+        DEFER(delete compressor);
+        if (compressor == nullptr) {
+            LOG_ERROR("failed to create compressor");
+            failed = true;
+            ret = -1;
+        }
+        auto ibuf = std::unique_ptr<unsigned char[]>(new unsigned char[range_size]);
+        auto obuf = std::unique_ptr<unsigned char[]>(new unsigned char[range_blocks * buf_size]);
+        std::vector<uint32_t> lens;
+        // every worker keeps taking turns until it sees EOF or a failure, so that
+        // the others never wait for a turn forever.
+        bool done = false;
+        while (!done) {
+            read_sem[id]->wait(1);
+            ssize_t readn = 0;
+            while (!eof && !failed && readn < (ssize_t)range_size) {
+                auto n = file->read(ibuf.get() + readn, range_size - readn);
+                if (n < 0) {
+                    LOG_ERROR("failed to read from source file. (readn: `, `)", n, ERRNO());
+                    failed = true;
+                    ret = -1;
+                    break;
+                }
+                if (n == 0) {
+                    eof = true;
+                    break;
+                }
+                readn += n;
+            }
+            off_t range_offset = infile_size;
+            infile_size += readn;
+            done = eof || failed;
+            read_sem[next]->signal(1);
+
+            lens.clear();
+            size_t opos = 0;
+            for (ssize_t i = 0; i < readn && !failed; i += block_size) {
+                auto len = std::min((size_t)(readn - i), block_size);
+                auto compressed_len = compress_data(compressor, ibuf.get() + i, len,
+                                                    obuf.get() + opos, buf_size, opt);
+                if (compressed_len <= 0) {
+                    LOG_ERROR("failed to compress block `", (range_offset + i) / block_size);
+                    failed = true;
+                    ret = -1;
+                    break;
+                }
+                lens.push_back(compressed_len);
+                opos += compressed_len;
+            }
+
+            write_sem[id]->wait(1);
+            if (!failed && opos > 0) {
+                if (as->write(obuf.get(), opos) != (ssize_t)opos) {
+                    LOG_ERROR("failed to write compressed data. `", ERRNO());
+                    failed = true;
+                    ret = -1;
+                } else {
+                    block_len.insert(block_len.end(), lens.begin(), lens.end());
+                    moffset += opos;
+                }
+            }
+            write_sem[next]->signal(1);
+        }
+        return ret;
+    });
+    return (res != 0 || failed) ? -1 : 0;
+}
+
+int zfile_compress(IFile *file, IFile *as, const CompressArgs *args) {
+    if (args == nullptr) {
+        LOG_ERROR_RETURN(EINVAL, -1, "CompressArgs is null");
+    }
+    if (file == nullptr || as == nullptr) {
+        LOG_ERROR_RETURN(EINVAL, -1, "file ptr is NULL (file: `, as: `)", file, as);
+    }
+    CompressOptions opt = args->opt;
+    LOG_INFO("create compress file. [ block size: `, type: `, enable_checksum: `, raw_block: `]",
+             opt.block_size, opt.algo, opt.verify, opt.raw_block);
+    char buf[CompressionFile::HeaderTrailer::SPACE] = {};
+    auto pht = new (buf) CompressionFile::HeaderTrailer;
+    pht->set_compress_option(opt);
+    LOG_INFO("write header.");
+    auto ret = write_header_trailer(as, true, false, true, pht);
+    if (ret < 0) {
+        LOG_ERRNO_RETURN(0, -1, "failed to write header");
+    }
+    LOG_INFO("block size: `", opt.block_size);
+    std::vector<uint32_t> block_len{};
+    uint64_t moffset = CompressionFile::HeaderTrailer::SPACE + opt.dict_size;
+    off_t infile_size = 0;
+    if (args->workers > 1) {
+        ret = compress_blocks_mp(file, as, args, block_len, moffset, infile_size);
+    } else {
+        ret = compress_blocks(file, as, args, block_len, moffset, infile_size);
+    }
+    if (ret != 0) {
+        LOG_ERRNO_RETURN(0, -1, "failed to compress data blocks");
+    }
+    if (write_index(as, args, pht, block_len, moffset) != 0) {
+        return -1;
     }
-    pht->index_crc = crc32::crc32c(&block_len[0], index_bytes);
-    LOG_INFO("index checksum: `", HEX(pht->index_crc).width(8));
-    pht->index_offset = index_offset;
-    pht->index_size = index_size;
     pht->original_file_size = infile_size;
     LOG_INFO("write trailer. (source file size: `)", infile_size);
     ret = write_header_trailer(as, false, true, true, pht);
@@ -1332,12 +1798,92 @@ int zfile_compress(IFile *file, IFile *as, const CompressArgs *args) {
     return 0;
 }
 
-int zfile_decompress(IFile *src, IFile *dst) {
+// Workers take block ranges from a shared cursor, so ranges complete in any order: each
+// range is decompressed into `dst` at its fixed offset. Only checksums are checked if
+// `dst` is nullptr.
+static int decompress_blocks_mp(CompressionFile *zfile, IFile *dst, int nworkers) {
+    auto &ht = zfile->m_ht;
+    auto &jump_table = zfile->m_jump_table;
+    size_t block_size = ht.opt.block_size;
+    size_t nblocks = ht.index_size;
+    size_t range_blocks = std::max(MP_RANGE_SIZE / block_size, (size_t)1);
+    size_t ibuf_size = range_blocks * (block_size + BUF_SIZE);
+    size_t crc_size = checksum_size(ht.opt);
+    std::atomic<size_t> next_block{0};
+    std::atomic<bool> failed{false};
+    // workers run on their own vcpus, so the whole jump table is loaded beforehand
+    if (jump_table.ensure(0, nblocks) != 0) {
+        LOG_ERRNO_RETURN(0, -1, "failed to load jump table");
+    }
+    LOG_INFO("` with ` workers, ` blocks per range", dst ? "decompress" : "check crc", nworkers,
+             range_blocks);
+    return run_workers(nworkers, [&](int id) -> int {
+        CompressArgs args(ht.opt);
+        auto compressor = create_compressor(&args);
+        DEFER(delete compressor);
+        if (compressor == nullptr) {
+            failed = true;
+            LOG_ERROR_RETURN(0, -1, "failed to create compressor");
+        }
+        auto ibuf = std::unique_ptr<unsigned char[]>(new unsigned char[ibuf_size]);
+        auto obuf = std::unique_ptr<unsigned char[]>(new unsigned char[range_blocks * block_size]);
+        while (!failed) {
+            size_t begin = next_block.fetch_add(range_blocks);
+            if (begin >= nblocks)
+                break;
+            size_t end = std::min(begin + range_blocks, nblocks);
+            off_t offset = jump_table[begin];
+            size_t length = jump_table[end] - offset;
+            if (length > ibuf_size) {
+                failed = true;
+                LOG_ERROR_RETURN(EIO, -1, "unexpected length ` of blocks [`, `)", length, begin,
+                                 end);
+            }
+            if (zfile->m_file->pread(ibuf.get(), length, offset) != (ssize_t)length) {
+                failed = true;
+                LOG_ERRNO_RETURN(0, -1, "failed to read compressed blocks. (offset: `, len: `)",
+                                 offset, length);
+            }
+            size_t raw_bytes = 0;
+            for (size_t i = begin; i < end; i++) {
+                auto data = ibuf.get() + (jump_table[i] - offset);
+                size_t compressed_size = jump_table[i + 1] - jump_table[i] - crc_size;
+                if (crc_size && block_checksum(ht.opt, data, compressed_size) !=
+                                    stored_checksum(ht.opt, data + compressed_size)) {
+                    failed = true;
+                    LOG_ERROR_RETURN(ECHECKSUM, -1, "crc check error in block `", i);
+                }
+                size_t raw_size = std::min(block_size, (size_t)(ht.original_file_size - i * block_size));
+                raw_bytes += raw_size;
+                if (dst == nullptr)
+                    continue;
+                auto out = obuf.get() + (i - begin) * block_size;
+                if (ht.opt.raw_block && compressed_size == raw_size) {
+                    memcpy(out, data, raw_size);
+                } else if (compressor->decompress(data, compressed_size, out, block_size) !=
+                           (int)raw_size) {
+                    failed = true;
+                    LOG_ERRNO_RETURN(0, -1, "failed to decompress block `", i);
+                }
+            }
+            if (dst && dst->pwrite(obuf.get(), raw_bytes, begin * block_size) != (ssize_t)raw_bytes) {
+                failed = true;
+                LOG_ERRNO_RETURN(0, -1, "failed to write file into dst");
+            }
+        }
+        return 0;
+    });
+}
+
+int zfile_decompress(IFile *src, IFile *dst, int workers) {
     auto file = (CompressionFile *)zfile_open_ro(src, /*verify = */ true);
     DEFER(delete file);
     if (file == nullptr) {
         LOG_ERROR_RETURN(0, -1, "failed to read file.");
     }
+    if (workers > 1) {
+        return decompress_blocks_mp(file, dst, workers);
+    }
     struct stat _st;
     file->fstat(&_st);
     auto raw_data_size = _st.st_size;
@@ -1361,7 +1907,7 @@ int zfile_decompress(IFile *src, IFile *dst) {
     return 0;
 }
 
-int zfile_validation_check(IFile *src) {
+int zfile_validation_check(IFile *src, int workers) {
     auto file = (CompressionFile *)zfile_open_ro(src, /*verify = */ true);
     DEFER(delete file);
     if (file == nullptr) {
@@ -1370,6 +1916,9 @@ int zfile_validation_check(IFile *src) {
     if (file->m_ht.opt.verify == 0) {
         LOG_ERROR_RETURN(0, -1, "source file doesn't have checksum.");
     }
+    if (workers > 1) {
+        return decompress_blocks_mp(file, nullptr, workers);
+    }
     file->valid = FLAG_VALID_CRC_CHECK;
     struct stat _st;
     file->fstat(&_st);
@@ -1411,6 +1960,22 @@ int is_zfile(IFile *file) {
     return 1;
 }
 
+int zfile_map_ranges(IFile *file, std::vector<std::pair<off_t, size_t>> &ranges) {
+    auto zfile = dynamic_cast<CompressionFile *>(file);
+    if (zfile == nullptr) {
+        LOG_ERROR_RETURN(EINVAL, -1, "file: ` is not a zfile object", file);
+    }
+    for (auto &r : ranges) {
+        off_t begin;
+        size_t length;
+        if (zfile->compressed_range(r.first, r.second, &begin, &length) != 0) {
+            return -1;
+        }
+        r = std::make_pair(begin, length);
+    }
+    return 0;
+}
+
 IFile *new_zfile_builder(IFile *file, const CompressArgs *args, bool ownership) {
     ZFileBuilderBase *builder;
     if (args->workers == 1) {
@@ -15,7 +15,12 @@
 */
 #pragma once
 
+#include <utility>
+#include <vector>
 #include "compressor.h"
+
+struct IOAlloc;
+
 namespace ZFile {
 const static size_t MAX_READ_SIZE = 65536; // 64K
 
@@ -25,15 +30,24 @@ extern "C" photon::fs::IFile *zfile_open_ro(photon::fs::IFile *file, bool verify
 extern "C" int zfile_compress(photon::fs::IFile *src_file, photon::fs::IFile *dst_file,
                               const CompressArgs *opt = nullptr);
 
-extern "C" int zfile_decompress(photon::fs::IFile *src_file, photon::fs::IFile *dst_file);
+// `workers` > 1 processes block ranges in parallel on that many threads.
+extern "C" int zfile_decompress(photon::fs::IFile *src_file, photon::fs::IFile *dst_file,
+                                int workers = 1);
 
-extern "C" int zfile_validation_check(photon::fs::IFile *src_file);
+extern "C" int zfile_validation_check(photon::fs::IFile *src_file, int workers = 1);
 
 
 extern "C" photon::fs::IFile *new_zfile_builder(photon::fs::IFile *file,
                                                 const CompressArgs *args = nullptr,
                                                 bool ownership = false);
 
+// staging buffers of batched decompression are taken from `alloc`, or new[] if nullptr
+extern "C" void zfile_set_io_alloc(IOAlloc *alloc);
+
+// map {offset, count} ranges of a zfile opened by zfile_open_ro() from the original file
+// to its compressed blocks in the underlying file, returns -1 if `file` is not a zfile
+int zfile_map_ranges(photon::fs::IFile *file, std::vector<std::pair<off_t, size_t>> &ranges);
+
 // return 1 if file object is a zfile.
 // return 0 if file object is a normal file.
 // otherwise return -1.
@@ -192,6 +192,14 @@ public:
         return 0;
     }
 
+    void get_trace_ranges(uint32_t layer_index,
+                          vector<pair<off_t, size_t>> &ranges) const override {
+        auto it = m_trace_ranges.find(layer_index);
+        if (it != m_trace_ranges.end()) {
+            ranges = it->second;
+        }
+    }
+
     void register_src_file(uint32_t layer_index, IFile *src_file) {
         m_src_files[layer_index] = src_file;
     }
@@ -216,6 +224,8 @@ public:
     vector<TraceFormat> m_record_array;
     queue<TraceFormat> m_replay_queue;
     map<uint32_t, IFile *> m_src_files;
+    // reads of the trace by layer, kept after m_replay_queue is consumed
+    map<uint32_t, vector<pair<off_t, size_t>>> m_trace_ranges;
     vector<photon::join_handle *> m_replay_threads;
     photon::join_handle *m_replay_thread = nullptr;
     photon::join_handle *m_detect_thread = nullptr;
@@ -307,11 +317,15 @@ public:
             checksum = crc32::crc32c_extend(&fmt, sizeof(TraceFormat), checksum);
             // Save in memory
             m_replay_queue.push(fmt);
+            if (fmt.op == TraceOp::READ) {
+                m_trace_ranges[fmt.layer_index].emplace_back(fmt.offset, fmt.count);
+            }
         }
 
         if (checksum != hdr.checksum) {
             queue<TraceFormat> tmp;
             m_replay_queue.swap(tmp);
+            m_trace_ranges.clear();
             LOG_ERROR_RETURN(0, -1, "Prefetch: reload checksum error");
         }
 
@@ -18,6 +18,8 @@ limitations under the License.
 #include <cctype>
 #include <cstdint>
 #include <string>
+#include <utility>
+#include <vector>
 #include <photon/fs/filesystem.h>
 
 using namespace photon::fs;
@@ -71,6 +73,12 @@ public:
     // The source file is supposed to have cache.
     virtual IFile *new_prefetch_file(IFile *src_file, uint32_t layer_index) = 0;
 
+    // Ranges {offset, count} of layer `layer_index` read in the trace to replay, in the
+    // order of the trace. Nothing if there is no recorded trace to replay.
+    virtual void get_trace_ranges(uint32_t layer_index,
+                                  std::vector<std::pair<off_t, size_t>> &ranges) const {
+    }
+
     static Mode detect_mode(const std::string &trace_file_path, size_t *file_size = nullptr);
 
     Mode get_mode() const {
@@ -15,6 +15,7 @@
 */
 #include "switch_file.h"
 #include <fcntl.h>
+#include <atomic>
 #include <photon/common/alog.h>
 #include <photon/common/alog-audit.h>
 #include <photon/common/alog-stdstring.h>
@@ -27,12 +28,16 @@
 using namespace std;
 using namespace photon::fs;
 
+// counted before m_local_file is checked, so that m_file is released only after the
+// operations that may have taken it are done, and uncounted at once by those that don't
 #define FORWARD(func)                                                                              \
+    m_source_ops++;                                                                                \
     if (m_local_file != nullptr) {                                                                 \
+        m_source_ops--;                                                                            \
         return m_local_file->func;                                                                 \
-    } else {                                                                                       \
-        return m_file->func;                                                                       \
-    }
+    }                                                                                              \
+    DEFER(m_source_ops--);                                                                         \
+    return m_file->func;
 
 
 // check if the `file` is zfile format
@@ -59,6 +64,8 @@ public:
     IFile *m_file = nullptr;
     IFile *m_local_file = nullptr;
     std::string m_filepath;
+    std::atomic<uint32_t> m_source_ops{0};
+    bool m_source_zfile = false;
 
     SwitchFile(IFile *source, bool local = false, const char *filepath = nullptr) {
         if (local)
@@ -99,6 +106,35 @@ public:
         m_local_file = file;
     }
 
+    int release_source(const int &running) override {
+        if (m_local_file == nullptr) {
+            return -1;
+        }
+        if (m_file == nullptr) {
+            return 0;
+        }
+        while (m_source_ops.load() != 0) {
+            if (running != 1) {
+                LOG_ERROR_RETURN(ECANCELED, -1, "stopped waiting for reads of ` source",
+                                 m_filepath);
+            }
+            photon::thread_usleep(1000);
+        }
+        safe_delete(m_file);
+        LOG_INFO("source of ` released", m_filepath);
+        return 0;
+    }
+
+    int map_source_ranges(std::vector<std::pair<off_t, size_t>> &ranges) override {
+        if (m_file == nullptr) {
+            return -1;
+        }
+        if (!m_source_zfile) {
+            return 0;
+        }
+        return ZFile::zfile_map_ranges(m_file, ranges);
+    }
+
     virtual int close() override {
         return 0;
     }
@@ -115,12 +151,14 @@ public:
         FORWARD(writev(iov, iovcnt));
     }
     virtual ssize_t pread(void *buf, size_t count, off_t offset) override {
+        m_source_ops++;
         if (m_local_file != nullptr) {
+            m_source_ops--;
             SCOPE_AUDIT_THRESHOLD(10UL * 1000, "file:pread", AU_FILEOP(m_filepath, offset, count));
             return m_local_file->pread(buf, count, offset);
-        } else {
-            return m_file->pread(buf, count, offset);
         }
+        DEFER(m_source_ops--);
+        return m_file->pread(buf, count, offset);
     }
     virtual ssize_t pwrite(const void *buf, size_t count, off_t offset) override {
         FORWARD(pwrite(buf, count, offset));
@@ -173,5 +211,7 @@ again:
             goto again;
         return nullptr;
     }
-    return new SwitchFile(file, local, file_path);
+    auto switch_file = new SwitchFile(file, local, file_path);
+    switch_file->m_source_zfile = (file != source);
+    return switch_file;
 };
@@ -14,6 +14,8 @@
    limitations under the License.
 */
 #pragma once
+#include <utility>
+#include <vector>
 #include <photon/fs/filesystem.h>
 
 // switch to local file after background download finished, and audit for local file pread
@@ -21,6 +23,13 @@
 class ISwitchFile : public photon::fs::IFile {
 public:
     virtual void set_switch_file(const char *filepath) = 0;
+    // close the source file once switched and it's no longer read, so that its cache can
+    // be released, returns -1 if not switched, or if `running` turns other than 1 while
+    // waiting for reads of the source
+    virtual int release_source(const int &running) = 0;
+    // map {offset, count} ranges of the file to those of the source it's read from, i.e.
+    // to the compressed blocks if the source is a zfile, returns -1 if not read from source
+    virtual int map_source_ranges(std::vector<std::pair<off_t, size_t>> &ranges) = 0;
 };
 
 extern "C" ISwitchFile *new_switch_file(photon::fs::IFile *source, bool local = false,
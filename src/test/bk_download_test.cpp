@@ -0,0 +1,452 @@
+/*
+   Copyright The Overlaybd Authors
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "photon/common/alog.h"
+#include "photon/fs/forwardfs.h"
+#include "photon/fs/localfs.h"
+#include "photon/photon.h"
+#include "photon/thread/thread.h"
+
+#include "../bk_download.cpp"
+#include "../switch_file.h"
+#include "../tools/sha256file.h"
+
+using namespace photon::fs;
+
+// the blob in the registry, reads of it are recorded, and may be failed or delayed
+class SourceFile : public ForwardFile_Ownership {
+public:
+    std::vector<off_t> reads;
+    // set once it's deleted
+    bool *deleted = nullptr;
+    // returns the errno to fail a read with, or 0
+    std::function<int(off_t)> fail;
+    // returns the time to delay a read in us
+    std::function<uint64_t(off_t)> delay;
+
+    SourceFile(IFile *file) : ForwardFile_Ownership(file, true) {
+    }
+    ~SourceFile() {
+        if (deleted) {
+            *deleted = true;
+        }
+    }
+    ssize_t pread(void *buf, size_t count, off_t offset) override {
+        reads.push_back(offset);
+        if (delay) {
+            photon::thread_usleep(delay(offset));
+        }
+        if (fail) {
+            int err = fail(offset);
+            if (err != 0) {
+                errno = err;
+                return -1;
+            }
+        }
+        return m_file->pread(buf, count, offset);
+    }
+};
+
+class TestDownload : public BKDL::BkDownload {
+public:
+    using BKDL::BkDownload::BkDownload;
+    using BKDL::BkDownload::download_order;
+    // of the blob hashed while downloading
+    const std::string &hashed_checksum() const {
+        return checksum;
+    }
+};
+
+class BkDownloadTest : public ::testing::Test {
+public:
+    const std::string test_dir = "/tmp/overlaybd/bk_download_test";
+    const std::string blob_path = test_dir + "/blob";
+    const std::string dl_dir = test_dir + "/dl";
+    const uint32_t bs = 64 * 1024;
+    // the last block is a short one
+    const size_t nblocks = 10;
+    const size_t file_size = (nblocks - 1) * bs + 1000;
+    std::vector<char> data;
+    std::string digest;
+    int running = 1;
+    ISwitchFile *sw_file = nullptr;
+    SourceFile *src = nullptr;
+
+    virtual void SetUp() override {
+        system(("rm -rf " + test_dir).c_str());
+        system(("mkdir -p " + dl_dir).c_str());
+        data.resize(file_size);
+        for (size_t i = 0; i < data.size(); i++) {
+            data[i] = i * 7 % 251;
+        }
+        auto file = open_localfile_adaptor(blob_path.c_str(), O_RDWR | O_CREAT, 0644);
+        ASSERT_NE(nullptr, file);
+        ASSERT_EQ((ssize_t)file_size, file->pwrite(data.data(), file_size, 0));
+        delete file;
+        digest = sha256sum(blob_path.c_str());
+        sw_file = new_switch_file(open_localfile_adaptor(blob_path.c_str(), O_RDONLY));
+        ASSERT_NE(nullptr, sw_file);
+    }
+    virtual void TearDown() override {
+        delete sw_file;
+        system(("rm -rf " + test_dir).c_str());
+    }
+
+    // `src` is the source of the returned download, owned by it
+    TestDownload *new_download(uint32_t connections) {
+        src = new SourceFile(open_localfile_adaptor(blob_path.c_str(), O_RDONLY));
+        return new TestDownload(sw_file, src, file_size, dl_dir, digest, blob_path, running,
+                                    0, 1, bs, 0, connections);
+    }
+
+    // blocks read from the source, each once
+    std::set<size_t> blocks_read() {
+        std::set<size_t> blocks;
+        for (auto off : src->reads) {
+            blocks.insert(off / bs);
+        }
+        return blocks;
+    }
+
+    // write blocks [begin, end) to the download file of an interrupted download
+    void write_download(size_t begin, size_t end) {
+        auto file = open_localfile_adaptor((dl_dir + "/" + BKDL::DOWNLOAD_TMP_NAME).c_str(),
+                                           O_RDWR | O_CREAT, 0644);
+        ASSERT_NE(nullptr, file);
+        file->ftruncate(file_size);
+        for (size_t i = begin; i < end; i++) {
+            size_t n = std::min((size_t)bs, file_size - i * bs);
+            ASSERT_EQ((ssize_t)n, file->pwrite(data.data() + i * bs, n, i * bs));
+        }
+        delete file;
+    }
+
+    // the download is committed, and reads are switched to it
+    void check_committed() {
+        EXPECT_TRUE(BKDL::check_downloaded(dl_dir));
+        EXPECT_NE(0, ::access((dl_dir + "/" + BKDL::DOWNLOAD_BITMAP_NAME).c_str(), F_OK));
+        EXPECT_EQ(digest, sha256sum((dl_dir + "/" + COMMIT_FILE_NAME).c_str()));
+        std::vector<char> buf(file_size);
+        EXPECT_EQ((ssize_t)file_size, sw_file->pread(buf.data(), file_size, 0));
+        EXPECT_EQ(0, memcmp(data.data(), buf.data(), file_size));
+    }
+};
+
+TEST_F(BkDownloadTest, short_last_block) {
+    std::unique_ptr<TestDownload> dl(new_download(3));
+    ASSERT_TRUE(dl->download());
+    EXPECT_EQ(nblocks, src->reads.size());
+    EXPECT_EQ(nblocks, blocks_read().size());
+    check_committed();
+}
+
+TEST_F(BkDownloadTest, resume_partial_bitmap) {
+    // interrupted after 4 blocks are read
+    std::unique_ptr<TestDownload> dl(new_download(1));
+    src->fail = [&](off_t) {
+        if (src->reads.size() >= 4) {
+            running = 0;
+        }
+        return 0;
+    };
+    ASSERT_FALSE(dl->download());
+    EXPECT_EQ(4UL, blocks_read().size());
+    EXPECT_FALSE(BKDL::check_downloaded(dl_dir));
+
+    // blocks marked in the persisted bitmap are not read again
+    BKDL::DownloadBitmap bitmap(file_size, bs);
+    ASSERT_EQ(0, bitmap.open(dl_dir + "/" + BKDL::DOWNLOAD_BITMAP_NAME, false));
+    EXPECT_EQ(4UL, bitmap.count());
+    running = 1;
+    dl.reset(new_download(2));
+    ASSERT_TRUE(dl->download());
+    auto second = blocks_read();
+    EXPECT_EQ(nblocks - bitmap.count(), second.size());
+    for (size_t i = 0; i < nblocks; i++) {
+        EXPECT_NE(bitmap.test(i), second.count(i) == 1);
+    }
+    check_committed();
+}
+
+TEST_F(BkDownloadTest, bitmap_of_other_block_size) {
+    auto path = dl_dir + "/" + BKDL::DOWNLOAD_BITMAP_NAME;
+    {
+        BKDL::DownloadBitmap bitmap(file_size, bs);
+        ASSERT_EQ(0, bitmap.open(path, false));
+        bitmap.set(1);
+        bitmap.set(nblocks - 1);
+        auto file = open_localfile_adaptor(blob_path.c_str(), O_RDONLY);
+        EXPECT_EQ(0, bitmap.persist(file));
+        delete file;
+    }
+    BKDL::DownloadBitmap same(file_size, bs);
+    ASSERT_EQ(0, same.open(path, false));
+    EXPECT_EQ(2UL, same.count());
+    EXPECT_TRUE(same.test(nblocks - 1));
+    BKDL::DownloadBitmap other(file_size, bs * 2);
+    ASSERT_EQ(0, other.open(path, false));
+    EXPECT_EQ(0UL, other.count());
+}
+
+TEST_F(BkDownloadTest, skip_written_blocks) {
+    // blocks already in the download file, e.g. by download cache, are found by SEEK_HOLE
+    write_download(2, 4);
+    std::unique_ptr<TestDownload> dl(new_download(2));
+    ASSERT_TRUE(dl->download());
+    auto blocks = blocks_read();
+    EXPECT_EQ(nblocks - 2, blocks.size());
+    EXPECT_EQ(0UL, blocks.count(2));
+    EXPECT_EQ(0UL, blocks.count(3));
+    check_committed();
+}
+
+TEST_F(BkDownloadTest, retry_failed_read) {
+    // a read failed once is retried by the connection
+    std::set<off_t> failed;
+    std::unique_ptr<TestDownload> dl(new_download(2));
+    src->fail = [&](off_t offset) {
+        if (offset == 3 * bs && failed.insert(offset).second) {
+            return EIO;
+        }
+        return 0;
+    };
+    ASSERT_TRUE(dl->download());
+    EXPECT_EQ(nblocks + 1, src->reads.size());
+    check_committed();
+}
+
+TEST_F(BkDownloadTest, retry_failed_download) {
+    // a block failing all retries fails the download, which is resumed by the next one
+    std::unique_ptr<TestDownload> dl(new_download(2));
+    src->fail = [&](off_t offset) { return offset == 5 * bs ? EIO : 0; };
+    ASSERT_FALSE(dl->download());
+    EXPECT_EQ(2, std::count(src->reads.begin(), src->reads.end(), 5 * bs));
+    dl.reset(new_download(2));
+    ASSERT_TRUE(dl->download());
+    EXPECT_GT(nblocks - 1, blocks_read().size());
+    EXPECT_EQ(1UL, blocks_read().count(5));
+    check_committed();
+}
+
+TEST_F(BkDownloadTest, hash_out_of_order) {
+    // the first blocks are done last
+    std::unique_ptr<TestDownload> dl(new_download(4));
+    src->delay = [&](off_t offset) -> uint64_t {
+        return offset < 2 * bs ? 50 * 1000 : 1000;
+    };
+    ASSERT_TRUE(dl->download());
+    EXPECT_EQ(digest, dl->hashed_checksum());
+    check_committed();
+}
+
+TEST_F(BkDownloadTest, hash_resumed) {
+    // blocks of an earlier run are read back to be hashed, along with those out of order
+    write_download(3, 7);
+    {
+        BKDL::DownloadBitmap bitmap(file_size, bs);
+        ASSERT_EQ(0, bitmap.open(dl_dir + "/" + BKDL::DOWNLOAD_BITMAP_NAME, false));
+        auto file = open_localfile_adaptor((dl_dir + "/" + BKDL::DOWNLOAD_TMP_NAME).c_str(),
+                                           O_RDONLY);
+        for (size_t i = 3; i < 7; i++) {
+            bitmap.set(i);
+        }
+        EXPECT_EQ(0, bitmap.persist(file));
+        delete file;
+    }
+    std::unique_ptr<TestDownload> dl(new_download(2));
+    src->delay = [&](off_t offset) -> uint64_t { return offset == 0 ? 50 * 1000 : 1000; };
+    ASSERT_TRUE(dl->download());
+    EXPECT_EQ(nblocks - 4, blocks_read().size());
+    EXPECT_EQ(digest, dl->hashed_checksum());
+    check_committed();
+}
+
+TEST_F(BkDownloadTest, download_order) {
+    using Order = std::vector<std::pair<size_t, bool>>;
+    std::unique_ptr<TestDownload> dl(new_download(1));
+    // blocks of ranges not in the file are ignored, and those taken already
+    dl->set_hot_ranges({{5 * bs + 10, 100},
+                        {2 * bs, bs + 1},
+                        {(off_t)file_size, 10},
+                        {-1, bs},
+                        {5 * bs, 10},
+                        {7 * bs, bs - 1000}});
+    Order hot{{5, false}, {2, false}, {3, false}, {7, false}, {8, false}};
+    Order rest{{0, false}, {1, false}, {4, false}, {6, false}, {9, false}};
+    Order expected = hot;
+    expected.insert(expected.end(), rest.begin(), rest.end());
+    EXPECT_EQ(expected, dl->download_order(nblocks));
+
+    // all blocks are tried from the registry cache first
+    dl->set_cache_file(open_localfile_adaptor(blob_path.c_str(), O_RDONLY));
+    Order cached;
+    for (size_t i = 0; i < nblocks; i++) {
+        cached.emplace_back(i, true);
+    }
+    cached.insert(cached.end(), expected.begin(), expected.end());
+    EXPECT_EQ(cached, dl->download_order(nblocks));
+}
+
+struct SourceReader {
+    ISwitchFile *file;
+    ssize_t ret;
+    bool done;
+};
+
+static void *read_source(void *args) {
+    auto r = (SourceReader *)args;
+    char buf[4096];
+    r->ret = r->file->pread(buf, sizeof(buf), 0);
+    r->done = true;
+    return nullptr;
+}
+
+TEST_F(BkDownloadTest, release_source) {
+    auto commit_path = dl_dir + "/" + COMMIT_FILE_NAME;
+    system(("cp " + blob_path + " " + commit_path).c_str());
+    bool deleted = false;
+    auto source = new SourceFile(open_localfile_adaptor(blob_path.c_str(), O_RDONLY));
+    source->deleted = &deleted;
+    std::unique_ptr<ISwitchFile> sw(new_switch_file(source));
+    ASSERT_NE(nullptr, sw);
+    EXPECT_EQ(-1, sw->release_source(running));
+
+    // released after the read of it in flight
+    source->delay = [](off_t) -> uint64_t { return 50 * 1000; };
+    SourceReader reader{sw.get(), 0, false};
+    auto jh = photon::thread_enable_join(photon::thread_create(read_source, &reader));
+    photon::thread_yield();
+    sw->set_switch_file(commit_path.c_str());
+    EXPECT_EQ(0, sw->release_source(running));
+    EXPECT_TRUE(reader.done);
+    EXPECT_EQ(4096, reader.ret);
+    EXPECT_TRUE(deleted);
+    EXPECT_EQ(0, sw->release_source(running));
+    photon::thread_join(jh);
+
+    // or not, if it's stopped meanwhile
+    source = new SourceFile(open_localfile_adaptor(blob_path.c_str(), O_RDONLY));
+    sw.reset(new_switch_file(source));
+    ASSERT_NE(nullptr, sw);
+    source->delay = [](off_t) -> uint64_t { return 50 * 1000; };
+    reader = {sw.get(), 0, false};
+    jh = photon::thread_enable_join(photon::thread_create(read_source, &reader));
+    photon::thread_yield();
+    sw->set_switch_file(commit_path.c_str());
+    int stopped = 0;
+    EXPECT_EQ(-1, sw->release_source(stopped));
+    EXPECT_EQ(ECANCELED, errno);
+    photon::thread_join(jh);
+    EXPECT_EQ(4096, reader.ret);
+}
+
+// the time in ms of throttle()s of `bytes` each
+static uint64_t throttle_ms(BKDL::DownloadScheduler &s, std::vector<size_t> bytes) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto n : bytes) {
+        s.throttle(n);
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now() - start).count();
+}
+
+TEST(DownloadScheduler, throttle) {
+    // each waits for the bandwidth reserved before it, of 1MB, 2MB and 1MB at 16MB/s
+    BKDL::DownloadScheduler s(16, 0, 0);
+    auto ms = throttle_ms(s, {1 << 20, 2 << 20, 1 << 20, 4096});
+    EXPECT_LE(240UL, ms);
+    EXPECT_GT(400UL, ms);
+    BKDL::DownloadScheduler unlimited(0, 0, 0);
+    EXPECT_GT(50UL, throttle_ms(unlimited, {64 << 20, 64 << 20}));
+}
+
+TEST(DownloadScheduler, backoff) {
+    const size_t MB = 1 << 20;
+    // halved to 8MB/s by a slow small read
+    BKDL::DownloadScheduler slow(16, 0, 100);
+    slow.report_foreground(500 * 1000, 4096);
+    EXPECT_LE(240UL, throttle_ms(slow, {2 * MB, 4096}));
+    // a large read of the same time is fast enough per MB
+    BKDL::DownloadScheduler fast(16, 0, 100);
+    fast.report_foreground(500 * 1000, 16 * MB);
+    EXPECT_GT(190UL, throttle_ms(fast, {2 * MB, 4096}));
+    // no backoff at all
+    BKDL::DownloadScheduler off(16, 0, 0);
+    off.report_foreground(500 * 1000, 4096);
+    EXPECT_GT(190UL, throttle_ms(off, {2 * MB, 4096}));
+}
+
+struct Waiter {
+    BKDL::DownloadScheduler *s;
+    std::atomic<uint64_t> last_read;
+    int running;
+    bool acquired;
+    std::vector<Waiter *> *order;
+};
+
+static void *acquire(void *args) {
+    auto w = (Waiter *)args;
+    w->acquired = w->s->acquire(&w->last_read, w->running);
+    w->order->push_back(w);
+    return nullptr;
+}
+
+TEST(DownloadScheduler, acquire) {
+    BKDL::DownloadScheduler s(0, 1, 0);
+    std::vector<Waiter *> order;
+    Waiter a{&s, {1}, 1, false, &order}, b{&s, {5}, 1, false, &order},
+        c{&s, {9}, 1, false, &order};
+    acquire(&a);
+    EXPECT_TRUE(a.acquired);
+    auto jb = photon::thread_enable_join(photon::thread_create(acquire, &b));
+    auto jc = photon::thread_enable_join(photon::thread_create(acquire, &c));
+    photon::thread_usleep(10 * 1000);
+    EXPECT_EQ(1UL, order.size());
+
+    // the slot released goes to the one read most recently, at once
+    auto start = std::chrono::steady_clock::now();
+    s.release();
+    while (order.size() < 2) {
+        photon::thread_usleep(1000);
+    }
+    EXPECT_GT(std::chrono::milliseconds(100), std::chrono::steady_clock::now() - start);
+    EXPECT_EQ(&c, order[1]);
+    EXPECT_TRUE(c.acquired);
+
+    // one waiting gives up once its image exits
+    b.running = 0;
+    photon::thread_join(jb);
+    EXPECT_FALSE(b.acquired);
+    s.release();
+    photon::thread_join(jc);
+}
+
+int main(int argc, char **argv) {
+    photon::init(photon::INIT_EVENT_DEFAULT, photon::INIT_IO_DEFAULT);
+    DEFER(photon::fini());
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
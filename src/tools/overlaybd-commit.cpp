@@ -49,6 +49,9 @@ bool build_turboOCI = false;
 bool build_fastoci = false;
 bool tar = false, rm_old = false, seal = false, commit_sealed = false;
 bool verbose = false;
+bool raw_block = false;
+bool compact_index = false;
+std::string checksum;
 int compress_threads = 1;
 std::string upload_url, cred_file_path, tls_key_path, tls_cert_path;
 ssize_t upload_bs = 262144;
@@ -76,6 +79,9 @@ int main(int argc, char **argv) {
     app.add_option(
            "--bs", block_size,
            "The size of a data block in KB. Must be a power of two between 4K~64K [4/8/16/32/64](default 4)");
+    app.add_flag("--raw_block", raw_block, "store incompressible blocks uncompressed")->default_val(false);
+    app.add_option("--checksum", checksum, "checksum of each zfile block, [crc32c|xxh64](default crc32c)");
+    app.add_flag("--compact_index", compact_index, "write zfile index as pages loaded on demand")->default_val(false);
     app.add_flag("--turboOCI", build_turboOCI, "commit using turboOCIv1 format")->default_val(false);
     app.add_flag("--fastoci", build_fastoci, "commit using turboOCIv1 format (depracated)")->default_val(false);
     app.add_option("data_file", data_file_path, "data file path")->type_name("FILEPATH")->check(CLI::ExistingFile)->required();
@@ -160,6 +166,13 @@ int main(int argc, char **argv) {
             fprintf(stderr, "invalid '--bs' parameters.\n");
             exit(-1);
         }
+        opt.raw_block = raw_block;
+        if (checksum == "xxh64") {
+            opt.checksum = ZFile::CompressOptions::XXH64;
+        } else if (checksum != "" && checksum != "crc32c") {
+            fprintf(stderr, "invalid '--checksum' parameters.\n");
+            exit(-1);
+        }
         IFileSystem *fs = lfs;
         if (tar) {
             fs = new_tar_fs_adaptor(fs);
@@ -171,6 +184,7 @@ int main(int argc, char **argv) {
         zfile_args = new ZFile::CompressArgs(opt);
         zfile_args->workers = compress_threads;
         zfile_args->overwrite_header = true;
+        zfile_args->compact_index = compact_index;
 
         if (!upload_url.empty()) {
             LOG_INFO("enable upload. URL: `, upload_bs: `, tls_key_path: `, tls_cert_path: `", upload_url, upload_bs, tls_key_path, tls_cert_path);
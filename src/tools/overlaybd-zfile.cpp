@@ -61,13 +61,13 @@ IFile *new_streamFile(){
     return new IStreamFile;
 }
 
-int verify_crc(IFile* src_file) {
+int verify_crc(IFile* src_file, int threads) {
 
     if (is_zfile(src_file) != 1) {
         fprintf(stderr, "format error! <source_file> should be a zfile.\n");
         exit(-1);
     }
-    return zfile_validation_check(src_file);
+    return zfile_validation_check(src_file, threads);
 }
 
 int main(int argc, char **argv) {
@@ -76,9 +76,13 @@ int main(int argc, char **argv) {
     bool tar = false;
     bool extract = false;
     bool verify = false;
+    bool raw_block = false;
+    bool compact_index = false;
     std::string fn_src, fn_dst;
     std::string algorithm;
+    std::string checksum;
     int block_size;
+    int threads;
     bool verbose = false;
 
     CLI::App app{"this is a zfile tool to create/extract zfile"};
@@ -87,10 +91,15 @@ int main(int argc, char **argv) {
     app.add_flag("--verify", verify, "verify checksum of {source_file}")->default_val(false);
     app.add_flag("-f", rm_old, "force compress. unlink exist")->default_val(false);
     app.add_option("--algorithm", algorithm, "compress algorithm, [lz4|zstd]")->default_str("lz4");
+    app.add_option("--checksum", checksum, "checksum of each block, [crc32c|xxh64]")->default_str("crc32c");
     app.add_option(
            "--bs", block_size,
            "The size of a data block in KB. Must be a power of two between 4K~64K [4/8/16/32/64])")
         ->default_val(4);
+    app.add_option("--threads", threads, "number of threads to compress/decompress/verify with")
+        ->default_val(1);
+    app.add_flag("--raw_block", raw_block, "store incompressible blocks uncompressed")->default_val(false);
+    app.add_flag("--compact_index", compact_index, "write index as pages loaded on demand")->default_val(false);
     app.add_option("source_file", fn_src, "source file path")
         ->type_name("FILEPATH")
         // ->check(CLI::ExistingFile)
@@ -118,7 +127,7 @@ int main(int argc, char **argv) {
             fprintf(stderr, "failed to open file %s\n", fn_src.c_str());
             exit(-1);
         }
-        if (verify_crc(new_tar_file_adaptor(file))!=0) {
+        if (verify_crc(new_tar_file_adaptor(file), threads)!=0) {
             printf("%s is not a valid zfile blob or checksum can't be found.\n", fn_src.c_str());
             return -1;
         }
@@ -135,6 +144,7 @@ int main(int argc, char **argv) {
 
     CompressOptions opt;
     opt.verify = 1;
+    opt.raw_block = raw_block;
     if (algorithm == "lz4") {
         opt.algo = CompressOptions::LZ4;
     } else if (algorithm == "zstd") {
@@ -145,6 +155,12 @@ int main(int argc, char **argv) {
         fprintf(stderr, "invalid '--bs' parameters.\nj");
         exit(-1);
     }
+    if (checksum == "xxh64") {
+        opt.checksum = CompressOptions::XXH64;
+    } else if (!checksum.empty() && checksum != "crc32c") {
+        fprintf(stderr, "invalid '--checksum' parameters.\n");
+        exit(-1);
+    }
     if (rm_old) {
         lfs->unlink(fn_dst.c_str());
     }
@@ -154,6 +170,8 @@ int main(int argc, char **argv) {
     }
     int ret = 0;
     CompressArgs args(opt);
+    args.workers = threads;
+    args.compact_index = compact_index;
     if (!extract) {
         printf("compress file %s as %s\n", fn_src.c_str(), fn_dst.c_str());
         IFile *infile = (!pipe ? lfs->open(fn_src.c_str(), O_RDONLY) : new_streamFile() );
@@ -195,7 +213,7 @@ int main(int argc, char **argv) {
         }
         DEFER(delete outfile);
 
-        ret = zfile_decompress(infile, outfile);
+        ret = zfile_decompress(infile, outfile, threads);
         if (ret != 0) {
             fprintf(stderr, "decompress failed, errno:%d\n", errno);
             exit(-1);
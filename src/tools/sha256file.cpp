@@ -68,6 +68,33 @@ SHA256File *new_sha256_file(IFile *file, bool ownership = true) {
     return new SHA256CheckedFile(file, ownership);
 }
 
+class SHA256StreamImpl : public SHA256Stream {
+public:
+    SHA256_CTX ctx = {0};
+
+    SHA256StreamImpl() {
+        SHA256_Init(&ctx);
+    }
+    int update(const void *buf, size_t count) override {
+        if (SHA256_Update(&ctx, buf, count) != 1) {
+            LOG_ERROR_RETURN(0, -1, "sha256 calculate error");
+        }
+        return 0;
+    }
+    std::string sha256_checksum() override {
+        unsigned char sha[32];
+        SHA256_Final(sha, &ctx);
+        char res[SHA256_DIGEST_LENGTH * 2 + 1];
+        for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+            sprintf(res + (i * 2), "%02x", sha[i]);
+        return "sha256:" + std::string(res, SHA256_DIGEST_LENGTH * 2);
+    }
+};
+
+SHA256Stream *new_sha256_stream() {
+    return new SHA256StreamImpl();
+}
+
 string sha256sum(const char *fn) {
     constexpr size_t BUFFERSIZE = 65536;
     // auto file = open_localfile_adaptor(fn, O_RDONLY | O_DIRECT);
@@ -11,4 +11,15 @@ public:
 
 SHA256File *new_sha256_file(photon::fs::IFile *file, bool ownership);
 
+// digest of data fed in order, e.g. while it's being downloaded
+class SHA256Stream {
+public:
+    virtual ~SHA256Stream() = default;
+    virtual int update(const void *buf, size_t count) = 0;
+    // returns "sha256:<hex>", no update is allowed after it
+    virtual std::string sha256_checksum() = 0;
+};
+
+SHA256Stream *new_sha256_stream();
+
 std::string sha256sum(const char *fn);